@@ -1,5 +1,16 @@
 #pragma once
+#include "bt_compare.h"
+#include "bt_diff.h"
+#include "bt_dispatch.h"
+#include "bt_json.h"
+#include "bt_merge.h"
+#include "bt_path.h"
 #include "bt_producer.h"
+#include "bt_push_parser.h"
+#include "bt_segmented.h"
 #include "bt_serialize.h"
+#include "bt_signature_batch.h"
+#include "bt_struct.h"
+#include "bt_validate.h"
 #include "bt_value.h"
 #include "bt_value_producer.h"
@@ -11,7 +11,8 @@ concept signverify_func_input = detail::char_view_type<T> || const_span_type<T>;
 
 template <typename Func, typename F = std::remove_reference_t<Func>>
 concept lambda_function =
-        !(std::is_function_v<F> || std::is_pointer_v<F> || std::is_member_pointer_v<F>);
+        !(std::is_function_v<F> || std::is_pointer_v<F> || std::is_member_pointer_v<F>) &&
+        requires { &F::operator(); };
 
 template <typename>
 struct function_traits;
@@ -0,0 +1,230 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <compare>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "bt_serialize.h"
+#include "bt_validate.h"
+#include "bt_value.h"
+#include "span.h"
+
+namespace oxenc {
+
+/** \file
+ * Equality, ordering and hashing of encoded values by what they mean rather than by their bytes.
+ *
+ * Two encodings are equal when they decode to the same value: `i7e` equals `i007e`, `i0e` equals
+ * `i-0e`, `3:abc` equals `03:abc`, and dicts are equal regardless of the order their keys are
+ * encoded in.  (As when decoding into a bt_value, only the first of duplicate dict keys counts).
+ * Every value has exactly one canonical encoding, so all of this is defined by comparing canonical
+ * encodings, and when the inputs already are canonical -- as anything encoded by this library is
+ * -- that is just a byte comparison.  The canonical check is a single bt_validate pass; only
+ * non-canonical input gets re-encoded (into a temporary string) before being compared or hashed.
+ *
+ * All of these throw bt_deserialize_invalid if given something that is not a single valid encoded
+ * value, nested no more than bt_default_max_depth levels deep.
+ */
+
+namespace detail {
+
+    /// Returns true if `s` is a valid, canonically encoded value, false if it is valid but not
+    /// canonical (it may turn out to be invalid further on: the check stops at the first
+    /// non-canonical encoding).  Throws if it is invalid.
+    inline bool bt_is_canonical(std::string_view s) {
+        auto err = bt_validate(s, {.max_depth = bt_default_max_depth, .canonical = true});
+        if (err.code == bt_errc::not_canonical)
+            return false;
+        if (err)
+            throw_bt_error(err);
+        return true;
+    }
+
+    inline void bt_append_string(std::string& out, std::string_view str) {
+        char buf[20];
+        auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), str.size());
+        out.append(buf, end);
+        out += ':';
+        out += str;
+    }
+
+    /// Consumes a single value from the front of `s`, appending its canonical encoding to `out`.
+    /// On failure `s` is left pointing at the location of the error.
+    inline bt_errc bt_canonicalize(std::string_view& s, std::string& out, size_t depth = 0) {
+        if (s.empty())
+            return bt_errc::unexpected_end;
+
+        if (s[0] == 'i') {
+            std::pair<some64, bool> result;
+            if (auto ec = bt_deserialize_integer(s, result); ec != bt_errc::ok)
+                return ec;
+            auto [v, negative] = result;
+            char buf[20];
+            auto [end, ec] = negative ? std::to_chars(buf, buf + sizeof(buf), v.i64)
+                                      : std::to_chars(buf, buf + sizeof(buf), v.u64);
+            out += 'i';
+            out.append(buf, end);
+            out += 'e';
+            return bt_errc::ok;
+        }
+
+        if (s[0] != 'l' && s[0] != 'd') {
+            std::string_view str;
+            if (auto ec = bt_deserialize<std::string_view>{}(s, str); ec != bt_errc::ok)
+                return ec;
+            bt_append_string(out, str);
+            return bt_errc::ok;
+        }
+
+        if (depth >= bt_default_max_depth)
+            return bt_errc::depth_limit;
+        const bool dict = s[0] == 'd';
+        out += s[0];
+        s.remove_prefix(1);
+
+        // Where each dict entry (key and value) ended up in `out`, so that they can be reordered
+        struct entry {
+            std::string_view key;
+            size_t begin, end;
+        };
+        std::vector<entry> entries;
+        bool sorted = true;
+        const size_t start = out.size();
+
+        for (;;) {
+            if (s.empty())
+                return bt_errc::unexpected_end;
+            if (s[0] == 'e')
+                break;
+            if (!dict) {
+                if (auto ec = bt_canonicalize(s, out, depth + 1); ec != bt_errc::ok)
+                    return ec;
+                continue;
+            }
+            entry e{{}, out.size(), 0};
+            if (auto ec = bt_deserialize<std::string_view>{}(s, e.key); ec != bt_errc::ok)
+                return ec;
+            if (s.empty())
+                return bt_errc::unexpected_end;
+            if (s[0] == 'e')
+                return bt_errc::invalid_value;  // key isn't followed by a value
+            if (!entries.empty() && e.key <= entries.back().key)
+                sorted = false;
+            bt_append_string(out, e.key);
+            if (auto ec = bt_canonicalize(s, out, depth + 1); ec != bt_errc::ok)
+                return ec;
+            e.end = out.size();
+            entries.push_back(e);
+        }
+        s.remove_prefix(1);
+
+        if (!sorted) {
+            // The stable sort keeps duplicate keys in order, so that we keep the first of them
+            std::stable_sort(entries.begin(), entries.end(), [](const entry& a, const entry& b) {
+                return a.key < b.key;
+            });
+            std::string encoded = out.substr(start);
+            out.resize(start);
+            for (size_t i = 0; i < entries.size(); i++) {
+                auto& e = entries[i];
+                if (i > 0 && e.key == entries[i - 1].key)
+                    continue;
+                out.append(encoded, e.begin - start, e.end - e.begin);
+            }
+        }
+        out += 'e';
+        return bt_errc::ok;
+    }
+
+    /// Re-encodes `s` canonically into `buf`, returning a view of it.  Throws if `s` is not a
+    /// single valid value.
+    inline std::string_view bt_reencode(std::string_view s, std::string& buf) {
+        std::string_view in{s};
+        buf.clear();
+        buf.reserve(s.size());
+        auto ec = bt_canonicalize(in, buf);
+        if (ec == bt_errc::ok && !in.empty())
+            ec = bt_errc::trailing_data;
+        if (ec != bt_errc::ok)
+            throw_bt_error({ec, static_cast<size_t>(in.data() - s.data())});
+        return buf;
+    }
+
+    /// Returns `s` itself if it is canonically encoded, otherwise re-encodes it into `buf` and
+    /// returns a view of that.
+    inline std::string_view bt_canonical_view(std::string_view s, std::string& buf) {
+        return bt_is_canonical(s) ? s : bt_reencode(s, buf);
+    }
+
+}  // namespace detail
+
+/// Returns true if `a` and `b` encode the same value, even if one or both of them are not
+/// canonically encoded.  If both are canonical this amounts to `a == b`.
+///
+///     bt_equal("d1:ai1e1:bi2ee", "d1:bi2e1:ai01ee"); // true
+inline bool bt_equal(std::string_view a, std::string_view b) {
+    if (a == b) {
+        if (auto err = bt_validate(a, {.max_depth = bt_default_max_depth}))
+            detail::throw_bt_error(err);
+        return true;
+    }
+    std::string abuf, bbuf;
+    bool a_canonical = detail::bt_is_canonical(a), b_canonical = detail::bt_is_canonical(b);
+    if (a_canonical && b_canonical)
+        return false;  // Different canonical encodings always mean different values
+    return (a_canonical ? a : detail::bt_reencode(a, abuf)) ==
+           (b_canonical ? b : detail::bt_reencode(b, bbuf));
+}
+
+/// Three-way comparison of two encoded values, consistent with bt_equal.  This is a total order
+/// suitable for sorting and for ordered containers, but it is the byte order of the canonical
+/// encodings rather than anything more meaningful: integers, for instance, do not sort
+/// numerically (`i10e` sorts before `i9e`), and values of different types sort by type (strings,
+/// then dicts, then integers, then lists).
+inline std::strong_ordering bt_compare(std::string_view a, std::string_view b) {
+    std::string abuf, bbuf;
+    return detail::bt_canonical_view(a, abuf) <=> detail::bt_canonical_view(b, bbuf);
+}
+
+/// Hashes an encoded value such that values that are bt_equal hash the same.  For canonical input
+/// this is `std::hash<std::string_view>` of the encoded value, and is also the same as the
+/// `std::hash` of the bt_value it decodes to.
+inline size_t bt_hash(std::string_view s) {
+    std::string buf;
+    return std::hash<std::string_view>{}(detail::bt_canonical_view(s, buf));
+}
+
+template <const_span_type SpanA, const_span_type SpanB>
+bool bt_equal(SpanA a, SpanB b) {
+    return bt_equal(detail::span_to_sv(a), detail::span_to_sv(b));
+}
+template <const_span_type SpanA, const_span_type SpanB>
+std::strong_ordering bt_compare(SpanA a, SpanB b) {
+    return bt_compare(detail::span_to_sv(a), detail::span_to_sv(b));
+}
+template <const_span_type SpanT>
+size_t bt_hash(SpanT s) {
+    return bt_hash(detail::span_to_sv(s));
+}
+
+/// Hash and equality function objects for keying unordered containers by encoded values, e.g. to
+/// deduplicate messages that may not all be canonically encoded:
+///
+///     std::unordered_set<std::string, bt_encoded_hash, bt_encoded_equal> seen;
+///     if (!seen.insert(msg).second)
+///         return;  // duplicate
+struct bt_encoded_hash {
+    using is_transparent = void;
+    size_t operator()(std::string_view s) const { return bt_hash(s); }
+};
+struct bt_encoded_equal {
+    using is_transparent = void;
+    bool operator()(std::string_view a, std::string_view b) const { return bt_equal(a, b); }
+};
+
+}  // namespace oxenc
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include "bt_producer.h"
+#include "bt_serialize.h"
+
+namespace oxenc {
+
+/** \file
+ * Structural diffs of encoded dicts, for sending just the changes to a large dict rather than the
+ * whole thing.  bt_diff(old, new) produces a *delta*, which bt_apply(old, delta) turns back into
+ * `new`.  A delta is itself an encoded dict, containing just the keys that changed, each with one
+ * of:
+ *
+ * - `l<value>e` -- a list of one value: the key is set to that value (whether or not it existed)
+ * - `le` -- an empty list: the key is deleted
+ * - `d...e` -- a dict: the key holds a dict in both, and this is the (nested) delta between them
+ *
+ * For example the delta from `d1:ai1e1:bi2e1:cd1:xi1e1:yi2eee` to `d1:ai1e1:cd1:xi1e1:yi3ee1:di4ee`
+ * is `d1:ble1:cd1:yli3eee1:dli4eee`.  The delta of identical dicts is `de`.
+ *
+ * Both directions are single linear merge-walks over their (sorted) input dicts, and values are
+ * compared and copied as raw encoded data, without being decoded.  Since values are compared by
+ * their encoding, the inputs should be canonically encoded (as everything this library encodes
+ * is): otherwise equal values that are encoded differently count as changed.
+ */
+
+namespace detail {
+
+    inline void bt_diff_impl(
+            bt_dict_consumer& old, bt_dict_consumer& now, bt_dict_producer& out, size_t depth) {
+        if (depth >= bt_default_max_depth)
+            throw_bt_depth_limit();
+        for (;;) {
+            bool have_old = !old.is_finished(), have_new = !now.is_finished();
+            if (!have_old && !have_new)
+                break;
+            int cmp = !have_old ? 1 : !have_new ? -1 : old.key().compare(now.key());
+            if (cmp < 0) {
+                out.append_list(old.next_value_data().first);  // deleted
+                continue;
+            }
+            std::string_view o;
+            if (cmp == 0)
+                o = old.consume_value_data();
+            auto [key, n] = now.next_value_data();
+            if (o == n)
+                continue;
+            if (!o.empty() && o[0] == 'd' && n[0] == 'd') {
+                // Send the nested delta instead if that is smaller than the whole new value
+                bt_dict_consumer oc{o}, nc{n};
+                bt_dict_producer sub;
+                bt_diff_impl(oc, nc, sub, depth + 1);
+                if (sub.view().size() < n.size() + 2) {
+                    out.append_encoded(key, sub.view());
+                    continue;
+                }
+            }
+            auto set = out.append_list(key);
+            set.append_encoded(n);
+        }
+    }
+
+    [[noreturn]] inline void bt_invalid_delta(std::string_view key, std::string_view problem) {
+        throw std::invalid_argument{
+                "Invalid bt delta: key '" + std::string{key} + "' " + std::string{problem}};
+    }
+
+    inline void bt_apply_impl(
+            bt_dict_consumer& old, bt_dict_consumer& delta, bt_dict_producer& out, size_t depth) {
+        if (depth >= bt_default_max_depth)
+            throw_bt_depth_limit();
+        for (;;) {
+            bool have_old = !old.is_finished(), have_delta = !delta.is_finished();
+            if (!have_old && !have_delta)
+                break;
+            int cmp = !have_old ? 1 : !have_delta ? -1 : old.key().compare(delta.key());
+            if (cmp < 0) {
+                auto [key, o] = old.next_value_data();  // unchanged
+                out.append_encoded(key, o);
+                continue;
+            }
+            std::string_view o;
+            if (cmp == 0)
+                o = old.consume_value_data();
+            if (delta.is_dict()) {
+                auto [key, d] = delta.next_dict_consumer();
+                if (o.empty() || o[0] != 'd')
+                    bt_invalid_delta(key, "is not a dict to be patched");
+                bt_dict_consumer oc{o};
+                auto sub = out.append_dict(key);
+                bt_apply_impl(oc, d, sub, depth + 1);
+                continue;
+            }
+            if (!delta.is_list())
+                bt_invalid_delta(delta.key(), "is neither a list nor a dict");
+            auto [key, op] = delta.next_list_consumer();
+            if (op.is_finished())
+                continue;  // deleted
+            auto n = op.consume_value_data();
+            if (!op.is_finished())
+                bt_invalid_delta(key, "has more than one value");
+            out.append_encoded(key, n);
+        }
+    }
+
+}  // namespace detail
+
+/// Appends the delta between encoded dicts `old` and `now` (see above) to `out`.  Throws (as the
+/// consumers do) if either is not a valid dict.
+inline void bt_diff(bt_dict_consumer old, bt_dict_consumer now, bt_dict_producer& out) {
+    detail::bt_diff_impl(old, now, out, 0);
+}
+
+inline void bt_diff(std::string_view old, std::string_view now, bt_dict_producer& out) {
+    bt_diff(bt_dict_consumer{old}, bt_dict_consumer{now}, out);
+}
+
+/// Returns the encoded delta between encoded dicts `old` and `now`.
+inline std::string bt_diff(std::string_view old, std::string_view now) {
+    bt_dict_producer out;
+    bt_diff(bt_dict_consumer{old}, bt_dict_consumer{now}, out);
+    return std::move(out).str();
+}
+
+/// Applies `delta`, as produced by bt_diff(), to the encoded dict `old`, appending the resulting
+/// dict's keys and values to `out`.  Values that the delta doesn't touch are copied as encoded.
+/// Throws std::invalid_argument if the delta is malformed or contains a nested delta for a key that
+/// is not a dict in `old` (i.e. the delta was made from a different `old`), and as the consumers do
+/// if `old` or `delta` is not a valid dict.
+inline void bt_apply(bt_dict_consumer old, bt_dict_consumer delta, bt_dict_producer& out) {
+    detail::bt_apply_impl(old, delta, out, 0);
+}
+
+inline void bt_apply(std::string_view old, std::string_view delta, bt_dict_producer& out) {
+    bt_apply(bt_dict_consumer{old}, bt_dict_consumer{delta}, out);
+}
+
+/// Applies `delta` to `old`, returning the resulting encoded dict.
+///
+///     auto delta = bt_diff(old_state, new_state);
+///     ...
+///     assert(bt_apply(old_state, delta) == new_state);
+inline std::string bt_apply(std::string_view old, std::string_view delta) {
+    bt_dict_producer out{old.size() + delta.size()};
+    bt_apply(bt_dict_consumer{old}, bt_dict_consumer{delta}, out);
+    return std::move(out).str();
+}
+
+}  // namespace oxenc
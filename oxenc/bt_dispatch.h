@@ -0,0 +1,187 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <concepts>
+#include <cstddef>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "bt_serialize.h"
+#include "bt_struct.h"
+
+namespace oxenc {
+
+/// Handler for dict key `Key` in consume_dict_dispatch(); create it with `bt_on<"key">(f)`.
+template <bt_key_literal Key, typename F>
+struct bt_key_handler {
+    static constexpr std::string_view key = Key.view();
+    F f;
+};
+
+/// Catch-all handler in consume_dict_dispatch(); create it with `bt_on_other(f)`.
+template <typename F>
+struct bt_other_handler {
+    F f;
+};
+
+/// Returns a consume_dict_dispatch() handler for dict key `Key`.  If `f` takes a
+/// `bt_dict_consumer&` it is called with the consumer positioned at the value, which it may consume
+/// however it likes; otherwise `f` must take a single argument of some type T, and is called with
+/// the value consumed as `consumer.consume<T>()`.
+template <bt_key_literal Key, typename F>
+bt_key_handler<Key, std::decay_t<F>> bt_on(F&& f) {
+    return {std::forward<F>(f)};
+}
+
+/// Returns a catch-all consume_dict_dispatch() handler, called as `f(key, consumer)` for keys that
+/// do not have a handler of their own.
+template <typename F>
+bt_other_handler<std::decay_t<F>> bt_on_other(F&& f) {
+    return {std::forward<F>(f)};
+}
+
+namespace detail {
+    template <typename T>
+    inline constexpr bool is_bt_key_handler = false;
+    template <bt_key_literal Key, typename F>
+    inline constexpr bool is_bt_key_handler<bt_key_handler<Key, F>> = true;
+
+    template <typename T>
+    inline constexpr bool is_bt_other_handler = false;
+    template <typename F>
+    inline constexpr bool is_bt_other_handler<bt_other_handler<F>> = true;
+
+    struct bt_dispatch_entry {
+        std::string_view key;
+        size_t handler;  // Index of the handler in the consume_dict_dispatch arguments
+    };
+
+    template <typename H>
+    constexpr std::string_view bt_handler_key() {
+        if constexpr (is_bt_key_handler<H>)
+            return H::key;
+        else
+            return {};
+    }
+
+    // The keyed handlers, sorted by key.
+    template <typename... Handlers>
+    inline constexpr auto bt_dispatch_keys = [] {
+        std::array<bt_dispatch_entry, (size_t{is_bt_key_handler<Handlers>} + ... + 0)> keys{};
+        size_t i = 0, h = 0;
+        ((is_bt_key_handler<Handlers> ? (void)(keys[i++] = {bt_handler_key<Handlers>(), h++})
+                                      : (void)h++),
+         ...);
+        std::sort(keys.begin(), keys.end(), [](const auto& a, const auto& b) {
+            return a.key < b.key;
+        });
+        return keys;
+    }();
+
+    template <typename... Handlers>
+    constexpr size_t bt_other_handler_index() {
+        size_t i = 0, h = 0;
+        ((is_bt_other_handler<Handlers> ? (void)(i = h++) : (void)h++), ...);
+        return i;
+    }
+
+    template <typename H>
+    void bt_dispatch_call(H& handler, bt_dict_consumer& d) {
+        using F = decltype(handler.f);
+        // Checking that an rvalue doesn't work excludes handlers taking a value that a consumer
+        // happens to convert to (such as an `int`, via the consumer's `operator bool`).
+        if constexpr (
+                std::invocable<F&, bt_dict_consumer&> && !std::invocable<F&, bt_dict_consumer&&>)
+            handler.f(d);
+        else
+            handler.f(d.consume<typename function_traits<F>::template argument_type<0>>());
+    }
+
+    // Jump table of handler invocations, in sorted key order.
+    template <typename Tuple, typename... Handlers>
+    inline constexpr auto bt_dispatch_calls = []<size_t... J>(std::index_sequence<J...>) {
+        using call_t = void (*)(Tuple&, bt_dict_consumer&);
+        return std::array<call_t, sizeof...(J)>{[](Tuple& hs, bt_dict_consumer& d) {
+            bt_dispatch_call(std::get<bt_dispatch_keys<Handlers...>[J].handler>(hs), d);
+        }...};
+    }(std::make_index_sequence<bt_dispatch_keys<Handlers...>.size()>{});
+}  // namespace detail
+
+/// Consumes the remaining key-value pairs of a dict consumer, passing each one to the handler for
+/// its key.  Keys without a handler are passed to the `bt_on_other` handler, if given, and
+/// otherwise skipped; values that a handler leaves unconsumed are skipped as well.  Returns when
+/// the end of the dict is reached.
+///
+///     consume_dict_dispatch(
+///             d,
+///             bt_on<"host">([&](std::string_view h) { host = h; }),
+///             bt_on<"port">([&](uint16_t p) { port = p; }),
+///             bt_on<"tags">([&](bt_dict_consumer& d) { tags = d.consume_list<tag_set>(); }),
+///             bt_on_other([&](std::string_view key, bt_dict_consumer&) { log_unknown(key); }));
+///
+/// This replaces chains of `if (key == "a") ... else if (key == "b") ...`, whose cost for each key
+/// grows with the number of handlers: the handler keys are sorted at compile time and, since
+/// encoded dict keys are sorted too, matched to the input with a single merge pass (so each key
+/// costs amortized O(1) comparisons) and dispatched through a jump table.  Unsorted input still
+/// works, it just costs a binary search whenever the key order goes backwards.
+///
+/// Exceptions thrown while parsing, or by the handlers, propagate to the caller.
+template <typename... Handlers>
+void consume_dict_dispatch(bt_dict_consumer& d, Handlers&&... handlers) {
+    constexpr auto& keys = detail::bt_dispatch_keys<std::remove_cvref_t<Handlers>...>;
+    constexpr size_t other_count =
+            (size_t{detail::is_bt_other_handler<std::remove_cvref_t<Handlers>>} + ... + 0);
+    static_assert(
+            keys.size() + other_count == sizeof...(Handlers),
+            "consume_dict_dispatch handlers must be created with bt_on<...>() or bt_on_other()");
+    static_assert(other_count <= 1, "consume_dict_dispatch takes at most one bt_on_other handler");
+    static_assert(
+            std::adjacent_find(keys.begin(), keys.end(), [](const auto& a, const auto& b) {
+                return a.key == b.key;
+            }) == keys.end(),
+            "consume_dict_dispatch handler keys must be unique");
+
+    auto hs = std::forward_as_tuple(handlers...);
+    constexpr auto& calls =
+            detail::bt_dispatch_calls<decltype(hs), std::remove_cvref_t<Handlers>...>;
+
+    size_t next = 0;  // Position in `keys` of the first handler key >= the last input key
+    std::string_view last;
+    while (!d.is_finished()) {
+        auto key = d.key();
+        if (key < last)
+            next = static_cast<size_t>(
+                    std::lower_bound(
+                            keys.begin(),
+                            keys.end(),
+                            key,
+                            [](const auto& e, std::string_view k) { return e.key < k; }) -
+                    keys.begin());
+        else
+            while (next < keys.size() && keys[next].key < key)
+                ++next;
+        last = key;
+
+        if (next < keys.size() && keys[next].key == key) {
+            calls[next](hs, d);
+        } else {
+            if constexpr (other_count > 0)
+                std::get<detail::bt_other_handler_index<std::remove_cvref_t<Handlers>...>()>(hs)
+                        .f(key, d);
+        }
+
+        // If the handler didn't consume the value then we are still at the same key
+        if (!d.is_finished() && d.key().data() == key.data())
+            d.skip_value();
+    }
+}
+
+template <typename... Handlers>
+void consume_dict_dispatch(bt_dict_consumer&& d, Handlers&&... handlers) {
+    consume_dict_dispatch(d, std::forward<Handlers>(handlers)...);
+}
+
+}  // namespace oxenc
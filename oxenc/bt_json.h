@@ -0,0 +1,577 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include "base64.h"
+#include "bt_producer.h"
+#include "bt_serialize.h"
+#include "hex.h"
+
+namespace oxenc {
+
+/** \file
+ * Direct conversion between bt-encoded values and JSON text, without building a bt_value (or any
+ * other tree) in between: each direction is a single forward pass over its input that writes its
+ * output (a std::string) as it goes.
+ *
+ * The mapping is the obvious one: dicts and JSON objects, lists and arrays, strings, and integers.
+ * Going from JSON, `true` and `false` become 1 and 0, object members with `null` values are
+ * omitted, and anything else that bt-encoding can't represent (non-integer numbers, and `null`
+ * other than as an object member value) is an error.
+ */
+
+/// How bt_to_json() writes strings that are not valid UTF-8, and so can't go into JSON as they are.
+/// (Strings that *are* valid UTF-8 are always written as ordinary JSON strings).  Note that none of
+/// these survive a round trip back through json_to_bt(): there is no telling such strings apart
+/// from ordinary ones.
+enum class bt_json_binary {
+    escape,  ///< bytes 0x80-0xff become \u0080-\u00ff escapes (i.e. the string is read as Latin-1)
+    hex,     ///< the whole string is written as hex
+    base64,  ///< the whole string is written as (padded) base64
+};
+
+/// Options for bt_to_json().
+struct bt_json_options {
+    /// How to write strings (and dict keys) that are not valid UTF-8.
+    bt_json_binary binary = bt_json_binary::escape;
+};
+
+namespace detail {
+
+    /// Returns true if `s` is valid UTF-8: no overlong encodings, surrogates, or code points past
+    /// U+10FFFF.
+    inline bool is_utf8(std::string_view s) {
+        size_t i = 0;
+        while (i < s.size()) {
+            if (i + 8 <= s.size()) {
+                uint64_t word;
+                std::memcpy(&word, s.data() + i, 8);
+                if (!(word & 0x8080808080808080ULL)) {  // 8 ASCII bytes
+                    i += 8;
+                    continue;
+                }
+            }
+            auto c = static_cast<unsigned char>(s[i]);
+            if (c < 0x80) {
+                i++;
+                continue;
+            }
+            size_t n;
+            uint32_t cp;
+            if ((c & 0xe0) == 0xc0)
+                n = 1, cp = c & 0x1fu;
+            else if ((c & 0xf0) == 0xe0)
+                n = 2, cp = c & 0x0fu;
+            else if ((c & 0xf8) == 0xf0)
+                n = 3, cp = c & 0x07u;
+            else
+                return false;
+            if (i + n >= s.size())
+                return false;
+            for (size_t j = 1; j <= n; j++) {
+                auto cc = static_cast<unsigned char>(s[i + j]);
+                if ((cc & 0xc0) != 0x80)
+                    return false;
+                cp = cp << 6 | (cc & 0x3fu);
+            }
+            if (cp < (n == 1 ? 0x80u : n == 2 ? 0x800u : 0x10000u) || cp > 0x10ffff ||
+                (cp >= 0xd800 && cp <= 0xdfff))
+                return false;
+            i += n + 1;
+        }
+        return true;
+    }
+
+    /// Appends `s` to `out` as a JSON string.
+    inline void json_append_string(std::string& out, std::string_view s, bt_json_binary binary) {
+        bool latin1 = false;
+        if (!is_utf8(s)) {
+            if (binary == bt_json_binary::hex || binary == bt_json_binary::base64) {
+                auto pos = out.size();
+                bool hex = binary == bt_json_binary::hex;
+                out.resize(pos + 2 + (hex ? to_hex_size(s.size()) : to_base64_size(s.size())));
+                out[pos] = '"';
+                if (hex)
+                    to_hex(s.begin(), s.end(), out.data() + pos + 1);
+                else
+                    to_base64(s.begin(), s.end(), out.data() + pos + 1);
+                out.back() = '"';
+                return;
+            }
+            latin1 = true;
+        }
+
+        constexpr const char* hexdigits = "0123456789abcdef";
+        out += '"';
+        size_t run = 0;  // Start of the bytes that can be copied as they are
+        for (size_t i = 0; i < s.size(); i++) {
+            auto c = static_cast<unsigned char>(s[i]);
+            if (c >= 0x20 && c != '"' && c != '\\' && (c < 0x80 || !latin1))
+                continue;
+            out.append(s.data() + run, i - run);
+            run = i + 1;
+            switch (c) {
+                case '"': out += "\\\""; break;
+                case '\\': out += "\\\\"; break;
+                case '\n': out += "\\n"; break;
+                case '\r': out += "\\r"; break;
+                case '\t': out += "\\t"; break;
+                case '\b': out += "\\b"; break;
+                case '\f': out += "\\f"; break;
+                default:
+                    char esc[6] = {'\\', 'u', '0', '0', hexdigits[c >> 4], hexdigits[c & 0xf]};
+                    out.append(esc, sizeof(esc));
+            }
+        }
+        out.append(s.data() + run, s.size() - run);
+        out += '"';
+    }
+
+    /// Converts the bt-encoded value at the front of `s` to JSON, appending it to `out`.  Like
+    /// bt_skip_value this is iterative, with list/dict nesting tracked in a bit stack.  On failure
+    /// `s` is left pointing at the location of the error.
+    inline bt_errc bt_to_json_impl(
+            std::string_view& s, std::string& out, const bt_json_options& opts) {
+        uint64_t dicts[bt_default_max_depth / 64];  // One bit per open container, set for dicts
+        size_t depth = 0;
+
+        for (;;) {
+            if (s.empty())
+                return bt_errc::unexpected_end;
+            switch (s[0]) {
+                case 'i': {
+                    std::pair<some64, bool> result;
+                    if (auto ec = bt_deserialize_integer(s, result); ec != bt_errc::ok)
+                        return ec;
+                    auto [v, negative] = result;
+                    char buf[20];
+                    auto [end, ec] = negative ? std::to_chars(buf, buf + sizeof(buf), v.i64)
+                                              : std::to_chars(buf, buf + sizeof(buf), v.u64);
+                    out.append(buf, end);
+                    break;
+                }
+                case 'l':
+                case 'd': {
+                    if (depth >= bt_default_max_depth)
+                        return bt_errc::depth_limit;
+                    auto& word = dicts[depth / 64];
+                    auto bit = uint64_t{1} << (depth % 64);
+                    word = s[0] == 'd' ? word | bit : word & ~bit;
+                    depth++;
+                    out += s[0] == 'd' ? '{' : '[';
+                    s.remove_prefix(1);
+                    break;
+                }
+                default: {
+                    if (s[0] < '0' || s[0] > '9')
+                        return bt_errc::wrong_type;
+                    std::string_view str;
+                    if (auto ec = bt_deserialize<std::string_view>{}(s, str); ec != bt_errc::ok)
+                        return ec;
+                    json_append_string(out, str, opts.binary);
+                }
+            }
+
+            // Close any finished lists/dicts, and write the separator (and key, in a dict) for the
+            // next value.
+            for (;;) {
+                if (depth == 0)
+                    return bt_errc::ok;
+                if (s.empty())
+                    return bt_errc::unexpected_end;
+                bool dict = dicts[(depth - 1) / 64] >> ((depth - 1) % 64) & 1;
+                if (s[0] == 'e') {
+                    s.remove_prefix(1);
+                    depth--;
+                    out += dict ? '}' : ']';
+                    continue;
+                }
+                if (out.back() != '[' && out.back() != '{')
+                    out += ',';
+                if (dict) {
+                    std::string_view key;
+                    if (auto ec = bt_deserialize<std::string_view>{}(s, key); ec != bt_errc::ok)
+                        return ec;
+                    if (s.empty())
+                        return bt_errc::unexpected_end;
+                    if (s[0] == 'e')
+                        return bt_errc::invalid_value;  // key isn't followed by a value
+                    json_append_string(out, key, opts.binary);
+                    out += ':';
+                }
+                break;
+            }
+        }
+    }
+
+    /// JSON to bt-encoding converter: see json_to_bt().
+    class json_to_bt_parser {
+        std::string_view in;
+        size_t pos = 0;
+        std::string& out;
+        std::string scratch;  // Holds strings with escapes while they are decoded
+
+        // An open array or object, whose encoding starts at `start` in `out`.  The members of
+        // objects are tracked in `entries`, from `first_entry` on, so that they can be sorted.
+        struct frame {
+            size_t start;
+            size_t first_entry;
+            bool object;
+            bool sorted;
+        };
+        // An object member; `begin` and `end` delimit the encoded key and value in `out`.
+        struct entry {
+            size_t begin, end;
+            size_t key, key_size;
+            bool null;  // A `null` value: drops the member (and any earlier one with the same key)
+        };
+        std::vector<frame> frames;
+        std::vector<entry> entries;
+
+        [[noreturn]] void fail(std::string_view what) const {
+            throw std::invalid_argument{
+                    "Invalid JSON at byte " + std::to_string(pos) + ": " + std::string{what}};
+        }
+
+        void skip_ws() {
+            while (pos < in.size() &&
+                   (in[pos] == ' ' || in[pos] == '\n' || in[pos] == '\r' || in[pos] == '\t'))
+                pos++;
+        }
+
+        // Skips whitespace and returns the next character, which must exist.
+        char peek() {
+            skip_ws();
+            if (pos >= in.size())
+                fail("unexpected end of input");
+            return in[pos];
+        }
+
+        void expect(char c) {
+            if (peek() != c)
+                fail(std::string{"expected '"} + c + "'");
+            pos++;
+        }
+
+        void append_length(size_t len) {
+            char buf[21];
+            auto [end, ec] = std::to_chars(buf, buf + 20, len);
+            *end++ = ':';
+            out.append(buf, end);
+        }
+
+        unsigned parse_hex4() {
+            unsigned v = 0;
+            for (int i = 0; i < 4; i++, pos++) {
+                if (pos >= in.size() || !is_hex_digit(in[pos]))
+                    fail("invalid \\u escape");
+                auto digit = from_hex_digit(static_cast<unsigned char>(in[pos]));
+                v = v << 4 | static_cast<unsigned>(digit);
+            }
+            return v;
+        }
+
+        // Parses the string at `pos` (at its opening quote), appending its bt encoding to `out`.
+        // Returns the length of the (decoded) string.
+        size_t parse_string() {
+            size_t start = ++pos, i = start;
+            while (i < in.size() && in[i] != '"' && in[i] != '\\' &&
+                   static_cast<unsigned char>(in[i]) >= 0x20)
+                i++;
+            if (i < in.size() && in[i] == '"') {
+                // No escapes (the usual case), so we can copy it straight from the input
+                append_length(i - start);
+                out.append(in.data() + start, i - start);
+                pos = i + 1;
+                return i - start;
+            }
+
+            scratch.assign(in.data() + start, i - start);
+            for (pos = i;; pos++) {
+                if (pos >= in.size())
+                    fail("unterminated string");
+                auto c = static_cast<unsigned char>(in[pos]);
+                if (c == '"')
+                    break;
+                if (c < 0x20)
+                    fail("unescaped control character in string");
+                if (c != '\\') {
+                    scratch += static_cast<char>(c);
+                    continue;
+                }
+                if (++pos >= in.size())
+                    fail("unterminated string");
+                switch (in[pos]) {
+                    case '"': scratch += '"'; break;
+                    case '\\': scratch += '\\'; break;
+                    case '/': scratch += '/'; break;
+                    case 'b': scratch += '\b'; break;
+                    case 'f': scratch += '\f'; break;
+                    case 'n': scratch += '\n'; break;
+                    case 'r': scratch += '\r'; break;
+                    case 't': scratch += '\t'; break;
+                    case 'u': {
+                        pos++;
+                        uint32_t cp = parse_hex4();
+                        if (cp >= 0xdc00 && cp <= 0xdfff)
+                            fail("unpaired surrogate in \\u escape");
+                        if (cp >= 0xd800 && cp <= 0xdbff) {
+                            if (in.substr(pos, 2) != "\\u")
+                                fail("unpaired surrogate in \\u escape");
+                            pos += 2;
+                            uint32_t low = parse_hex4();
+                            if (low < 0xdc00 || low > 0xdfff)
+                                fail("unpaired surrogate in \\u escape");
+                            cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+                        }
+                        pos--;  // (the loop increment skips the last hex digit)
+                        if (cp < 0x80) {
+                            scratch += static_cast<char>(cp);
+                        } else if (cp < 0x800) {
+                            scratch += static_cast<char>(0xc0 | cp >> 6);
+                            scratch += static_cast<char>(0x80 | (cp & 0x3f));
+                        } else if (cp < 0x10000) {
+                            scratch += static_cast<char>(0xe0 | cp >> 12);
+                            scratch += static_cast<char>(0x80 | (cp >> 6 & 0x3f));
+                            scratch += static_cast<char>(0x80 | (cp & 0x3f));
+                        } else {
+                            scratch += static_cast<char>(0xf0 | cp >> 18);
+                            scratch += static_cast<char>(0x80 | (cp >> 12 & 0x3f));
+                            scratch += static_cast<char>(0x80 | (cp >> 6 & 0x3f));
+                            scratch += static_cast<char>(0x80 | (cp & 0x3f));
+                        }
+                        break;
+                    }
+                    default: fail("invalid escape in string");
+                }
+            }
+            pos++;
+            append_length(scratch.size());
+            out += scratch;
+            return scratch.size();
+        }
+
+        void parse_integer() {
+            size_t start = pos;
+            bool negative = in[pos] == '-';
+            if (negative)
+                pos++;
+            size_t digits = pos;
+            while (pos < in.size() && in[pos] >= '0' && in[pos] <= '9')
+                pos++;
+            if (pos == digits)
+                fail("invalid number");
+            if (in[digits] == '0' && pos > digits + 1)
+                fail("invalid number (leading zero)");
+            if (pos < in.size() && (in[pos] == '.' || in[pos] == 'e' || in[pos] == 'E'))
+                fail("non-integer numbers are not supported");
+            // Range check: must fit in an int64_t if negative, a uint64_t otherwise
+            auto num = in.substr(start, pos - start);
+            std::errc ec;
+            if (negative) {
+                int64_t v;
+                ec = std::from_chars(num.data(), num.data() + num.size(), v).ec;
+            } else {
+                uint64_t v;
+                ec = std::from_chars(num.data(), num.data() + num.size(), v).ec;
+            }
+            if (ec != std::errc{})
+                fail("integer out of range");
+            if (num == "-0")
+                num = "0";
+            out += 'i';
+            out += num;
+            out += 'e';
+        }
+
+        void parse_literal(std::string_view lit) {
+            if (in.substr(pos, lit.size()) != lit)
+                fail("invalid value");
+            pos += lit.size();
+        }
+
+        // Parses an object member's key and the following colon.
+        void parse_key() {
+            if (peek() != '"')
+                fail("expected object key");
+            auto& f = frames.back();
+            entry e{out.size(), 0, 0, 0, false};
+            e.key_size = parse_string();
+            e.key = out.size() - e.key_size;
+            if (entries.size() > f.first_entry && !(key_of(e) > key_of(entries.back())))
+                f.sorted = false;
+            entries.push_back(e);
+            expect(':');
+        }
+
+        std::string_view key_of(const entry& e) const { return {out.data() + e.key, e.key_size}; }
+
+        // Finishes the innermost array or object.  Object members are put in key order if they
+        // weren't already (keeping the last of any duplicates, and then dropping it if null).
+        void close() {
+            auto& f = frames.back();
+            if (f.object && !f.sorted) {
+                auto first = entries.begin() + static_cast<std::ptrdiff_t>(f.first_entry);
+                std::stable_sort(first, entries.end(), [this](const entry& a, const entry& b) {
+                    return key_of(a) < key_of(b);
+                });
+                std::string encoded = out.substr(f.start);
+                out.resize(f.start);
+                for (auto it = first; it != entries.end(); ++it) {
+                    if (it->null || (it + 1 != entries.end() && key_of(it[1]) == key_of(*it)))
+                        continue;
+                    out.append(encoded, it->begin - f.start, it->end - it->begin);
+                }
+            }
+            out += 'e';
+            entries.resize(f.first_entry);
+            frames.pop_back();
+        }
+
+      public:
+        json_to_bt_parser(std::string_view json, std::string& output) : in{json}, out{output} {}
+
+        void parse() {
+            for (;;) {
+                // Parse a value
+                switch (char c = peek()) {
+                    case '{':
+                    case '[':
+                        if (frames.size() >= bt_default_max_depth)
+                            fail("nesting too deep");
+                        pos++;
+                        frames.push_back({out.size() + 1, entries.size(), c == '{', true});
+                        out += c == '{' ? 'd' : 'l';
+                        if (peek() == (c == '{' ? '}' : ']')) {
+                            pos++;
+                            close();
+                            break;
+                        }
+                        if (c == '{')
+                            parse_key();
+                        continue;
+                    case '"': parse_string(); break;
+                    case 't':
+                        parse_literal("true");
+                        out += "i1e";
+                        break;
+                    case 'f':
+                        parse_literal("false");
+                        out += "i0e";
+                        break;
+                    case 'n':
+                        parse_literal("null");
+                        if (frames.empty() || !frames.back().object)
+                            fail("null is only supported as an object member value");
+                        if (frames.back().sorted) {
+                            // No earlier member has this key, so we can just drop the key
+                            out.resize(entries.back().begin);
+                            entries.pop_back();
+                        } else {
+                            // An earlier member may have the same key, in which case that has to
+                            // go too when the object is sorted (and deduplicated) in close()
+                            entries.back().null = true;
+                        }
+                        break;
+                    default:
+                        if (c != '-' && (c < '0' || c > '9'))
+                            fail("invalid value");
+                        parse_integer();
+                }
+
+                // Close any finished arrays/objects, and move on to the next value
+                for (;;) {
+                    if (frames.empty()) {
+                        skip_ws();
+                        if (pos != in.size())
+                            fail("trailing data after JSON value");
+                        return;
+                    }
+                    auto& f = frames.back();
+                    if (f.object && entries.size() > f.first_entry)
+                        entries.back().end = out.size();
+                    char c = peek();
+                    if (c == ',') {
+                        pos++;
+                        if (f.object)
+                            parse_key();
+                        break;
+                    }
+                    if (c != (f.object ? '}' : ']'))
+                        fail(f.object ? "expected ',' or '}'" : "expected ',' or ']'");
+                    pos++;
+                    close();
+                }
+            }
+        }
+    };
+
+}  // namespace detail
+
+/// Converts a bt-encoded value to JSON, appending it to `out`.  Dicts keep their (sorted) key
+/// order, and the output has no whitespace.  Throws bt_deserialize_invalid if `bt` is not a single
+/// valid value (in which case `out` may have been partly appended to).
+///
+///     std::string json;
+///     bt_to_json(msg, json, {.binary = bt_json_binary::hex});
+inline void bt_to_json(std::string_view bt, std::string& out, const bt_json_options& opts = {}) {
+    std::string_view s{bt};
+    out.reserve(out.size() + bt.size() + bt.size() / 4);
+    auto ec = detail::bt_to_json_impl(s, out, opts);
+    if (ec == bt_errc::ok && !s.empty())
+        ec = bt_errc::trailing_data;
+    if (ec != bt_errc::ok)
+        detail::throw_bt_error({ec, static_cast<size_t>(s.data() - bt.data())});
+}
+
+/// Converts a bt-encoded value to JSON, returning it.
+inline std::string bt_to_json(std::string_view bt, const bt_json_options& opts = {}) {
+    std::string out;
+    bt_to_json(bt, out, opts);
+    return out;
+}
+
+/// Converts JSON text to bt-encoding, appending it to `out`.  Object members are written in
+/// sorted order: they are encoded straight into `out` as they are parsed and, only if they turn out
+/// to be out of order, then sorted (keeping the last of any duplicate keys).  Throws
+/// std::invalid_argument, with the byte offset of the problem, if `json` is not valid JSON or has
+/// something that can't be bt-encoded (in which case `out` may have been partly appended to).
+inline void json_to_bt(std::string_view json, std::string& out) {
+    out.reserve(out.size() + json.size());
+    detail::json_to_bt_parser{json, out}.parse();
+}
+
+/// Converts JSON text to bt-encoding, returning it.
+inline std::string json_to_bt(std::string_view json) {
+    std::string out;
+    json_to_bt(json, out);
+    return out;
+}
+
+/// Converts a JSON object, appending its members to the dict producer `out` (which, as usual, must
+/// not already have keys sorting after them).  Throws std::invalid_argument if `json` is not a
+/// JSON object.
+///
+/// Note that this is not a direct conversion: the object is first converted into a temporary
+/// string (as by `json_to_bt(json)`), and its members are then copied from there into `out`, so
+/// when building a whole message from JSON it is cheaper to convert into a string.
+inline void json_to_bt(std::string_view json, bt_dict_producer& out) {
+    auto encoded = json_to_bt(json);
+    if (encoded[0] != 'd')
+        throw std::invalid_argument{"Invalid JSON: expected an object"};
+    bt_dict_consumer members{encoded};
+    while (!members.is_finished()) {
+        auto [key, val] = members.next_value_data();
+        out.append_encoded(key, val);
+    }
+}
+
+}  // namespace oxenc
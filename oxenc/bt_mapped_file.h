@@ -0,0 +1,173 @@
+#pragma once
+
+// POSIX-only: memory-mapped access to bt-encoded files.  This header is not included by bt.h.
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <filesystem>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+
+#include "bt_serialize.h"
+
+namespace oxenc {
+
+/// Read-only memory mapping of a (possibly very large) bt-encoded file, for consuming it in place
+/// rather than first reading it into memory:
+///
+///     bt_mapped_file snapshot{"snapshot.bt"};
+///     auto d = snapshot.dict_consumer();
+///     auto version = d.require<int>("version");
+///     ...
+///
+/// The file's pages are only read when they are accessed (e.g. a `skip_until` over a large value
+/// only reads the pages containing the encoded structure of what it skips, and nothing at all of
+/// large strings), so startup time and memory use depend on what is actually touched rather than
+/// on the file size.  The mapped pages are backed by the file itself, which means the kernel can
+/// simply drop them under memory pressure, so files larger than RAM work too (as long as they fit
+/// in the address space).
+///
+/// The views and consumers obtained from the mapping are only valid while the bt_mapped_file
+/// exists.  The file must not be modified (and in particular must not be truncated) while mapped.
+///
+/// Throws std::system_error if the file cannot be opened or mapped.
+class bt_mapped_file {
+  public:
+    /// Expected access pattern, passed to the kernel (via madvise) as a hint for read-ahead.
+    enum class access_pattern {
+        normal,      ///< no special treatment
+        sequential,  ///< aggressive read-ahead; pages behind the access position may be dropped
+        random,      ///< no read-ahead
+    };
+
+    /// Maps the given file.  `pattern` is a hint of how the file will be accessed; the default
+    /// suits parsing it front to back.
+    explicit bt_mapped_file(
+            const std::filesystem::path& path,
+            access_pattern pattern = access_pattern::sequential) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            throw_errno(errno, "Unable to open " + path.string());
+        struct stat st;
+        if (::fstat(fd, &st) != 0)
+            throw_errno(close_keep_errno(fd), "Unable to stat " + path.string());
+        size_ = static_cast<size_t>(st.st_size);
+        if (size_ > 0) {
+            void* addr = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+            if (addr == MAP_FAILED)
+                throw_errno(close_keep_errno(fd), "Unable to mmap " + path.string());
+            data_ = static_cast<const char*>(addr);
+        }
+        // The mapping keeps its own reference to the file
+        ::close(fd);
+        advise(pattern);
+    }
+
+    bt_mapped_file(bt_mapped_file&& other) noexcept :
+            data_{std::exchange(other.data_, nullptr)}, size_{std::exchange(other.size_, 0)} {}
+
+    bt_mapped_file& operator=(bt_mapped_file&& other) noexcept {
+        if (this != &other) {
+            unmap();
+            data_ = std::exchange(other.data_, nullptr);
+            size_ = std::exchange(other.size_, 0);
+        }
+        return *this;
+    }
+
+    bt_mapped_file(const bt_mapped_file&) = delete;
+    bt_mapped_file& operator=(const bt_mapped_file&) = delete;
+
+    ~bt_mapped_file() { unmap(); }
+
+    /// Returns the size of the file.
+    size_t size() const { return size_; }
+    /// Returns true if the file is empty (or has been moved from).
+    bool empty() const { return size_ == 0; }
+
+    /// Returns a view of the entire file contents.
+    std::string_view view() const { return {data_, size_}; }
+
+    /// Returns a list consumer over the file contents; throws if the file does not contain a list.
+    bt_list_consumer list_consumer() const { return bt_list_consumer{view()}; }
+
+    /// Returns a dict consumer over the file contents; throws if the file does not contain a dict.
+    bt_dict_consumer dict_consumer() const { return bt_dict_consumer{view()}; }
+
+    /// Gives the kernel a new access pattern hint for `length` bytes starting at `offset` (by
+    /// default, the whole file).
+    void advise(
+            access_pattern pattern,
+            size_t offset = 0,
+            size_t length = std::numeric_limits<size_t>::max()) const {
+        madvise_range(
+                pattern == access_pattern::sequential ? MADV_SEQUENTIAL
+                : pattern == access_pattern::random   ? MADV_RANDOM
+                                                      : MADV_NORMAL,
+                offset,
+                length);
+    }
+
+    /// Hints that the given range of the file will be needed soon, so that the kernel can start
+    /// reading it in.
+    void will_need(size_t offset, size_t length) const {
+        madvise_range(MADV_WILLNEED, offset, length);
+    }
+
+    /// Hints that the given range of the file is not needed any more (e.g. because a scan has
+    /// already processed it), so that its memory can be released immediately rather than whenever
+    /// the kernel gets around to it.  The data remains accessible: if it is accessed again it is
+    /// simply re-read from the file.
+    void dont_need(size_t offset, size_t length) const {
+        madvise_range(MADV_DONTNEED, offset, length);
+    }
+
+    /// Returns the offset of `pos`, a pointer into the mapped data (such as the `data()` of a view
+    /// returned by a consumer), from the beginning of the file; useful for passing to will_need()
+    /// or dont_need().
+    size_t offset_of(const char* pos) const { return static_cast<size_t>(pos - data_); }
+
+  private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+
+    [[noreturn]] static void throw_errno(int err, const std::string& what) {
+        throw std::system_error{err, std::generic_category(), what};
+    }
+
+    // Closes `fd` and returns the errno value from before closing it.
+    static int close_keep_errno(int fd) {
+        int err = errno;
+        ::close(fd);
+        return err;
+    }
+
+    void unmap() {
+        if (data_)
+            ::munmap(const_cast<char*>(data_), size_);
+        data_ = nullptr;
+        size_ = 0;
+    }
+
+    // madvise() requires a page-aligned start, so extend the range down to the page boundary.
+    // Advice failures are ignored: they are only hints.
+    void madvise_range(int advice, size_t offset, size_t length) const {
+        if (offset >= size_)
+            return;
+        length = std::min(length, size_ - offset);
+        static const auto page_size = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+        size_t start = offset / page_size * page_size;
+        ::madvise(const_cast<char*>(data_) + start, length + (offset - start), advice);
+    }
+};
+
+}  // namespace oxenc
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+#include "bt_producer.h"
+#include "bt_serialize.h"
+
+namespace oxenc {
+
+/// Options for bt_merge().
+struct bt_merge_options {
+    /// If true then a key that holds a dict in both the base and the overlay gets the merge of the
+    /// two dicts, rather than just the overlay's dict.
+    bool recursive = false;
+};
+
+namespace detail {
+
+    inline void bt_merge_impl(
+            bt_dict_consumer& base,
+            bt_dict_consumer& overlay,
+            bt_dict_producer& out,
+            const bt_merge_options& opts,
+            size_t depth) {
+        if (depth >= bt_default_max_depth)
+            throw_bt_depth_limit();
+        for (;;) {
+            bool have_base = !base.is_finished(), have_overlay = !overlay.is_finished();
+            if (!have_base && !have_overlay)
+                break;
+            int cmp = !have_base ? 1 : !have_overlay ? -1 : base.key().compare(overlay.key());
+            if (cmp < 0) {
+                auto [key, val] = base.next_value_data();
+                out.append_encoded(key, val);
+            } else if (cmp > 0) {
+                auto [key, val] = overlay.next_value_data();
+                out.append_encoded(key, val);
+            } else if (opts.recursive && base.is_dict() && overlay.is_dict()) {
+                auto [key, b] = base.next_dict_consumer();
+                auto o = overlay.consume_dict_consumer();
+                auto sub = out.append_dict(key);
+                bt_merge_impl(b, o, sub, opts, depth + 1);
+            } else {
+                base.skip_value();
+                auto [key, val] = overlay.next_value_data();
+                out.append_encoded(key, val);
+            }
+        }
+    }
+
+}  // namespace detail
+
+/// Merges two encoded dicts into `out`, for layering one dict (such as configuration overrides)
+/// on top of another (such as the defaults): keys that are in only one of `base` and `overlay` are
+/// copied from it, and keys that are in both get the overlay's value.  (Or, with the `recursive`
+/// option, the merge of the two values if both are dicts).
+///
+///     bt_dict_producer out;
+///     bt_merge(defaults, overrides, out, {.recursive = true});
+///     auto config = std::move(out).str();
+///
+/// Because both dicts have sorted keys this is a single linear pass over both of them, and values
+/// are copied as raw encoded data without being decoded (and only the values of keys present in
+/// both are skipped).  The merged key/values are appended to `out`, which can be a subdict of a
+/// larger dict being produced, and must not already contain any keys that sort after those being
+/// merged.
+///
+/// Throws (as the consumers do) if either input is not a valid dict, and bt_deserialize_invalid
+/// if recursively merged dicts are nested more than bt_default_max_depth deep.
+inline void bt_merge(
+        bt_dict_consumer base,
+        bt_dict_consumer overlay,
+        bt_dict_producer& out,
+        const bt_merge_options& opts = {}) {
+    detail::bt_merge_impl(base, overlay, out, opts, 0);
+}
+
+inline void bt_merge(
+        std::string_view base,
+        std::string_view overlay,
+        bt_dict_producer& out,
+        const bt_merge_options& opts = {}) {
+    bt_merge(bt_dict_consumer{base}, bt_dict_consumer{overlay}, out, opts);
+}
+
+/// Merges two encoded dicts, as above, and returns the encoded result.
+inline std::string bt_merge(
+        std::string_view base, std::string_view overlay, const bt_merge_options& opts = {}) {
+    bt_dict_producer out{base.size() + overlay.size()};
+    bt_merge(base, overlay, out, opts);
+    return std::move(out).str();
+}
+
+}  // namespace oxenc
@@ -0,0 +1,194 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <limits>
+#include <optional>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "bt_serialize.h"
+#include "span.h"
+
+// Note that code using this header must link with the system thread library (e.g. with cmake's
+// `Threads::Threads`).  For that reason it is not included from bt.h: include it directly.
+
+namespace oxenc {
+
+/// Options for bt_deserialize_parallel().
+struct bt_parallel_options {
+    /// Maximum number of threads to use (including the calling thread); 0 means one per hardware
+    /// thread.
+    size_t threads = 0;
+
+    /// Minimum amount of encoded data for each thread: smaller inputs use fewer threads, and small
+    /// enough inputs are simply decoded sequentially on the calling thread, as starting a thread
+    /// costs more than decoding a few kB.
+    size_t min_bytes_per_thread = 32 * 1024;
+};
+
+/// Non-throwing version of bt_deserialize_parallel(): deserializes the bt-encoded list `s` into
+/// `out`, returning a bt_error that is empty on success.  On failure `out` holds the elements
+/// before the failed one.
+///
+/// The result, including the error code and offset of any error, is the same as that of
+/// `try_bt_deserialize(s, out)`.
+template <typename T>
+bt_error try_bt_deserialize_parallel(
+        std::string_view s, std::vector<T>& out, const bt_parallel_options& opts = {}) {
+    size_t threads = opts.threads ? opts.threads : std::thread::hardware_concurrency();
+    threads = std::min(threads, s.size() / std::max<size_t>(opts.min_bytes_per_thread, 1));
+    if (threads <= 1)
+        return try_bt_deserialize(s, out);
+
+    const char* const orig = s.data();
+    auto error = [orig](bt_errc ec, const char* at) {
+        return bt_error{ec, static_cast<size_t>(at - orig)};
+    };
+    out.clear();
+    if (s.empty())
+        return error(bt_errc::unexpected_end, s.data());
+    if (s[0] != 'l')
+        return error(bt_errc::wrong_type, s.data());
+    s.remove_prefix(1);
+
+    // Structural pre-scan to find where each element starts.  If this fails then the elements
+    // before the failure are decoded in parallel, and the rest of the list (which fails somewhere)
+    // sequentially, so that we end up with exactly the sequential error.
+    std::vector<const char*> starts;
+    while (!s.empty() && s[0] != 'e') {
+        std::string_view elem{s};
+        if (detail::bt_skip_value(elem) != bt_errc::ok)
+            break;
+        starts.push_back(s.data());
+        s = elem;
+    }
+    const size_t count = starts.size();
+    const char* const scan_end = s.data();
+    auto element = [&](size_t i) {
+        const char* end = i + 1 < count ? starts[i + 1] : scan_end;
+        return std::string_view{starts[i], static_cast<size_t>(end - starts[i])};
+    };
+
+    threads = std::clamp<size_t>(threads, 1, std::max<size_t>(count, 1));
+
+    out.resize(count);
+    std::atomic<size_t> failed{std::numeric_limits<size_t>::max()};  // Lowest failed element
+    // Each thread's failure, if any: the failed element, and its error or exception
+    struct failure {
+        size_t index;
+        bt_error err;
+        std::exception_ptr exception;
+    };
+    std::vector<std::optional<failure>> failures(threads);
+
+    // Each thread decodes a contiguous range of elements holding about 1/threads of the data
+    auto decode_range = [&](size_t t) {
+        auto first_byte = [&](size_t k) {
+            return k == threads ? scan_end : orig + 1 + (scan_end - orig - 1) * k / threads;
+        };
+        auto begin = static_cast<size_t>(
+                std::lower_bound(starts.begin(), starts.end(), first_byte(t)) - starts.begin());
+        auto end = static_cast<size_t>(
+                std::lower_bound(starts.begin(), starts.end(), first_byte(t + 1)) -
+                starts.begin());
+        auto fail = [&](size_t i, bt_error err, std::exception_ptr exception) {
+            failures[t] = failure{i, err, std::move(exception)};
+            size_t f = failed.load();
+            while (i < f && !failed.compare_exchange_weak(f, i)) {}
+        };
+        size_t i = begin;
+        try {
+            detail::bt_deserialize<T> deserializer;
+            for (; i < end && i < failed.load(std::memory_order_relaxed); i++) {
+                auto e = element(i);
+                if (auto ec = deserializer(e, out[i]); ec != bt_errc::ok) {
+                    fail(i, error(ec, e.data()), nullptr);
+                    break;
+                }
+            }
+        } catch (...) {
+            fail(i, {}, std::current_exception());
+        }
+    };
+
+    std::vector<std::thread> workers;
+    workers.reserve(threads - 1);
+    for (size_t t = 1; t < threads; t++)
+        workers.emplace_back(decode_range, t);
+    decode_range(0);
+    for (auto& w : workers)
+        w.join();
+
+    // The first failure in element order is the one the sequential decoder would have hit (and
+    // every element before it has been decoded), whether it is an error or an exception.
+    if (size_t f = failed.load(); f < count) {
+        for (auto& fl : failures) {
+            if (fl && fl->index == f) {
+                if (fl->exception)
+                    std::rethrow_exception(fl->exception);
+                out.resize(f);
+                return fl->err;
+            }
+        }
+    }
+
+    // Finish sequentially: this is just the closing `e` unless the pre-scan failed
+    detail::bt_deserialize<T> deserializer;
+    while (!s.empty() && s[0] != 'e') {
+        if (auto ec = deserializer(s, out.emplace_back()); ec != bt_errc::ok) {
+            out.pop_back();
+            return error(ec, s.data());
+        }
+    }
+    if (s.empty())
+        return error(bt_errc::unexpected_end, s.data());
+    s.remove_prefix(1);
+    if (!s.empty())
+        return error(bt_errc::trailing_data, s.data());
+    return {};
+}
+
+/// The elements of a std::vector<bool> share storage, so can't be written from different threads:
+/// it is simply decoded sequentially.
+template <std::same_as<bool> T>
+bt_error try_bt_deserialize_parallel(
+        std::string_view s, std::vector<T>& out, const bt_parallel_options& = {}) {
+    return try_bt_deserialize(s, out);
+}
+
+template <typename T, const_span_type SpanT>
+bt_error try_bt_deserialize_parallel(
+        SpanT sp, std::vector<T>& out, const bt_parallel_options& opts = {}) {
+    return try_bt_deserialize_parallel(detail::span_to_sv(sp), out, opts);
+}
+
+/// Deserializes a bt-encoded list of independent elements, such as a large list of dicts, into a
+/// std::vector<T>, using multiple threads.  This produces the same result as
+/// `bt_deserialize<std::vector<T>>(s)`, including for invalid input (where it throws the same
+/// exception).
+///
+/// This first makes a quick structural pass over the list (as when skipping values) to find where
+/// each element starts, then splits the elements into one contiguous range for each thread, each
+/// holding about the same amount of encoded data, and decodes the ranges in parallel directly into
+/// their positions in the pre-sized output vector.  It is worthwhile for lists of thousands of
+/// elements or more; see bt_parallel_options for controlling the number of threads.
+///
+///     auto members = bt_deserialize_parallel<swarm_member>(encoded);
+template <typename T>
+std::vector<T> bt_deserialize_parallel(std::string_view s, const bt_parallel_options& opts = {}) {
+    std::vector<T> out;
+    if (auto err = try_bt_deserialize_parallel(s, out, opts))
+        detail::throw_bt_error(err);
+    return out;
+}
+
+template <typename T, const_span_type SpanT>
+std::vector<T> bt_deserialize_parallel(SpanT sp, const bt_parallel_options& opts = {}) {
+    return bt_deserialize_parallel<T>(detail::span_to_sv(sp), opts);
+}
+
+}  // namespace oxenc
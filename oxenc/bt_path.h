@@ -0,0 +1,482 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <cstddef>
+#include <initializer_list>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "bt_serialize.h"
+#include "bt_validate.h"
+#include "span.h"
+
+namespace oxenc {
+
+namespace detail {
+
+    // Moves `s` (which must be at an encoded dict's `d`) to the value of key `key`.  Returns
+    // key_not_found (with `s` at the first greater key's value, or at the dict's `e`) if the dict
+    // doesn't have the key; like bt_dict_consumer::skip_until this relies on the keys being sorted.
+    // If given, `entry` is set to where the key is, or where it would be inserted if not found.
+    inline bt_errc bt_path_find_key(
+            std::string_view& s, std::string_view key, const char** entry = nullptr) {
+        s.remove_prefix(1);
+        for (;;) {
+            if (s.empty())
+                return bt_errc::unexpected_end;
+            if (entry)
+                *entry = s.data();
+            if (s[0] == 'e')
+                return bt_errc::key_not_found;
+            std::string_view k;
+            if (auto ec = bt_deserialize<std::string_view>{}(s, k); ec != bt_errc::ok)
+                return ec;
+            if (s.empty())
+                return bt_errc::unexpected_end;
+            if (s[0] == 'e')
+                return bt_errc::invalid_value;  // key isn't followed by a value
+            if (k == key)
+                return bt_errc::ok;
+            if (k > key)
+                return bt_errc::key_not_found;
+            if (auto ec = bt_skip_value(s); ec != bt_errc::ok)
+                return ec;
+        }
+    }
+
+    // Moves `s` (which must be at an encoded list's `l`) to element `index`, or returns
+    // key_not_found (with `s` at the list's `e`) if the list is too short.
+    inline bt_errc bt_path_find_index(std::string_view& s, size_t index) {
+        s.remove_prefix(1);
+        for (;; index--) {
+            if (s.empty())
+                return bt_errc::unexpected_end;
+            if (s[0] == 'e')
+                return bt_errc::key_not_found;
+            if (index == 0)
+                return bt_errc::ok;
+            if (auto ec = bt_skip_value(s); ec != bt_errc::ok)
+                return ec;
+        }
+    }
+
+    // Consumes the value at the front of `s`, returning a view of its encoding in `val`.
+    inline bt_errc bt_path_take_value(std::string_view& s, std::string_view& val) {
+        auto start = s;
+        if (auto ec = bt_skip_value(s); ec != bt_errc::ok)
+            return ec;
+        val = start.substr(0, static_cast<size_t>(s.data() - start.data()));
+        return bt_errc::ok;
+    }
+
+}  // namespace detail
+
+/// A compiled path to a value nested inside encoded lists and dicts, for pulling single fields out
+/// of (many) messages without decoding them or writing out consumer chains:
+///
+///     static const bt_path pubkey{"result.swarm[3].pubkey"};
+///     if (auto pk = pubkey.find(msg))
+///         use(bt_deserialize<std::string_view>(*pk));
+///     // or simply:
+///     auto pk = pubkey.get<std::string_view>(msg);
+///
+/// A path is a sequence of dict keys, separated by `.`, and list indices, in `[]`; an empty path
+/// refers to the whole value.  A `\` in a key escapes the following character, for keys containing
+/// `.`, `[` or `\`.
+///
+/// Finding a value walks the encoded data once, from the front, to the end of the value found:
+/// values before it are skipped over without being decoded, and nothing after it is looked at (and
+/// so nothing after it is validated either).  As with bt_dict_consumer::skip_until, dict keys are
+/// assumed to be sorted, so the search of a dict stops at the first key past the one it wants.
+///
+/// A path can also be used to patch the encoded data, replacing, inserting or removing the value
+/// at the path without re-encoding anything else: see set() and erase().
+///
+/// Paths are immutable once constructed, and can be shared between threads.  To extract several
+/// values from the same message see bt_path_set, which does it in a single pass.
+class bt_path {
+  public:
+    /// One step of a path: a dict key, or (if `is_index` is set) a list index.
+    struct step {
+        std::string key;
+        size_t index = 0;
+        bool is_index = false;
+    };
+
+    /// Compiles a path expression.  Throws std::invalid_argument if it is malformed (for instance
+    /// `a..b`, `a[x]` or `a[1`).
+    explicit bt_path(std::string_view path) {
+        if (path.empty())
+            return;
+        bool need_key = path[0] != '[';
+        for (size_t i = 0; i < path.size();) {
+            if (path[i] == '[') {
+                auto close = path.find(']', i);
+                auto digits =
+                        path.substr(i + 1, close == std::string_view::npos ? 0 : close - i - 1);
+                const char* digits_end = digits.data() + digits.size();
+                step st{{}, 0, true};
+                auto [end, ec] = std::from_chars(digits.data(), digits_end, st.index);
+                if (digits.empty() || ec != std::errc{} || end != digits_end)
+                    throw std::invalid_argument{
+                            "Invalid list index in bt path " + std::string{path}};
+                steps_.push_back(std::move(st));
+                i = close + 1;
+                if (i < path.size() && path[i] == '.') {
+                    need_key = true;
+                    if (++i == path.size())
+                        throw std::invalid_argument{"Empty key in bt path " + std::string{path}};
+                }
+            } else if (!need_key) {
+                throw std::invalid_argument{"Invalid bt path " + std::string{path}};
+            } else {
+                step st;
+                for (; i < path.size() && path[i] != '.' && path[i] != '['; i++) {
+                    if (path[i] == '\\' && ++i == path.size())
+                        throw std::invalid_argument{
+                                "Invalid escape in bt path " + std::string{path}};
+                    st.key += path[i];
+                }
+                if (st.key.empty())
+                    throw std::invalid_argument{"Empty key in bt path " + std::string{path}};
+                steps_.push_back(std::move(st));
+                need_key = i < path.size() && path[i] == '.';
+                if (need_key && ++i == path.size())
+                    throw std::invalid_argument{"Empty key in bt path " + std::string{path}};
+            }
+        }
+    }
+
+    /// The steps of the path, outermost first.
+    const std::vector<step>& steps() const { return steps_; }
+
+    /// Non-throwing version of find(): on success sets `val` to the encoded value at the path.
+    /// Returns a bt_errc::key_not_found error if the path doesn't exist in `data` (because a key or
+    /// index along it is missing, or because a value along it is not the dict or list the path
+    /// expects), and the error that stopped it if `data` is malformed.
+    bt_error try_find(std::string_view data, std::string_view& val) const {
+        std::string_view s{data};
+        auto ec = walk(s, steps_.size());
+        if (ec == bt_errc::ok)
+            ec = detail::bt_path_take_value(s, val);
+        if (ec != bt_errc::ok)
+            return {ec, static_cast<size_t>(s.data() - data.data())};
+        return {};
+    }
+
+    /// Returns a view of the encoded value at the path, or std::nullopt if `data` does not have
+    /// one.  Throws bt_deserialize_invalid if the data walked through is malformed.
+    std::optional<std::string_view> find(std::string_view data) const {
+        std::string_view val;
+        if (auto err = try_find(data, val)) {
+            if (err.code == bt_errc::key_not_found)
+                return std::nullopt;
+            detail::throw_bt_error(err);
+        }
+        return val;
+    }
+
+    template <const_span_type SpanT>
+    std::optional<std::string_view> find(SpanT data) const {
+        return find(detail::span_to_sv(data));
+    }
+
+    /// Finds and decodes the value at the path, returning std::nullopt if there is no such value.
+    /// Throws if the data is malformed or the value can't be decoded as a `T`.  (As with
+    /// bt_deserialize, a view-typed `T` refers into `data`).
+    template <typename T>
+    std::optional<T> get(std::string_view data) const {
+        auto val = find(data);
+        if (!val)
+            return std::nullopt;
+        return bt_deserialize<T>(*val);
+    }
+
+    /// Patches the value at the path in `data`, an encoded value, to `encoded` (which must be a
+    /// single encoded value), without decoding and re-encoding anything else: the new value is
+    /// spliced in and everything else is moved along as raw bytes.  When the new value has the
+    /// same encoded size as the one it replaces it is simply copied over it in place; otherwise
+    /// `data` is only reallocated if it lacks the capacity for the new size.
+    ///
+    /// If the last step of the path is a dict key that doesn't exist it is inserted, in sorted
+    /// position.  Returns false, leaving `data` unchanged, if the path otherwise does not exist
+    /// (intermediate dicts and lists are not created, and list elements can only be replaced).
+    ///
+    ///     bt_path counter{"stats.count"};
+    ///     counter.set(blob, *counter.get<int64_t>(blob) + 1);
+    ///
+    /// Throws bt_deserialize_invalid if `data` (as far as it has to be walked) or `encoded` is
+    /// invalid.  An empty path replaces `data` entirely.
+    bool set_encoded(std::string& data, std::string_view encoded) const {
+        if (auto err = bt_validate(encoded, {.max_depth = bt_default_max_depth}))
+            detail::throw_bt_error(err);
+        if (steps_.empty()) {
+            data = encoded;
+            return true;
+        }
+        std::string_view s{data};
+        const char* entry = nullptr;
+        auto ec = walk_last(s, &entry);
+        if (ec == bt_errc::key_not_found) {
+            if (!entry)
+                return false;
+            // Missing dict key: insert it (and the value) where the key would be
+            std::string ins;
+            ins.reserve(21 + steps_.back().key.size() + encoded.size());
+            ins += std::to_string(steps_.back().key.size());
+            ins += ':';
+            ins += steps_.back().key;
+            ins += encoded;
+            data.insert(static_cast<size_t>(entry - data.data()), ins);
+            return true;
+        }
+        auto begin = static_cast<size_t>(s.data() - data.data());
+        if (ec == bt_errc::ok)
+            ec = detail::bt_skip_value(s);
+        if (ec != bt_errc::ok)
+            detail::throw_bt_error({ec, static_cast<size_t>(s.data() - data.data())});
+        auto size = static_cast<size_t>(s.data() - data.data()) - begin;
+        if (size == encoded.size())
+            std::memmove(data.data() + begin, encoded.data(), size);
+        else
+            data.replace(begin, size, encoded);
+        return true;
+    }
+
+    /// Same as set_encoded(), but takes any value that bt_serialize() accepts.
+    template <typename T>
+    bool set(std::string& data, const T& value) const {
+        return set_encoded(data, bt_serialize(value));
+    }
+
+    /// Removes the value at the path from `data` (along with its key, if in a dict), moving the
+    /// encoded data after it down in place.  Returns false if there is no value at the path.
+    /// Throws std::invalid_argument if the path is empty, and bt_deserialize_invalid if `data` is
+    /// invalid as far as it has to be walked.
+    bool erase(std::string& data) const {
+        if (steps_.empty())
+            throw std::invalid_argument{"Cannot erase the top-level bt value"};
+        std::string_view s{data};
+        const char* entry = nullptr;
+        auto ec = walk_last(s, &entry);
+        if (ec == bt_errc::key_not_found)
+            return false;
+        if (!entry)
+            entry = s.data();  // a list element
+        if (ec == bt_errc::ok)
+            ec = detail::bt_skip_value(s);
+        if (ec != bt_errc::ok)
+            detail::throw_bt_error({ec, static_cast<size_t>(s.data() - data.data())});
+        data.erase(
+                static_cast<size_t>(entry - data.data()), static_cast<size_t>(s.data() - entry));
+        return true;
+    }
+
+  private:
+    std::vector<step> steps_;
+
+    // Moves `s` to the value reached by the first `n` steps; returns key_not_found if there isn't
+    // one.
+    bt_errc walk(std::string_view& s, size_t n) const {
+        for (size_t i = 0; i < n; i++) {
+            auto& st = steps_[i];
+            if (s.empty())
+                return bt_errc::unexpected_end;
+            if (s[0] != (st.is_index ? 'l' : 'd'))
+                return bt_errc::key_not_found;
+            auto ec = st.is_index ? detail::bt_path_find_index(s, st.index)
+                                  : detail::bt_path_find_key(s, st.key);
+            if (ec != bt_errc::ok)
+                return ec;
+        }
+        return bt_errc::ok;
+    }
+
+    // Like walk() for all the steps, but if the last step is a dict key this also sets `entry` to
+    // where the key is (or would be inserted, if the parent dict exists but doesn't have it).
+    // Errors other than key_not_found are thrown.
+    bt_errc walk_last(std::string_view& s, const char** entry) const {
+        const char* begin = s.data();
+        auto ec = walk(s, steps_.size() - 1);
+        auto& st = steps_.back();
+        if (ec == bt_errc::ok) {
+            if (s.empty())
+                ec = bt_errc::unexpected_end;
+            else if (s[0] != (st.is_index ? 'l' : 'd'))
+                return bt_errc::key_not_found;
+            else if (st.is_index)
+                ec = detail::bt_path_find_index(s, st.index);
+            else
+                ec = detail::bt_path_find_key(s, st.key, entry);
+        }
+        if (ec != bt_errc::ok && ec != bt_errc::key_not_found)
+            detail::throw_bt_error({ec, static_cast<size_t>(s.data() - begin)});
+        return ec;
+    }
+};
+
+/// A set of compiled paths (see bt_path) that are all looked up in a single pass over the data:
+///
+///     static const bt_path_set fields{"result.height", "result.swarm[0].pubkey", "t"};
+///     auto found = fields.find(msg);  // one std::optional<std::string_view> per path
+///
+/// The paths are merged into a tree, so that each list or dict is scanned at most once whatever
+/// the number of paths going through it, and the scan of a list or dict stops as soon as it is
+/// past everything the remaining paths need from it.  Overlapping paths (such as `a` and `a.b`)
+/// are allowed, but then the overlapping part is walked twice.
+class bt_path_set {
+  public:
+    explicit bt_path_set(std::initializer_list<std::string_view> paths) :
+            bt_path_set{std::vector<std::string_view>(paths)} {}
+
+    template <typename Range>
+    requires requires(const Range& r) { bt_path{*std::begin(r)}; }
+    explicit bt_path_set(const Range& paths) {
+        nodes_.emplace_back();
+        for (const auto& p : paths)
+            add(bt_path{p});
+    }
+
+    /// Returns the number of paths.
+    size_t size() const { return size_; }
+
+    /// Non-throwing version of find(), which writes the results to `vals` (resized to size()) to
+    /// allow reusing it.  The path values found before an error is encountered are still set.
+    bt_error try_find(std::string_view data, std::vector<std::optional<std::string_view>>& vals)
+            const {
+        vals.assign(size_, std::nullopt);
+        std::string_view s{data};
+        if (auto ec = walk(0, s, false, vals.data()); ec != bt_errc::ok)
+            return {ec, static_cast<size_t>(s.data() - data.data())};
+        return {};
+    }
+
+    /// Returns the encoded values at each of the paths (in the order the paths were given), with
+    /// std::nullopt for any that `data` does not have.  Throws bt_deserialize_invalid if the data
+    /// walked through is malformed.
+    std::vector<std::optional<std::string_view>> find(std::string_view data) const {
+        std::vector<std::optional<std::string_view>> vals;
+        if (auto err = try_find(data, vals))
+            detail::throw_bt_error(err);
+        return vals;
+    }
+
+    template <const_span_type SpanT>
+    std::vector<std::optional<std::string_view>> find(SpanT data) const {
+        return find(detail::span_to_sv(data));
+    }
+
+  private:
+    struct node {
+        std::vector<std::pair<std::string, size_t>> keys;  // child nodes by key, sorted
+        std::vector<std::pair<size_t, size_t>> indices;    // child nodes by list index, sorted
+        std::vector<size_t> paths;                         // the paths ending here
+    };
+    std::vector<node> nodes_;
+    size_t size_ = 0;
+
+    void add(const bt_path& path) {
+        size_t n = 0;
+        for (auto& st : path.steps()) {
+            auto child = [this, n](auto& children, const auto& k) {
+                auto it = std::lower_bound(
+                        children.begin(), children.end(), k, [](const auto& c, const auto& k) {
+                            return c.first < k;
+                        });
+                if (it != children.end() && it->first == k)
+                    return it->second;
+                size_t c = nodes_.size();
+                children.insert(it, {k, c});
+                nodes_.emplace_back();  // (invalidates `children`)
+                return c;
+            };
+            n = st.is_index ? child(nodes_[n].indices, st.index) : child(nodes_[n].keys, st.key);
+        }
+        nodes_[n].paths.push_back(size_++);
+    }
+
+    // Walks the value at the front of `s` for node `n`.  If `need_end` is set this consumes the
+    // whole value; otherwise it may stop as soon as it has found everything below `n`.
+    bt_errc walk(
+            size_t n,
+            std::string_view& s,
+            bool need_end,
+            std::optional<std::string_view>* vals) const {
+        auto& nd = nodes_[n];
+        if (s.empty())
+            return bt_errc::unexpected_end;
+        bool dict = s[0] == 'd' && !nd.keys.empty(), list = s[0] == 'l' && !nd.indices.empty();
+
+        if (!nd.paths.empty()) {
+            auto inner = s;
+            std::string_view val;
+            if (auto ec = detail::bt_path_take_value(s, val); ec != bt_errc::ok)
+                return ec;
+            for (auto p : nd.paths)
+                vals[p] = val;
+            if (dict || list) {
+                if (auto ec = walk_children(nd, dict, inner, false, vals); ec != bt_errc::ok) {
+                    s = inner;
+                    return ec;
+                }
+            }
+            return bt_errc::ok;
+        }
+        if (dict || list)
+            return walk_children(nd, dict, s, need_end, vals);
+        return need_end ? detail::bt_skip_value(s) : bt_errc::ok;
+    }
+
+    bt_errc walk_children(
+            const node& nd,
+            bool dict,
+            std::string_view& s,
+            bool need_end,
+            std::optional<std::string_view>* vals) const {
+        s.remove_prefix(1);
+        size_t next = 0, count = dict ? nd.keys.size() : nd.indices.size();
+        for (size_t index = 0;; index++) {
+            if (s.empty())
+                return bt_errc::unexpected_end;
+            if (s[0] == 'e') {
+                s.remove_prefix(1);
+                return bt_errc::ok;
+            }
+            if (next == count && !need_end)
+                return bt_errc::ok;
+            bool match = false;
+            if (dict) {
+                std::string_view k;
+                if (auto ec = detail::bt_deserialize<std::string_view>{}(s, k); ec != bt_errc::ok)
+                    return ec;
+                if (s.empty())
+                    return bt_errc::unexpected_end;
+                if (s[0] == 'e')
+                    return bt_errc::invalid_value;  // key isn't followed by a value
+                while (next < count && nd.keys[next].first < k)
+                    next++;
+                match = next < count && nd.keys[next].first == k;
+            } else {
+                match = next < count && nd.indices[next].first == index;
+            }
+            if (match) {
+                auto child = dict ? nd.keys[next].second : nd.indices[next].second;
+                bool last = ++next == count;
+                if (auto ec = walk(child, s, need_end || !last, vals); ec != bt_errc::ok)
+                    return ec;
+                if (last && !need_end)
+                    return bt_errc::ok;
+            } else if (auto ec = detail::bt_skip_value(s); ec != bt_errc::ok) {
+                return ec;
+            }
+        }
+    }
+};
+
+}  // namespace oxenc
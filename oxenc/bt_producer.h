@@ -12,7 +12,7 @@
 #include <utility>
 
 #ifndef NDEBUG
-#include "bt_serialize.h"
+#include "bt_validate.h"
 #endif
 #include "bt_common.h"
 #include "common.h"
@@ -148,6 +148,26 @@ class bt_list_producer {
     // Appends to buffer, throws on overrun/
     void buffer_append(const char* data, size_t size);
 
+    // Makes room for exactly `size` bytes at the end of the buffer (throwing on overrun), calls
+    // `write(char*)` to write them in place, and then advances past them.
+    template <typename Write>
+    void buffer_append_with(size_t size, Write&& write) {
+        char* dest;
+        if (auto* s = std::get_if<std::string>(&out)) {
+            s->resize(next + size);  // Also truncates any trailing e's
+            dest = s->data() + next;
+        } else {
+            auto* bs = std::get_if<buf_span>(&out);
+            assert(bs);
+            if (size > static_cast<size_t>(std::distance(bs->init + next, bs->end)))
+                throw std::length_error{"Cannot write bt_producer: buffer size exceeded"};
+            dest = bs->init + next;
+        }
+        write(dest);
+        for (auto* p = this; p; p = p->parent())
+            p->next += size;
+    }
+
     // Appends the 'e's into the buffer to close off open sublists/dicts *without* advancing the
     // buffer position; we do this after each append so that the buffer always contains valid
     // encoded data, even while we are still appending to it, and so that appending something raises
@@ -503,6 +523,12 @@ class bt_list_producer {
     template <typename T>
     void append_bt(const T& bt);
 
+    /// Appends a struct with a bt_fields description as a dict.  The encoded size is computed
+    /// first and the dict is then encoded directly into the buffer, using pre-encoded keys.  You
+    /// must include the bt_struct.h header (either directly or via bt.h) to use this method.
+    template <bt_struct_type T>
+    void append_struct(const T& val);
+
     /// Appends a signature of the previous list values to the list, calling the given invocable
     /// object to obtain the signature.
     ///
@@ -531,7 +557,10 @@ class bt_list_producer {
     void append_encoded(T encoded) {
 #ifndef NDEBUG
         // on debug build, throw if `encoded` is invalid bt-encoded data
-        (void)bt_deserialize<bt_value>(encoded);
+        if (auto err = bt_validate(
+                    std::string_view{reinterpret_cast<const char*>(encoded.data()), encoded.size()},
+                    {.max_depth = bt_validate_limits::max_depth_cap}))
+            detail::throw_bt_error(err);
 #endif
         buffer_append(reinterpret_cast<const char*>(encoded.data()), encoded.size());
         append_intermediate_ends();
@@ -793,6 +822,18 @@ class bt_dict_producer : bt_list_producer {
     template <typename T>
     void append_bt(std::string_view key, const T& bt);
 
+    /// Appends a struct with a bt_fields description as a subdict with the given key.  You must
+    /// include the bt_struct.h header (either directly or via bt.h) to use this method.
+    template <bt_struct_type T>
+    void append_struct(std::string_view key, const T& val);
+
+    /// Appends the fields of a struct with a bt_fields description directly to this dict (i.e.
+    /// *not* as a subdict).  The struct's keys must all sort after any keys already in the dict;
+    /// this, like other key ordering, is only checked in debug builds.  You must include the
+    /// bt_struct.h header (either directly or via bt.h) to use this method.
+    template <bt_struct_type T>
+    void append_fields(const T& val);
+
     /// Appends a signature of the previous dict keys/values to the list, calling the given
     /// invocable object to obtain the signature.
     ///
@@ -0,0 +1,360 @@
+#pragma once
+
+#include <algorithm>
+#include <concepts>
+#include <cstdint>
+#include <limits>
+#include <string_view>
+
+#include "bt_serialize.h"
+#include "span.h"
+
+namespace oxenc {
+
+/// Event passed to the handler of a bt_push_parser as values are parsed.
+struct bt_push_event {
+    enum class kind : uint8_t {
+        list_begin,  ///< start of a list
+        dict_begin,  ///< start of a dict
+        end,         ///< end of the innermost open list or dict
+        integer,     ///< an integer value; see `negative`, `i64`, and `u64`
+        key,         ///< (part of) a dict key; see `data`, `offset`, and `size`
+        string,      ///< (part of) a string value; see `data`, `offset`, and `size`
+    };
+
+    kind type = kind::end;
+
+    /// Nesting depth of the value: 0 for the top-level value, 1 for the keys and values of a
+    /// top-level dict or list, and so on.  An `end` event has the same depth as its `_begin`.
+    size_t depth = 0;
+
+    /// For `integer` events: if `negative` is true the value is in `i64`, otherwise in `u64`.
+    bool negative = false;
+    union {
+        int64_t i64;
+        uint64_t u64 = 0;
+    };
+
+    /// For `key` and `string` events: strings are delivered in one or more pieces as the data
+    /// arrives.  `data` is the piece, which starts at byte `offset` of the full string of `size`
+    /// bytes; the final piece is the one with `offset + data.size() == size`.  An empty string is
+    /// delivered as a single, empty piece.  `data` points into the chunk passed to `feed()` and so
+    /// must be copied if it needs to outlive the handler call.
+    std::string_view data;
+    size_t offset = 0;
+    size_t size = 0;
+};
+
+/// Parsing state of a bt_push_parser.
+enum class bt_push_status : uint8_t {
+    need_more,  ///< the message is not yet complete
+    complete,   ///< a complete message has been parsed
+    error,      ///< the input is invalid; see `bt_push_parser::error()`
+};
+
+/// Incremental, push-style parser for a single bt-encoded message that arrives in arbitrary
+/// fragments (e.g. from a socket).  Each chunk is passed to `feed()` as it is received; the parser
+/// keeps its state between calls (it never needs earlier chunks again, and never allocates) and
+/// invokes a handler with a bt_push_event for each value as soon as it has been read, so that
+/// processing can overlap with receiving and large messages never need a second pass.
+///
+/// Once the message is complete `feed()` stops consuming input: the return value tells how much
+/// of the chunk belonged to this message, and anything after that is the start of the next one.
+/// Call `reset()` to parse another message with the same parser.
+///
+///     bt_push_parser parser;
+///     while (auto chunk = receive()) {
+///         while (!chunk.empty()) {
+///             chunk.remove_prefix(parser.feed(chunk, handler));
+///             if (parser.complete()) {
+///                 message_done(parser.consumed());
+///                 parser.reset();
+///             } else if (parser.failed()) {
+///                 return reject(parser.error());
+///             }
+///         }
+///     }
+///
+/// The parser accepts the same input as bt_deserialize<bt_value> (including the 64-bit integer
+/// limits and the list/dict nesting limit given to the constructor), except that duplicate and
+/// unsorted dict keys are not detected.  Errors report the offset, from the beginning of the
+/// message, of the byte at which the problem was detected.
+class bt_push_parser {
+  public:
+    /// Constructs a parser.  Lists and dicts nested more than `max_depth` levels deep (which is
+    /// capped at bt_max_skip_depth) are rejected with bt_errc::depth_limit.
+    explicit bt_push_parser(size_t max_depth = bt_default_max_depth) :
+            max_depth_{std::min(max_depth, bt_max_skip_depth)} {}
+
+    /// Feeds the next chunk of the message, calling `handler(const bt_push_event&)` for each
+    /// parsed event.  Returns the number of bytes of `chunk` that were consumed, which is the full
+    /// chunk unless the message completes (or fails) part way through it.  Does nothing (and
+    /// returns 0) if the message is already complete or has failed.
+    ///
+    /// If the handler throws the exception propagates to the caller, and the parser must be reset
+    /// before it is used again.
+    template <std::invocable<const bt_push_event&> Handler>
+    size_t feed(std::string_view chunk, Handler&& handler);
+
+    /// Feeds the next chunk without generating events; this just validates the message and finds
+    /// where it ends.
+    size_t feed(std::string_view chunk) {
+        return feed(chunk, [](const bt_push_event&) {});
+    }
+
+    template <const_span_type SpanT, std::invocable<const bt_push_event&> Handler>
+    size_t feed(SpanT chunk, Handler&& handler) {
+        return feed(detail::span_to_sv(chunk), std::forward<Handler>(handler));
+    }
+    template <const_span_type SpanT>
+    size_t feed(SpanT chunk) {
+        return feed(detail::span_to_sv(chunk));
+    }
+
+    /// Returns the current status of the parser.
+    bt_push_status status() const {
+        return state_ == state::done     ? bt_push_status::complete
+             : state_ == state::failed ? bt_push_status::error
+                                       : bt_push_status::need_more;
+    }
+    /// Returns true if a complete message has been parsed.
+    bool complete() const { return state_ == state::done; }
+    /// Returns true if the input was invalid.
+    bool failed() const { return state_ == state::failed; }
+
+    /// Returns the error, if the input was invalid; otherwise returns an empty bt_error.  The
+    /// offset is relative to the start of the message.
+    bt_error error() const { return error_; }
+
+    /// Returns the number of bytes of the message consumed so far.  Once complete, this is the
+    /// size of the message (i.e. the message ends at this offset of the input stream).
+    size_t consumed() const { return consumed_; }
+
+    /// Returns the current list/dict nesting depth of the parser.
+    size_t depth() const { return depth_; }
+
+    /// Resets the parser to begin a new message.
+    void reset() {
+        state_ = state::value;
+        depth_ = 0;
+        consumed_ = 0;
+        want_key_ = false;
+        error_ = {};
+    }
+
+  private:
+    enum class state : uint8_t {
+        value,       // Expecting a value, dict key, or list/dict end
+        int_sign,    // After `i`, expecting `-` or a digit
+        int_first,   // After `i-`, expecting a digit
+        int_digits,  // Reading integer digits, or the terminating `e`
+        len_digits,  // Reading string length digits, or the terminating `:`
+        str_data,    // Reading string data
+        done,
+        failed,
+    };
+
+    size_t max_depth_;
+    size_t depth_ = 0;
+    size_t consumed_ = 0;
+    state state_ = state::value;
+    bool want_key_ = false;  // True if the innermost container is a dict and expects a key
+    bool is_key_ = false;    // True if the string being read is a dict key
+    bool negative_ = false;
+    uint64_t num_ = 0;   // Integer value or string length being parsed
+    uint64_t read_ = 0;  // String bytes read so far
+    bt_error error_;
+    // One bit per open container, set for dicts
+    uint64_t dicts_[bt_max_skip_depth / 64] = {};
+
+    bool in_dict() const { return dicts_[(depth_ - 1) / 64] >> ((depth_ - 1) % 64) & 1; }
+
+    // Called when a (non-key) value has been fully parsed.
+    void value_done() {
+        if (depth_ == 0) {
+            state_ = state::done;
+        } else {
+            state_ = state::value;
+            want_key_ = in_dict();
+        }
+    }
+
+    // Accumulates a digit into num_; returns false on overflow.
+    bool add_digit(char c) {
+        uint64_t d = static_cast<uint64_t>(c - '0');
+        if (num_ > (std::numeric_limits<uint64_t>::max() - d) / 10)
+            return false;
+        num_ = num_ * 10 + d;
+        return true;
+    }
+
+    static bool is_digit(char c) { return c >= '0' && c <= '9'; }
+
+    bt_push_event event(bt_push_event::kind type) const {
+        bt_push_event ev;
+        ev.type = type;
+        ev.depth = depth_;
+        return ev;
+    }
+};
+
+template <std::invocable<const bt_push_event&> Handler>
+size_t bt_push_parser::feed(std::string_view chunk, Handler&& handler) {
+    const char* const begin = chunk.data();
+    const char* const end = begin + chunk.size();
+    const char* p = begin;
+
+    auto fail = [&](bt_errc ec) {
+        error_ = {ec, consumed_ + static_cast<size_t>(p - begin)};
+        state_ = state::failed;
+    };
+
+    while (p < end && state_ != state::done && state_ != state::failed) {
+        switch (state_) {
+            case state::value:
+                if (depth_ > 0 && *p == 'e') {
+                    if (!want_key_ && in_dict()) {
+                        fail(bt_errc::invalid_value);  // key isn't followed by a value
+                        break;
+                    }
+                    ++p;
+                    --depth_;
+                    handler(event(bt_push_event::kind::end));
+                    value_done();
+                } else if (want_key_) {
+                    if (!is_digit(*p)) {
+                        fail(bt_errc::wrong_type);  // Dict keys must be strings
+                        break;
+                    }
+                    is_key_ = true;
+                    num_ = 0;
+                    state_ = state::len_digits;
+                } else if (*p == 'l' || *p == 'd') {
+                    if (depth_ >= max_depth_) {
+                        fail(bt_errc::depth_limit);
+                        break;
+                    }
+                    bool dict = *p == 'd';
+                    handler(event(
+                            dict ? bt_push_event::kind::dict_begin
+                                 : bt_push_event::kind::list_begin));
+                    auto& word = dicts_[depth_ / 64];
+                    auto bit = uint64_t{1} << (depth_ % 64);
+                    word = dict ? word | bit : word & ~bit;
+                    ++depth_;
+                    want_key_ = dict;
+                    ++p;
+                } else if (*p == 'i') {
+                    negative_ = false;
+                    num_ = 0;
+                    state_ = state::int_sign;
+                    ++p;
+                } else if (is_digit(*p)) {
+                    is_key_ = false;
+                    num_ = 0;
+                    state_ = state::len_digits;
+                } else {
+                    fail(bt_errc::invalid_value);
+                }
+                break;
+
+            case state::int_sign:
+                if (*p == '-') {
+                    negative_ = true;
+                    ++p;
+                }
+                state_ = state::int_first;
+                break;
+
+            case state::int_first:
+                if (!is_digit(*p)) {
+                    fail(bt_errc::invalid_value);
+                    break;
+                }
+                state_ = state::int_digits;
+                [[fallthrough]];
+
+            case state::int_digits:
+                for (; p < end && is_digit(*p); ++p)
+                    if (!add_digit(*p))
+                        break;
+                if (p == end)
+                    break;
+                if (is_digit(*p)) {
+                    fail(bt_errc::integer_overflow);
+                    break;
+                }
+                if (*p != 'e') {
+                    fail(bt_errc::invalid_value);
+                    break;
+                }
+                if (negative_ && num_ > (uint64_t{1} << 63)) {
+                    fail(bt_errc::integer_overflow);
+                    break;
+                }
+                ++p;
+                {
+                    auto ev = event(bt_push_event::kind::integer);
+                    ev.negative = negative_;
+                    if (negative_)
+                        ev.i64 = -static_cast<int64_t>(num_);
+                    else
+                        ev.u64 = num_;
+                    handler(ev);
+                }
+                value_done();
+                break;
+
+            case state::len_digits:
+                for (; p < end && is_digit(*p); ++p)
+                    if (!add_digit(*p))
+                        break;
+                if (p == end)
+                    break;
+                if (is_digit(*p)) {
+                    fail(bt_errc::integer_overflow);
+                    break;
+                }
+                if (*p != ':') {
+                    fail(bt_errc::invalid_value);
+                    break;
+                }
+                ++p;
+                read_ = 0;
+                state_ = state::str_data;
+                if (num_ > 0)
+                    break;
+                [[fallthrough]];  // An empty string is complete already
+
+            case state::str_data: {
+                auto n = static_cast<size_t>(
+                        std::min<uint64_t>(num_ - read_, static_cast<uint64_t>(end - p)));
+                auto ev = event(is_key_ ? bt_push_event::kind::key : bt_push_event::kind::string);
+                ev.data = {p, n};
+                ev.offset = static_cast<size_t>(read_);
+                ev.size = static_cast<size_t>(num_);
+                handler(ev);
+                p += n;
+                read_ += n;
+                if (read_ < num_)
+                    break;
+                if (is_key_) {
+                    want_key_ = false;
+                    state_ = state::value;
+                } else {
+                    value_done();
+                }
+                break;
+            }
+
+            case state::done:
+            case state::failed: break;
+        }
+    }
+
+    auto n = static_cast<size_t>(p - begin);
+    consumed_ += n;
+    return n;
+}
+
+}  // namespace oxenc
@@ -0,0 +1,665 @@
+#pragma once
+
+#include <algorithm>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include "bt_serialize.h"
+
+namespace oxenc {
+
+namespace detail {
+
+    /// Position within a sequence of input segments.  The position is kept normalized so that,
+    /// unless at the end of the input, it always points at an actual byte (i.e. empty segments and
+    /// segment ends are skipped over).
+    class bt_segment_cursor {
+      public:
+        bt_segment_cursor() = default;
+        explicit bt_segment_cursor(std::span<const std::string_view> segments) : segs_{segments} {
+            normalize();
+        }
+
+        bool at_end() const { return seg_ == segs_.size(); }
+
+        // Offset from the beginning of the input.
+        size_t offset() const { return offset_; }
+
+        // The rest of the current segment.
+        std::string_view contiguous() const {
+            return at_end() ? std::string_view{} : segs_[seg_].substr(pos_);
+        }
+
+        // Returns the byte `i` bytes ahead of the current position, or nullopt if the input ends
+        // first.
+        std::optional<char> peek(size_t i = 0) const {
+            for (size_t s = seg_, p = pos_; s < segs_.size(); s++, p = 0) {
+                if (i < segs_[s].size() - p)
+                    return segs_[s][p + i];
+                i -= segs_[s].size() - p;
+            }
+            return std::nullopt;
+        }
+
+        // Advances by `n` bytes; returns false (leaving the cursor at the end) if the input ends
+        // first.
+        bool advance(size_t n) {
+            while (n > 0 && !at_end()) {
+                size_t step = std::min(n, segs_[seg_].size() - pos_);
+                pos_ += step;
+                offset_ += step;
+                n -= step;
+                normalize();
+            }
+            return n == 0;
+        }
+
+        // Copies up to `n` bytes from the current position into `out` without advancing; returns
+        // the number of bytes copied, which is less than `n` only at the end of the input.
+        size_t peek_copy(char* out, size_t n) const {
+            size_t copied = 0;
+            for (size_t s = seg_, p = pos_; s < segs_.size() && copied < n; s++, p = 0) {
+                size_t len = std::min(n - copied, segs_[s].size() - p);
+                std::memcpy(out + copied, segs_[s].data() + p, len);
+                copied += len;
+            }
+            return copied;
+        }
+
+        // Calls `f(std::string_view)` for each piece of the next `n` bytes (which must exist).
+        template <typename F>
+        void for_each_piece(size_t n, F&& f) const {
+            for (size_t s = seg_, p = pos_; n > 0; s++, p = 0) {
+                size_t len = std::min(n, segs_[s].size() - p);
+                if (len)
+                    f(segs_[s].substr(p, len));
+                n -= len;
+            }
+        }
+
+      private:
+        std::span<const std::string_view> segs_;
+        size_t seg_ = 0;
+        size_t pos_ = 0;
+        size_t offset_ = 0;
+
+        void normalize() {
+            while (seg_ < segs_.size() && pos_ == segs_[seg_].size()) {
+                ++seg_;
+                pos_ = 0;
+            }
+        }
+    };
+
+    // Parses a (short) token at the cursor with `parse(std::string_view&) -> bt_errc`, which must
+    // advance the view past the token on success and leave it at the error position on failure.
+    // Tokens are parsed in place when they lie within the current segment, and otherwise from a
+    // copy of the next 64 bytes, which is plenty for any canonically encoded integer or string
+    // length; a longer (non-canonical, zero-padded) token is copied again into a buffer twice the
+    // size until its terminator is reached.  Returns the error, with an offset relative to the
+    // whole input.
+    template <typename Parse>
+    bt_error bt_segmented_token(bt_segment_cursor& c, Parse&& parse) {
+        std::string_view s = c.contiguous();
+        const char* begin = s.data();
+        if (parse(s) == bt_errc::ok) {
+            c.advance(static_cast<size_t>(s.data() - begin));
+            return {};
+        }
+        char buf[64];
+        std::string long_buf;
+        size_t want = sizeof(buf);
+        std::string_view copy{buf, c.peek_copy(buf, want)};
+        while (true) {
+            s = copy;
+            auto ec = parse(s);
+            size_t n = static_cast<size_t>(s.data() - copy.data());
+            if (ec == bt_errc::unexpected_end && copy.size() == want) {
+                // Ran out of copy rather than input
+                want *= 2;
+                long_buf.resize(want);
+                copy = {long_buf.data(), c.peek_copy(long_buf.data(), want)};
+                continue;
+            }
+            if (ec != bt_errc::ok)
+                return {ec, c.offset() + n};
+            c.advance(n);
+            return {};
+        }
+    }
+
+    // Parses a string length prefix (`123:`), advancing past it and setting `len`.  Does not check
+    // that the string data is actually present.
+    inline bt_error bt_segmented_string_length(bt_segment_cursor& c, uint64_t& len) {
+        auto ch = c.peek();
+        if (!ch)
+            return {bt_errc::unexpected_end, c.offset()};
+        if (*ch < '0' || *ch > '9')
+            return {bt_errc::wrong_type, c.offset()};
+        return bt_segmented_token(c, [&len](std::string_view& s) {
+            if (auto ec = extract_unsigned(s, len); ec != bt_errc::ok)
+                return ec;
+            if (s.empty())
+                return bt_errc::unexpected_end;
+            if (s[0] != ':')
+                return bt_errc::invalid_value;
+            s.remove_prefix(1);
+            return bt_errc::ok;
+        });
+    }
+
+    // Parses a string at the cursor, setting `start` to the position of its data and `len` to its
+    // length, and advancing past it.
+    inline bt_error bt_segmented_string(
+            bt_segment_cursor& c, bt_segment_cursor& start, size_t& len) {
+        auto orig = c;
+        uint64_t l;
+        if (auto err = bt_segmented_string_length(c, l))
+            return err;
+        start = c;
+        if (l > std::numeric_limits<size_t>::max() || !c.advance(static_cast<size_t>(l))) {
+            c = orig;
+            return {bt_errc::string_length, c.offset()};
+        }
+        len = static_cast<size_t>(l);
+        return {};
+    }
+
+    // Skips over one complete value at the cursor.  On failure the cursor is left unchanged.
+    inline bt_error bt_segmented_skip(
+            bt_segment_cursor& c, size_t max_depth = bt_default_max_depth) {
+        max_depth = std::min(max_depth, bt_max_skip_depth);
+        uint64_t dicts[bt_max_skip_depth / 64];
+        size_t depth = 0;
+        bool want_key = false;
+        auto in_dict = [&] { return dicts[(depth - 1) / 64] >> ((depth - 1) % 64) & 1; };
+        // End of the segment in which skipping a value in one go last failed: values in the rest
+        // of that segment are walked token by token, rather than each retrying (and failing) to
+        // skip to the end of the segment.
+        const char* failed_seg_end = nullptr;
+        auto cur = c;
+        do {
+            auto ch = cur.peek();
+            if (!ch)
+                return {bt_errc::unexpected_end, cur.offset()};
+            if (depth > 0 && *ch == 'e') {
+                if (!want_key && in_dict())
+                    return {bt_errc::invalid_value, cur.offset()};  // key without a value
+                cur.advance(1);
+                --depth;
+                want_key = depth > 0 && in_dict();
+                continue;
+            }
+            bt_segment_cursor start;
+            size_t len;
+            if (want_key) {
+                if (auto err = bt_segmented_string(cur, start, len))
+                    return err;
+                want_key = false;
+                continue;
+            }
+
+            // Values lying entirely within the current segment are skipped in one go; anything
+            // else is walked token by token.
+            std::string_view s = cur.contiguous();
+            const char* begin = s.data();
+            const char* seg_end = s.data() + s.size();
+            bool skipped = false;
+            if (seg_end != failed_seg_end) {
+                skipped = bt_skip_value(s, max_depth - depth) == bt_errc::ok;
+                if (!skipped)
+                    failed_seg_end = seg_end;
+            }
+            if (skipped) {
+                cur.advance(static_cast<size_t>(s.data() - begin));
+            } else if (*ch == 'l' || *ch == 'd') {
+                if (depth >= max_depth)
+                    return {bt_errc::depth_limit, cur.offset()};
+                auto& word = dicts[depth / 64];
+                auto bit = uint64_t{1} << (depth % 64);
+                word = *ch == 'd' ? word | bit : word & ~bit;
+                ++depth;
+                want_key = *ch == 'd';
+                cur.advance(1);
+                continue;
+            } else if (*ch == 'i') {
+                if (auto err = bt_segmented_token(cur, [](std::string_view& s) {
+                        std::pair<some64, bool> ignored;
+                        return bt_deserialize_integer(s, ignored);
+                    }))
+                    return err;
+            } else if (*ch >= '0' && *ch <= '9') {
+                if (auto err = bt_segmented_string(cur, start, len))
+                    return err;
+            } else {
+                return {bt_errc::invalid_value, cur.offset()};
+            }
+            want_key = depth > 0 && in_dict();
+        } while (depth > 0);
+        c = cur;
+        return {};
+    }
+
+}  // namespace detail
+
+/// A string value from a segmented consumer, which may span several input segments.  This does
+/// not copy the string: it refers to the consumer's input segments, which must stay valid.
+class bt_segmented_view {
+  public:
+    bt_segmented_view() = default;
+    bt_segmented_view(detail::bt_segment_cursor start, size_t size) : start_{start}, size_{size} {}
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    /// Returns true if the string lies within a single input segment.
+    bool contiguous() const { return start_.contiguous().size() >= size_; }
+
+    /// Calls `f(std::string_view)` for each piece of the string, in order.
+    template <std::invocable<std::string_view> F>
+    void for_each_piece(F&& f) const {
+        start_.for_each_piece(size_, std::forward<F>(f));
+    }
+
+    /// Copies the string to `out`, which must have room for `size()` bytes.
+    void copy_to(char* out) const {
+        for_each_piece([&out](std::string_view piece) {
+            std::memcpy(out, piece.data(), piece.size());
+            out += piece.size();
+        });
+    }
+
+    /// Returns a copy of the string.
+    std::string str() const {
+        std::string s(size_, '\0');
+        copy_to(s.data());
+        return s;
+    }
+
+    bool operator==(std::string_view s) const {
+        if (s.size() != size_)
+            return false;
+        bool eq = true;
+        for_each_piece([&](std::string_view piece) {
+            eq = eq && s.starts_with(piece);
+            s.remove_prefix(piece.size());
+        });
+        return eq;
+    }
+
+  private:
+    detail::bt_segment_cursor start_;
+    size_t size_ = 0;
+};
+
+class bt_segmented_dict_consumer;
+
+/// Consumer for a bt-encoded list split across several non-contiguous input segments (such as an
+/// iovec chain, the two halves of a wrapped ring buffer, or the pieces of a rope), without first
+/// copying it into one contiguous buffer.  Tokens, length prefixes, and string data may straddle
+/// segment boundaries anywhere.  The segments themselves, and the data they refer to, must remain
+/// valid for the lifetime of the consumer (and of any sub-consumers and views obtained from it).
+///
+///     std::string_view segments[] = {first_buffer, second_buffer};
+///     bt_segmented_list_consumer c{segments};
+///     auto n = c.consume_integer<int>();
+///     auto name = c.consume_string_view();
+///
+/// This supports the commonly used part of the bt_list_consumer interface.  Strings can be
+/// consumed three ways: as a std::string_view, which points directly into the input when the
+/// string lies within one segment and otherwise into a scratch buffer of the consumer (which is
+/// overwritten by the next such string); as a bt_segmented_view, which never copies; or as a
+/// std::string copy.
+///
+/// Errors throw the same exceptions as bt_list_consumer, with the byte offset relative to the
+/// beginning of the first segment.
+class bt_segmented_list_consumer {
+  protected:
+    detail::bt_segment_cursor cur_;
+    std::string scratch_;
+    // Offset of the end of the value, for sub-consumers; the top-level value must end the input.
+    size_t end_ = std::numeric_limits<size_t>::max();
+
+    bt_segmented_list_consumer() = default;
+
+    explicit bt_segmented_list_consumer(detail::bt_segment_cursor cur, char type) : cur_{cur} {
+        auto ch = cur_.peek();
+        if (!ch)
+            throw std::runtime_error{"Cannot create a segmented consumer with no data"};
+        if (*ch != type)
+            throw std::runtime_error{
+                    type == 'l' ? "Cannot create a bt_list_consumer with non-list data"
+                                : "Cannot create a bt_dict_consumer with non-dict data"};
+        cur_.advance(1);
+    }
+
+    char peek_value() const {
+        auto ch = cur_.peek();
+        if (!ch)
+            detail::throw_bt_error({bt_errc::unexpected_end, cur_.offset()});
+        return *ch;
+    }
+
+    bt_segmented_view consume_view() {
+        bt_segment_cursor start;
+        size_t len;
+        if (auto err = detail::bt_segmented_string(cur_, start, len))
+            detail::throw_bt_error(err);
+        return {start, len};
+    }
+
+    // Returns a view of a segmented string, copying it into `scratch` if it isn't contiguous.
+    static std::string_view view_of(const bt_segmented_view& v, std::string& scratch) {
+        std::string_view result;
+        if (v.contiguous()) {
+            v.for_each_piece([&result](std::string_view piece) { result = piece; });
+            return result;
+        }
+        scratch.resize(v.size());
+        v.copy_to(scratch.data());
+        return scratch;
+    }
+
+    template <std::integral IntType>
+    IntType consume_int() {
+        IntType val;
+        if (auto err = detail::bt_segmented_token(cur_, [&val](std::string_view& s) {
+                return detail::bt_deserialize<IntType>{}(s, val);
+            }))
+            detail::throw_bt_error(err);
+        return val;
+    }
+
+    void skip() {
+        if (auto err = detail::bt_segmented_skip(cur_))
+            detail::throw_bt_error(err);
+    }
+
+    template <typename Consumer>
+    Consumer consume_sub() {
+        char type = std::same_as<Consumer, bt_segmented_list_consumer> ? 'l' : 'd';
+        if (peek_value() != type)
+            detail::throw_bt_error({bt_errc::wrong_type, cur_.offset()});
+        auto start = cur_;
+        skip();
+        Consumer sub{start, type};
+        sub.end_ = cur_.offset();
+        return sub;
+    }
+
+    using bt_segment_cursor = detail::bt_segment_cursor;
+    friend class bt_segmented_dict_consumer;
+
+  public:
+    explicit bt_segmented_list_consumer(std::span<const std::string_view> segments) :
+            bt_segmented_list_consumer{detail::bt_segment_cursor{segments}, 'l'} {}
+
+    /// Returns the offset of the current position from the beginning of the input.
+    size_t offset() const { return cur_.offset(); }
+
+    /// Returns true if the next value indicates the end of the list
+    bool is_finished() const { return peek_value() == 'e'; }
+    /// Returns true if the next element looks like an encoded string
+    bool is_string() const {
+        char c = peek_value();
+        return c >= '0' && c <= '9';
+    }
+    /// Returns true if the next element looks like an encoded integer
+    bool is_integer() const { return peek_value() == 'i'; }
+    /// Returns true if the next element looks like an encoded negative integer
+    bool is_negative_integer() const { return is_integer() && cur_.peek(1) == '-'; }
+    /// Returns true if the next element looks like an encoded non-negative integer
+    bool is_unsigned_integer() const {
+        return is_integer() && cur_.peek(1) && *cur_.peek(1) >= '0' && *cur_.peek(1) <= '9';
+    }
+    /// Returns true if the next element looks like an encoded list
+    bool is_list() const { return peek_value() == 'l'; }
+    /// Returns true if the next element looks like an encoded dict
+    bool is_dict() const { return peek_value() == 'd'; }
+
+    /// Consumes the next value as a string, returning a view of it.  If the string spans several
+    /// segments it is copied into a scratch buffer, and the view is only valid until the next
+    /// string is consumed.
+    std::string_view consume_string_view() { return view_of(consume_view(), scratch_); }
+
+    /// Consumes the next value as a string without copying it.
+    bt_segmented_view consume_segmented_string() { return consume_view(); }
+
+    /// Consumes the next value as a string, returning a copy.
+    std::string consume_string() { return consume_view().str(); }
+
+    /// Consumes the next value as an integer of the given type.
+    template <std::integral IntType>
+    IntType consume_integer() {
+        return consume_int<IntType>();
+    }
+
+    /// Consumes the next value as a sublist.
+    bt_segmented_list_consumer consume_list_consumer() {
+        return consume_sub<bt_segmented_list_consumer>();
+    }
+
+    /// Consumes the next value as a subdict.
+    inline bt_segmented_dict_consumer consume_dict_consumer();
+
+    /// Consumes the next value as the given type: an integer, std::string, std::string_view (see
+    /// consume_string_view()), bt_segmented_view, or a segmented list or dict consumer.
+    template <typename T>
+    T consume();
+
+    /// Consumes a value without returning it.
+    void skip_value() { skip(); }
+
+    /// Reads through any remaining values to the end of the list, and confirms that the end of the
+    /// list is the end of the input.
+    void finish() {
+        while (!is_finished())
+            skip();
+        cur_.advance(1);
+        if (end_ == std::numeric_limits<size_t>::max() ? !cur_.at_end() : cur_.offset() != end_)
+            detail::throw_bt_error({bt_errc::trailing_data, cur_.offset()});
+    }
+};
+
+/// Consumer for a bt-encoded dict split across several non-contiguous input segments; see
+/// bt_segmented_list_consumer.  This supports the commonly used part of the bt_dict_consumer
+/// interface.  Keys are returned as std::string_views: a key spanning several segments is copied
+/// into a scratch buffer (separate from the one for string values), which is valid until the next
+/// key is read.
+class bt_segmented_dict_consumer : private bt_segmented_list_consumer {
+    friend class bt_segmented_list_consumer;
+
+    std::string_view key_;  // The current key, when not in key_scratch_
+    std::string key_scratch_;
+    bool have_key_ = false;
+    bool key_in_scratch_ = false;
+
+    bt_segmented_dict_consumer(bt_segment_cursor cur, char type) :
+            bt_segmented_list_consumer{cur, type} {}
+
+    // Reads the next key, if not already read; returns false at the end of the dict.
+    bool consume_key() {
+        if (have_key_)
+            return true;
+        if (peek_value() == 'e')
+            return false;
+        auto k = consume_view();
+        if (cur_.at_end())
+            detail::throw_bt_error({bt_errc::unexpected_end, cur_.offset()});
+        if (*cur_.peek() == 'e')
+            detail::throw_bt_error({bt_errc::invalid_value, cur_.offset()});
+        key_in_scratch_ = !k.contiguous();
+        key_ = view_of(k, key_scratch_);
+        have_key_ = true;
+        return true;
+    }
+
+    std::string_view current_key() const {
+        return key_in_scratch_ ? std::string_view{key_scratch_} : key_;
+    }
+
+    // Reads the key (throwing if at the end of the dict), then returns `f()`, which consumes the
+    // value.
+    template <typename F>
+    auto next(F&& f) {
+        if (!consume_key())
+            detail::throw_bt_error({bt_errc::wrong_type, cur_.offset()});
+        auto result = f();
+        have_key_ = false;
+        return result;
+    }
+
+  public:
+    explicit bt_segmented_dict_consumer(std::span<const std::string_view> segments) :
+            bt_segmented_dict_consumer{bt_segment_cursor{segments}, 'd'} {}
+
+    using bt_segmented_list_consumer::offset;
+
+    /// Returns true if the next value indicates the end of the dict
+    bool is_finished() { return !consume_key(); }
+    /// Returns true if the next value looks like an encoded string
+    bool is_string() { return consume_key() && bt_segmented_list_consumer::is_string(); }
+    /// Returns true if the next value looks like an encoded integer
+    bool is_integer() { return consume_key() && bt_segmented_list_consumer::is_integer(); }
+    /// Returns true if the next value looks like an encoded negative integer
+    bool is_negative_integer() {
+        return consume_key() && bt_segmented_list_consumer::is_negative_integer();
+    }
+    /// Returns true if the next value looks like an encoded non-negative integer
+    bool is_unsigned_integer() {
+        return consume_key() && bt_segmented_list_consumer::is_unsigned_integer();
+    }
+    /// Returns true if the next value looks like an encoded list
+    bool is_list() { return consume_key() && bt_segmented_list_consumer::is_list(); }
+    /// Returns true if the next value looks like an encoded dict
+    bool is_dict() { return consume_key() && bt_segmented_list_consumer::is_dict(); }
+
+    /// Returns the key of the next pair.
+    std::string_view key() {
+        if (!consume_key())
+            throw bt_deserialize_invalid{"Cannot access next key: at the end of the dict"};
+        return current_key();
+    }
+
+    /// The consume_* methods consume the next key and its value.
+    std::string_view consume_string_view() {
+        return next([this] { return bt_segmented_list_consumer::consume_string_view(); });
+    }
+    bt_segmented_view consume_segmented_string() {
+        return next([this] { return consume_view(); });
+    }
+    std::string consume_string() {
+        return next([this] { return consume_view().str(); });
+    }
+    template <std::integral IntType>
+    IntType consume_integer() {
+        return next([this] { return consume_int<IntType>(); });
+    }
+    bt_segmented_list_consumer consume_list_consumer() {
+        return next([this] { return consume_sub<bt_segmented_list_consumer>(); });
+    }
+    bt_segmented_dict_consumer consume_dict_consumer() {
+        return next([this] { return consume_sub<bt_segmented_dict_consumer>(); });
+    }
+
+    /// Consumes the next value as the given type; see bt_segmented_list_consumer::consume().
+    template <typename T>
+    T consume();
+
+    /// Consumes the next key-value pair without parsing the value.
+    void skip_value() {
+        next([this] {
+            skip();
+            return 0;
+        });
+    }
+
+    /// Skips ahead until we find the first key >= the given key or reach the end of the dict.
+    /// Returns true if we found an exact match, false if we reached some greater value or the
+    /// end; as with bt_dict_consumer, this assumes the keys are sorted.
+    bool skip_until(std::string_view find) {
+        while (consume_key() && current_key() < find)
+            skip_value();
+        return have_key_ && current_key() == find;
+    }
+
+    /// Advances to the given key, throwing std::out_of_range if it does not exist.
+    void required(std::string_view find) {
+        if (!skip_until(find))
+            throw std::out_of_range{"Key " + std::string{find} + " not found!"};
+    }
+
+    /// Advances to and requires the given key, then consumes its value as a `T`.
+    template <typename T>
+    T require(std::string_view key) {
+        required(key);
+        return consume<T>();
+    }
+
+    /// Advances to the given key, returning std::nullopt if it does not exist and otherwise its
+    /// value as a `T`.
+    template <typename T>
+    std::optional<T> maybe(std::string_view key) {
+        if (!skip_until(key))
+            return std::nullopt;
+        return consume<T>();
+    }
+
+    /// Reads through any remaining keys and values to the end of the dict, and confirms that the
+    /// end of the dict is the end of the input.
+    void finish() {
+        while (consume_key())
+            skip_value();
+        bt_segmented_list_consumer::finish();
+    }
+};
+
+inline bt_segmented_dict_consumer bt_segmented_list_consumer::consume_dict_consumer() {
+    return consume_sub<bt_segmented_dict_consumer>();
+}
+
+template <typename T>
+T bt_segmented_list_consumer::consume() {
+    if constexpr (std::integral<T>)
+        return consume_integer<T>();
+    else if constexpr (std::same_as<T, std::string>)
+        return consume_string();
+    else if constexpr (std::same_as<T, std::string_view>)
+        return consume_string_view();
+    else if constexpr (std::same_as<T, bt_segmented_view>)
+        return consume_segmented_string();
+    else if constexpr (std::same_as<T, bt_segmented_list_consumer>)
+        return consume_list_consumer();
+    else {
+        static_assert(std::same_as<T, bt_segmented_dict_consumer>, "Unsupported consume type");
+        return consume_dict_consumer();
+    }
+}
+
+template <typename T>
+T bt_segmented_dict_consumer::consume() {
+    if constexpr (std::integral<T>)
+        return consume_integer<T>();
+    else if constexpr (std::same_as<T, std::string>)
+        return consume_string();
+    else if constexpr (std::same_as<T, std::string_view>)
+        return consume_string_view();
+    else if constexpr (std::same_as<T, bt_segmented_view>)
+        return consume_segmented_string();
+    else if constexpr (std::same_as<T, bt_segmented_list_consumer>)
+        return consume_list_consumer();
+    else {
+        static_assert(std::same_as<T, bt_segmented_dict_consumer>, "Unsupported consume type");
+        return consume_dict_consumer();
+    }
+}
+
+}  // namespace oxenc
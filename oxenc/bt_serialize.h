@@ -1,10 +1,13 @@
 #pragma once
 
 #include <algorithm>
+#include <array>
+#include <bit>
 #include <concepts>
 #include <cstdint>
 #include <cstring>
 #include <functional>
+#include <iterator>
 #include <limits>
 #include <optional>
 #include <ostream>
@@ -14,14 +17,21 @@
 #include <string_view>
 #include <tuple>
 #include <type_traits>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
 #include "bt_common.h"
 #include "bt_value.h"
+#include "endian.h"
 #include "span.h"
 #include "variant.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define OXENC_BT_SSE2
+#endif
+
 namespace oxenc {
 
 /** \file
@@ -59,16 +69,158 @@ class bt_deserialize_invalid_type : public bt_deserialize_invalid {
     using bt_deserialize_invalid::bt_deserialize_invalid;
 };
 
+/// Error codes reported by the non-throwing `try_` deserialization functions and consumer methods.
+enum class [[nodiscard]] bt_errc : uint8_t {
+    ok = 0,
+    unexpected_end,    ///< input ended before the value was complete
+    wrong_type,        ///< the next value is not of the requested type
+    invalid_value,     ///< malformed encoding, e.g. an unexpected character or missing delimiter
+    integer_overflow,  ///< encoded integer does not fit in a 64-bit integer
+    integer_range,     ///< encoded integer does not fit in the requested integer type
+    string_length,     ///< encoded string length is longer than the remaining data
+    tuple_size,        ///< encoded list has too many elements for the requested tuple
+    no_variant_match,  ///< value could not be deserialized into any of the variant's types
+    trailing_data,     ///< value was parsed but did not consume the entire input
+    key_not_found,     ///< a required dict key does not exist
+    depth_limit,       ///< lists/dicts are nested more deeply than the configured limit
+    element_limit,     ///< input contains more values than the configured limit
+    string_limit,      ///< a string is longer than the configured limit
+    not_canonical,     ///< valid, but not canonically encoded (e.g. unsorted keys, leading zeros)
+};
+
+/// Returns a static description of the given error code.
+constexpr const char* bt_errc_message(bt_errc ec) {
+    switch (ec) {
+        case bt_errc::ok: return "success";
+        case bt_errc::unexpected_end: return "unexpected end of data";
+        case bt_errc::wrong_type: return "encoded value has the wrong type";
+        case bt_errc::invalid_value: return "invalid encoded value";
+        case bt_errc::integer_overflow: return "integer value is too large for a 64-bit int";
+        case bt_errc::integer_range: return "integer value is out of range for the requested type";
+        case bt_errc::string_length: return "encoded string length is longer than the data";
+        case bt_errc::tuple_size: return "encoded list has the wrong size for the tuple";
+        case bt_errc::no_variant_match: return "value could not be stored in any variant type";
+        case bt_errc::trailing_data: return "did not consume the entire encoded string";
+        case bt_errc::key_not_found: return "required key not found";
+        case bt_errc::depth_limit: return "maximum nesting depth exceeded";
+        case bt_errc::element_limit: return "maximum number of elements exceeded";
+        case bt_errc::string_limit: return "maximum string length exceeded";
+        case bt_errc::not_canonical: return "value is not canonically encoded";
+    }
+    return "unknown error";
+}
+
+/// Error value returned by the non-throwing `try_` deserialization interfaces.  This holds an error
+/// code and the byte offset into the input at which the error was detected.  Like
+/// `std::error_code`, this evaluates to true in a boolean context when it holds an error:
+///
+///     int x;
+///     if (auto err = try_bt_deserialize("i123x", x))
+///         log("failed: ", err.message(), " at byte ", err.offset);
+///
+/// Reporting an error never allocates.
+struct [[nodiscard]] bt_error {
+    bt_errc code = bt_errc::ok;
+    size_t offset = 0;
+
+    constexpr explicit operator bool() const { return code != bt_errc::ok; }
+    constexpr const char* message() const { return bt_errc_message(code); }
+    constexpr bool operator==(const bt_error&) const = default;
+};
+
+/// Default maximum list/dict nesting depth when decoding a bt_value (see bt_get).  Decoding is
+/// iterative, so this is not about stack usage, but it bounds how much work (and allocation) a
+/// hostile `llll...` input can cause.  Deeper input fails with bt_errc::depth_limit.
+inline constexpr size_t bt_default_max_depth = 512;
+
+/// Largest supported nesting depth for skipping over values, which is also the depth the consumer
+/// classes skip (and extract `*_data`) through: skipping keeps a fixed bit per level on the stack
+/// rather than allocating, so this deep is cheap.  Deeper values fail with bt_errc::depth_limit.
+inline constexpr size_t bt_max_skip_depth = 4096;
+
+/// Deduplicated, immutable storage for strings, used to intern dict keys when decoding (see
+/// try_bt_deserialize_interned()).  Each distinct string is stored once, at an address that stays
+/// the same for as long as the table exists (or until clear() is called), so decoded values can
+/// hold std::string_views of it that outlive the encoded data.  The table only ever grows: it is
+/// meant for a bounded set of strings, such as the keys of a fixed message schema, rather than for
+/// arbitrary data.  Not thread-safe.
+class bt_intern_table {
+    struct hash {
+        using is_transparent = void;
+        size_t operator()(std::string_view s) const { return std::hash<std::string_view>{}(s); }
+    };
+    std::unordered_set<std::string, hash, std::equal_to<>> strings_;
+
+  public:
+    /// Returns a view of the table's copy of `s`, adding it to the table if not already present.
+    std::string_view intern(std::string_view s) {
+        auto it = strings_.find(s);
+        if (it == strings_.end())
+            it = strings_.emplace(s).first;
+        return *it;
+    }
+
+    /// Returns the number of distinct strings in the table.
+    size_t size() const { return strings_.size(); }
+
+    /// Removes all strings from the table, invalidating all views of them.
+    void clear() { strings_.clear(); }
+};
+
 namespace detail {
+    // Options of the decoding in progress on this thread, set by try_bt_deserialize_borrowed(),
+    // try_bt_deserialize_interned() and try_bt_deserialize_reusing().  These are thread-local so
+    // that they reach the decoders of nested values without having to be passed through all of
+    // them.
+    struct bt_decode_context {
+        bt_intern_table* keys = nullptr;  // Table to intern std::string_view dict keys into
+        bool reuse = false;               // Decode into existing container elements
+        bool borrow = false;              // Match view variant alternatives
+    };
+    inline thread_local constinit bt_decode_context bt_decode_ctx{};
+
+    // Restores the thread's decoding context, as it was when constructed, on destruction.
+    class bt_decode_scope {
+        bt_decode_context saved_ = bt_decode_ctx;
+
+      public:
+        bt_decode_scope() = default;
+        bt_decode_scope(const bt_decode_scope&) = delete;
+        bt_decode_scope& operator=(const bt_decode_scope&) = delete;
+        ~bt_decode_scope() { bt_decode_ctx = saved_; }
+    };
+
     template <typename T>
     concept consumer_input = const_span_type<T> || char_view_type<T>;
 
-    /// Reads digits into an unsigned 64-bit int.
-    uint64_t extract_unsigned(std::string_view& s);
+    /// Throws the exception corresponding to the given error: bt_deserialize_invalid_type for type
+    /// mismatches, std::out_of_range for missing required keys, and bt_deserialize_invalid for
+    /// everything else.
+    [[noreturn]] inline void throw_bt_error(const bt_error& err) {
+        auto msg = "Deserialization failed: "s + err.message() + " at byte " +
+                   std::to_string(err.offset);
+        if (err.code == bt_errc::wrong_type)
+            throw bt_deserialize_invalid_type{msg};
+        if (err.code == bt_errc::key_not_found)
+            throw std::out_of_range{msg};
+        throw bt_deserialize_invalid{msg};
+    }
+
+    /// Throws bt_deserialize_invalid for values nested more than bt_default_max_depth deep, for
+    /// code (such as bt_merge) that walks nested dicts through consumers and so has no byte offset
+    /// into the original input to report.
+    [[noreturn]] inline void throw_bt_depth_limit() {
+        throw bt_deserialize_invalid{
+                "Deserialization failed: "s + bt_errc_message(bt_errc::depth_limit)};
+    }
+
+    /// Reads digits into an unsigned 64-bit int.  On failure returns an error code and leaves `s`
+    /// pointing at the offending character.
+    bt_errc extract_unsigned(std::string_view& s, uint64_t& val);
     // (Provide non-constant lvalue and rvalue ref functions so that we only accept explicit
     // string_views but not implicitly converted ones)
-    inline uint64_t extract_unsigned(std::string_view&& s) {
-        return extract_unsigned(s);
+    inline bt_errc extract_unsigned(std::string_view&& s, uint64_t& val) {
+        return extract_unsigned(s, val);
     }
 
     // Fallback base case; we only get here if none of the partial specializations below work
@@ -84,22 +236,74 @@ namespace detail {
                 std::is_void_v<T>, "Cannot deserialize T: unsupported type for bt deserialization");
     };
 
-    /// Checks that we aren't at the end of a string view and throws if we are.
-    inline void bt_need_more(const std::string_view& s) {
-        if (s.empty())
-            throw bt_deserialize_invalid{"Unexpected end of string while deserializing"};
-    }
-
     using some64 = union {
         int64_t i64;
         uint64_t u64;
     };
 
+    // Returns the number of decimal digits in `v`.
+    constexpr size_t bt_digits(uint64_t v) {
+        size_t n = 1;
+        for (; v >= 10; v /= 10)
+            n++;
+        return n;
+    }
+
     /// Deserializes a signed or unsigned 64-bit integer from a string.  Sets the second bool to
     /// true iff the value read was negative, false if positive; in either case the unsigned value
-    /// is return in .first.  Throws an exception if the read value doesn't fit in a int64_t (if
-    /// negative) or a uint64_t (if positive).  Removes consumed characters from the string_view.
-    std::pair<some64, bool> bt_deserialize_integer(std::string_view& s);
+    /// is return in .first.  Returns an error code if the input isn't an encoded integer or if the
+    /// read value doesn't fit in a int64_t (if negative) or a uint64_t (if positive).  Removes
+    /// consumed characters from the string_view; on failure the string_view is left pointing at the
+    /// location of the error.
+    bt_errc bt_deserialize_integer(std::string_view& s, std::pair<some64, bool>& result);
+
+    /// Throwing version of the above.
+    inline std::pair<some64, bool> bt_deserialize_integer(std::string_view& s) {
+        const char* orig = s.data();
+        std::pair<some64, bool> result;
+        if (auto ec = bt_deserialize_integer(s, result); ec != bt_errc::ok)
+            throw_bt_error({ec, static_cast<size_t>(s.data() - orig)});
+        return result;
+    }
+
+    /// Skips over a single encoded value of any type (descending into lists and dicts) without
+    /// allocating.  This is iterative rather than recursive: list/dict nesting is tracked in a
+    /// fixed-size bit stack, and values nested more than `max_depth` levels deep (which is capped
+    /// at bt_max_skip_depth) fail with bt_errc::depth_limit.  On failure `s` is left pointing at
+    /// the location of the error.
+    bt_errc bt_skip_value(std::string_view& s, size_t max_depth = bt_default_max_depth);
+
+    /// Counts the elements of an encoded list, or the pairs of an encoded dict, for pre-sizing the
+    /// container it is decoded into.  `s` starts just after the `l` or `d`.  This is a shallow
+    /// pass that jumps over strings using their length prefixes and over integers by finding their
+    /// `e`, without validating them; nested lists and dicts are skipped with bt_skip_value().
+    /// Returns 0 if the end of the list can't be found, leaving the decoder to report the error.
+    size_t bt_count_elements(std::string_view s, bool dict);
+
+    // Element types that are cheap for bt_count_elements() to pass over, so that it's worth
+    // counting a list or dict of them to pre-size the container.  (Counting a list of lists, say,
+    // would mean a second full pass over the nested lists, while reallocation just moves them).
+    template <typename T>
+    concept bt_leaf_type = std::integral<T> || string_like<T> || const_span_type<T>;
+
+    template <typename T>
+    inline constexpr bool bt_int_vector = false;
+#ifdef OXENC_BT_SSE2
+    /// Fast path for deserializing a list of integers into a std::vector of an integral type (see
+    /// the definition for details).  Returns false, leaving `s` unchanged, if the input is not a
+    /// valid list of integers in the range of `T`; the caller then uses the general list decoder,
+    /// which reports exactly where the problem is.
+    template <std::integral T, typename Alloc>
+    bool bt_deserialize_int_list(std::string_view& s, std::vector<T, Alloc>& out);
+
+    template <std::integral T, typename Alloc>
+    requires(!std::same_as<T, bool>)
+    inline constexpr bool bt_int_vector<std::vector<T, Alloc>> = true;
+#endif
+
+    // The `bt_deserialize<T>` specializations below return `bt_errc::ok` on success, and otherwise
+    // return an error code with `s` pointing at the location of the error.  The throwing
+    // deserialization API is implemented on top of these.
 
     /// Integer specializations
     template <typename T>
@@ -122,38 +326,27 @@ namespace detail {
     template <typename T>
     requires std::integral<T>
     struct bt_deserialize<T> {
-        void operator()(std::string_view& s, T& val) {
+        bt_errc operator()(std::string_view& s, T& val) {
             constexpr uint64_t umax = static_cast<uint64_t>(std::numeric_limits<T>::max());
             constexpr int64_t smin = static_cast<int64_t>(std::numeric_limits<T>::min());
 
-            auto [v, neg] = bt_deserialize_integer(s);
+            auto orig = s;
+            std::pair<some64, bool> result;
+            if (auto ec = bt_deserialize_integer(s, result); ec != bt_errc::ok)
+                return ec;
+            auto [v, neg] = result;
 
-            if (std::signed_integral<T>) {
-                if (!neg) {
-                    if (v.u64 > umax)
-                        throw bt_deserialize_invalid(
-                                "Integer deserialization failed: found too-large value " +
-                                std::to_string(v.u64) + " > " + std::to_string(umax));
-                    val = static_cast<T>(v.u64);
-                } else {
-                    auto& sval = v.i64;
-                    if (!std::same_as<T, int64_t> && sval < smin)
-                        throw bt_deserialize_invalid(
-                                "Integer deserialization failed: found too-low value " +
-                                std::to_string(sval) + " < " + std::to_string(smin));
-                    val = static_cast<T>(sval);
-                }
-            } else {
-                if (neg)
-                    throw bt_deserialize_invalid(
-                            "Integer deserialization failed: found negative value -" +
-                            std::to_string(v.i64) + " but type is unsigned");
-                if (!std::same_as<T, uint64_t> && v.u64 > umax)
-                    throw bt_deserialize_invalid(
-                            "Integer deserialization failed: found too-large value " +
-                            std::to_string(v.u64) + " > " + std::to_string(umax));
-                val = static_cast<T>(v.u64);
+            bool in_range;
+            if (std::signed_integral<T>)
+                in_range = neg ? std::same_as<T, int64_t> || v.i64 >= smin : v.u64 <= umax;
+            else
+                in_range = !neg && (std::same_as<T, uint64_t> || v.u64 <= umax);
+            if (!in_range) {
+                s = orig;
+                return bt_errc::integer_range;
             }
+            val = neg ? static_cast<T>(v.i64) : static_cast<T>(v.u64);
+            return bt_errc::ok;
         }
     };
 
@@ -170,7 +363,7 @@ namespace detail {
     };
     template <>
     struct bt_deserialize<std::string_view> {
-        void operator()(std::string_view& s, std::string_view& val);
+        bt_errc operator()(std::string_view& s, std::string_view& val);
     };
 
     /// String specialization
@@ -182,20 +375,24 @@ namespace detail {
     };
     template <>
     struct bt_deserialize<std::string> {
-        void operator()(std::string_view& s, std::string& val) {
+        bt_errc operator()(std::string_view& s, std::string& val) {
             std::string_view view;
-            bt_deserialize<std::string_view>{}(s, view);
-            val = {view.data(), view.size()};
+            auto ec = bt_deserialize<std::string_view>{}(s, view);
+            if (ec == bt_errc::ok)
+                val.assign(view);  // (Rather than replacing `val`, which would lose its capacity)
+            return ec;
         }
     };
 
     /// const_span specialization
     template <oxenc::const_span_type T>
     struct bt_deserialize<T> {
-        void operator()(std::string_view& s, T& val) {
+        bt_errc operator()(std::string_view& s, T& val) {
             std::string_view view;
-            bt_deserialize<std::string_view>{}(s, view);
-            val = {reinterpret_cast<const typename T::value_type*>(view.data()), view.size()};
+            auto ec = bt_deserialize<std::string_view>{}(s, view);
+            if (ec == bt_errc::ok)
+                val = {reinterpret_cast<const typename T::value_type*>(view.data()), view.size()};
+            return ec;
         }
     };
 
@@ -220,12 +417,14 @@ namespace detail {
     concept bt_insertable =
             requires(T v) { v.insert(v.end(), std::declval<typename T::value_type>()); };
 
-    /// Determines whether the given type looks like a compatible map (i.e. has std::string keys)
-    /// that we can insert into.
+    /// Determines whether the given type looks like a compatible map (i.e. has std::string keys,
+    /// or std::string_view keys for borrowing deserialization) that we can insert into.
     template <typename T>
     concept bt_output_dict_container =
-            std::same_as<std::string, std::remove_cv_t<typename T::value_type::first_type>> &&
-            requires {
+            (std::same_as<std::string, std::remove_cv_t<typename T::value_type::first_type>> ||
+             std::same_as<
+                     std::string_view,
+                     std::remove_cv_t<typename T::value_type::first_type>>)&&requires {
                 typename T::value_type::second_type;  // has a second type
             };
 
@@ -259,32 +458,91 @@ namespace detail {
 
     template <bt_output_dict_container T>
     struct bt_deserialize<T> {
+        using key_type = std::remove_cv_t<typename T::value_type::first_type>;
         using second_type = typename T::value_type::second_type;
-        void operator()(std::string_view& s, T& dict) {
-            // Smallest dict is 2 bytes "de", for an empty dict.
-            if (s.size() < 2)
-                throw bt_deserialize_invalid(
-                        "Deserialization failed: end of string found where dict expected");
+        bt_errc operator()(std::string_view& s, T& dict) {
+            if (s.empty())
+                return bt_errc::unexpected_end;
             if (s[0] != 'd')
-                throw bt_deserialize_invalid_type(
-                        "Deserialization failed: expected 'd', found '"s + s[0] + "'"s);
+                return bt_errc::wrong_type;
             s.remove_prefix(1);
+            if constexpr (requires { dict.extract(dict.begin()).mapped(); })
+                if (bt_decode_ctx.reuse)
+                    return deserialize_reusing(s, dict);
             dict.clear();
-            bt_deserialize<std::string> key_deserializer;
-            bt_deserialize<second_type> val_deserializer;
+            if constexpr (
+                    requires { dict.reserve(size_t{}); } && bt_leaf_type<second_type>)
+                dict.reserve(bt_count_elements(s, true));
+            while (!s.empty() && s[0] != 'e')
+                if (auto ec = deserialize_new(s, dict); ec != bt_errc::ok)
+                    return ec;
+            if (s.empty())
+                return bt_errc::unexpected_end;
+            s.remove_prefix(1);  // Consume the 'e'
+            return bt_errc::ok;
+        }
 
+      private:
+        static bt_errc deserialize_key(std::string_view& s, key_type& key) {
+            if (auto ec = bt_deserialize<key_type>{}(s, key); ec != bt_errc::ok)
+                return ec;
+            if constexpr (std::same_as<key_type, std::string_view>)
+                if (bt_decode_ctx.keys)
+                    key = bt_decode_ctx.keys->intern(key);
+            return bt_errc::ok;
+        }
+
+        // Decodes the next pair into a new element at the end of `dict`.
+        static bt_errc deserialize_new(std::string_view& s, T& dict) {
+            key_type key;
+            second_type val;
+            if (auto ec = deserialize_key(s, key); ec != bt_errc::ok)
+                return ec;
+            if (auto ec = bt_deserialize<second_type>{}(s, val); ec != bt_errc::ok)
+                return ec;
+            dict.insert(dict.end(), typename T::value_type{std::move(key), std::move(val)});
+            return bt_errc::ok;
+        }
+
+        // Reusing decoding (see try_bt_deserialize_reusing()): detaches the existing nodes, then
+        // decodes each pair into one of them (keeping the storage of its key and value) and
+        // reinserts it; only pairs beyond the existing ones need new nodes.
+        static bt_errc deserialize_reusing(std::string_view& s, T& dict) {
+            if constexpr (requires { dict.bucket_count(); }) {
+                // Hash tables: the nodes are moved into a per-thread spare table of this type,
+                // rather than swapping `dict` with an empty one, so that `dict` keeps its bucket
+                // array (and the spare table keeps its own from one decoding to the next).
+                thread_local T spare;
+                spare.merge(dict);
+                auto ec = deserialize_into(s, dict, spare);
+                spare.clear();  // (Frees any nodes not reused, but not the buckets)
+                return ec;
+            } else {
+                T old;
+                old.swap(dict);
+                return deserialize_into(s, dict, old);
+            }
+        }
+
+        // Decodes the pairs of a dict into `dict`, which is empty, reusing nodes from `old`.
+        static bt_errc deserialize_into(std::string_view& s, T& dict, T& old) {
             while (!s.empty() && s[0] != 'e') {
-                std::string key;
-                second_type val;
-                key_deserializer(s, key);
-                val_deserializer(s, val);
-                dict.insert(dict.end(), typename T::value_type{std::move(key), std::move(val)});
+                if (old.empty()) {
+                    if (auto ec = deserialize_new(s, dict); ec != bt_errc::ok)
+                        return ec;
+                    continue;
+                }
+                auto node = old.extract(old.begin());
+                if (auto ec = deserialize_key(s, node.key()); ec != bt_errc::ok)
+                    return ec;
+                if (auto ec = bt_deserialize<second_type>{}(s, node.mapped()); ec != bt_errc::ok)
+                    return ec;
+                dict.insert(dict.end(), std::move(node));
             }
             if (s.empty())
-                throw bt_deserialize_invalid(
-                        "Deserialization failed: encountered end of string before dict was "
-                        "finished");
+                return bt_errc::unexpected_end;
             s.remove_prefix(1);  // Consume the 'e'
+            return bt_errc::ok;
         }
     };
 
@@ -292,6 +550,14 @@ namespace detail {
     concept bt_output_list_container =
             !std::same_as<T, std::string> && !bt_output_dict_container<T> && bt_insertable<T>;
 
+    // A list container whose elements can be decoded into in place: that is, not a set (whose
+    // elements are const) or std::vector<bool> (whose elements are proxies).
+    template <typename T>
+    concept bt_reusable_sequence = requires(T& t, typename T::iterator it) {
+        { *it } -> std::same_as<typename T::value_type&>;
+        t.erase(it, t.end());
+    };
+
     // Sanity checks:
     static_assert(bt_input_list_container<bt_list>);
     static_assert(bt_output_list_container<bt_list>);
@@ -309,27 +575,58 @@ namespace detail {
     template <bt_output_list_container T>
     struct bt_deserialize<T> {
         using value_type = typename T::value_type;
-        void operator()(std::string_view& s, T& list) {
-            // Smallest list is 2 bytes "le", for an empty list.
-            if (s.size() < 2)
-                throw bt_deserialize_invalid(
-                        "Deserialization failed: end of string found where list expected");
+        bt_errc operator()(std::string_view& s, T& list) {
+            if constexpr (bt_int_vector<T>)
+                if (bt_deserialize_int_list(s, list))
+                    return bt_errc::ok;
+            if (s.empty())
+                return bt_errc::unexpected_end;
             if (s[0] != 'l')
-                throw bt_deserialize_invalid_type(
-                        "Deserialization failed: expected 'l', found '"s + s[0] + "'"s);
+                return bt_errc::wrong_type;
             s.remove_prefix(1);
+            if constexpr (bt_reusable_sequence<T>)
+                if (bt_decode_ctx.reuse)
+                    return deserialize_reusing(s, list);
             list.clear();
+            if constexpr (requires { list.reserve(size_t{}); } && bt_leaf_type<value_type>)
+                list.reserve(bt_count_elements(s, false));
             bt_deserialize<value_type> deserializer;
             while (!s.empty() && s[0] != 'e') {
                 value_type v;
-                deserializer(s, v);
+                if (auto ec = deserializer(s, v); ec != bt_errc::ok)
+                    return ec;
                 list.insert(list.end(), std::move(v));
             }
             if (s.empty())
-                throw bt_deserialize_invalid(
-                        "Deserialization failed: encountered end of string before list was "
-                        "finished");
+                return bt_errc::unexpected_end;
             s.remove_prefix(1);  // Consume the 'e'
+            return bt_errc::ok;
+        }
+
+      private:
+        // Reusing decoding (see try_bt_deserialize_reusing()): decodes into the existing elements
+        // (keeping their storage), then appends any further elements, or erases any left over.
+        static bt_errc deserialize_reusing(std::string_view& s, T& list) {
+            bt_deserialize<value_type> deserializer;
+            auto it = list.begin();
+            while (!s.empty() && s[0] != 'e') {
+                if (it != list.end()) {
+                    if (auto ec = deserializer(s, *it); ec != bt_errc::ok)
+                        return ec;
+                    ++it;
+                    continue;
+                }
+                value_type v;
+                if (auto ec = deserializer(s, v); ec != bt_errc::ok)
+                    return ec;
+                list.insert(list.end(), std::move(v));
+                it = list.end();
+            }
+            if (s.empty())
+                return bt_errc::unexpected_end;
+            list.erase(it, list.end());
+            s.remove_prefix(1);  // Consume the 'e'
+            return bt_errc::ok;
         }
     };
 
@@ -355,76 +652,85 @@ namespace detail {
     struct bt_deserialize<Tuple> {
       private:
         template <size_t... Is>
-        void operator()(std::string_view& s, Tuple& elems, std::index_sequence<Is...>) {
-            // Smallest list is 2 bytes "le", for an empty list.
-            if (s.size() < 2)
-                throw bt_deserialize_invalid(
-                        "Deserialization failed: end of string found where tuple expected");
+        bt_errc operator()(std::string_view& s, Tuple& elems, std::index_sequence<Is...>) {
+            if (s.empty())
+                return bt_errc::unexpected_end;
             if (s[0] != 'l')
-                throw bt_deserialize_invalid_type(
-                        "Deserialization of tuple failed: expected 'l', found '"s + s[0] + "'"s);
+                return bt_errc::wrong_type;
             s.remove_prefix(1);
-            (bt_deserialize<std::tuple_element_t<Is, Tuple>>{}(s, std::get<Is>(elems)), ...);
+            auto ec = bt_errc::ok;
+            // Stops at the first element that fails:
+            (void)(((ec = bt_deserialize<std::tuple_element_t<Is, Tuple>>{}(
+                             s, std::get<Is>(elems))) == bt_errc::ok) &&
+                   ...);
+            if (ec != bt_errc::ok)
+                return ec;
             if (s.empty())
-                throw bt_deserialize_invalid(
-                        "Deserialization failed: encountered end of string before tuple was "
-                        "finished");
+                return bt_errc::unexpected_end;
             if (s[0] != 'e')
-                throw bt_deserialize_invalid(
-                        "Deserialization failed: expected end of tuple but found something else");
+                return bt_errc::tuple_size;
             s.remove_prefix(1);  // Consume the 'e'
+            return bt_errc::ok;
         }
 
       public:
-        void operator()(std::string_view& s, Tuple& elems) {
-            operator()(s, elems, std::make_index_sequence<std::tuple_size_v<Tuple>>{});
+        bt_errc operator()(std::string_view& s, Tuple& elems) {
+            return operator()(s, elems, std::make_index_sequence<std::tuple_size_v<Tuple>>{});
         }
     };
 
     template <typename T>
     concept bt_deserializable =
-            std::same_as<T, std::string> || std::integral<T> || bt_output_dict_container<T> ||
+            std::same_as<T, std::string> || std::same_as<T, std::string_view> ||
+            const_span_type<T> || std::integral<T> || bt_output_dict_container<T> ||
             bt_output_list_container<T> || tuple_like<T>;
 
+    // True for the (borrowed) string types that are deserialized as views into the input
+    template <typename T>
+    concept bt_view_type = std::same_as<T, std::string_view> || const_span_type<T>;
+
     // General template and base case; this base will only actually be invoked when Ts... is empty,
     // which means we reached the end without finding any variant type capable of holding the value.
     template <typename Variant, typename... Ts>
     struct bt_deserialize_try_variant_impl {
-        void operator()(std::string_view&, Variant&) {
-            throw bt_deserialize_invalid(
-                    "Deserialization failed: could not deserialize value into any variant type");
-        }
+        bt_errc operator()(std::string_view&, Variant&) { return bt_errc::no_variant_match; }
     };
 
     template <typename... Ts, typename Variant>
-    void bt_deserialize_try_variant(std::string_view& s, Variant& variant) {
-        bt_deserialize_try_variant_impl<Variant, Ts...>{}(s, variant);
+    bt_errc bt_deserialize_try_variant(std::string_view& s, Variant& variant) {
+        return bt_deserialize_try_variant_impl<Variant, Ts...>{}(s, variant);
     }
 
     template <typename Variant, bt_deserializable T, typename... Ts>
     struct bt_deserialize_try_variant_impl<Variant, T, Ts...> {
-        void operator()(std::string_view& s, Variant& variant) {
-            if (bt_output_list_container<T>    ? s[0] == 'l'
-                : tuple_like<T>                ? s[0] == 'l'
-                : bt_output_dict_container<T>  ? s[0] == 'd'
-                : std::integral<T>             ? s[0] == 'i'
-                : std::same_as<T, std::string> ? s[0] >= '0' && s[0] <= '9'
-                                               : false) {
+        bt_errc operator()(std::string_view& s, Variant& variant) {
+            // View alternatives are only decoded into when explicitly borrowing; otherwise they
+            // are skipped, as they always have been, so that e.g. a bt_variant gets a std::string.
+            if constexpr (bt_view_type<T>)
+                if (!bt_decode_ctx.borrow)
+                    return bt_deserialize_try_variant<Ts...>(s, variant);
+            // (Anything else deserializable is a string, string_view, or span)
+            if (bt_output_list_container<T>   ? s[0] == 'l'
+                : tuple_like<T>               ? s[0] == 'l'
+                : bt_output_dict_container<T> ? s[0] == 'd'
+                : std::integral<T>            ? s[0] == 'i'
+                                              : s[0] >= '0' && s[0] <= '9') {
                 T val;
-                bt_deserialize<T>{}(s, val);
-                variant = std::move(val);
-            } else {
-                bt_deserialize_try_variant<Ts...>(s, variant);
+                auto ec = bt_deserialize<T>{}(s, val);
+                if (ec == bt_errc::ok)
+                    variant = std::move(val);
+                return ec;
             }
+            return bt_deserialize_try_variant<Ts...>(s, variant);
         }
     };
 
     template <typename Variant, typename T, typename... Ts>
     requires(!bt_deserializable<T>)
     struct bt_deserialize_try_variant_impl<Variant, T, Ts...> {
-        void operator()(std::string_view& s, Variant& variant) {
+        bt_errc operator()(std::string_view& s, Variant& variant) {
             // Unsupported deserialization type, skip it
-            bt_deserialize_try_variant<Ts...>(s, variant);
+            return bt_deserialize_try_variant<Ts...>(s, variant);
         }
     };
 
@@ -451,17 +757,77 @@ namespace detail {
         static_assert(
                 (bt_deserializable<Ts> || ...), "at least one type must be bt-deserializable");
 
-        void operator()(std::string_view& s, std::variant<Ts...>& val) {
-            bt_deserialize_try_variant<Ts...>(s, val);
+        bt_errc operator()(std::string_view& s, std::variant<Ts...>& val) {
+            if (s.empty())
+                return bt_errc::unexpected_end;
+            return bt_deserialize_try_variant<Ts...>(s, val);
         }
     };
 
+    /// What bt_borrows() checks for.
+    enum class bt_borrow_check {
+        borrowed,       ///< views stored by the borrowing functions (bt_deserialize_borrowed etc.)
+        plain,          ///< views stored by the plain functions (which skip view alternatives)
+        borrowed_only,  ///< views only the borrowing functions accept: std::string_view dict keys
+    };
+
+    template <bt_struct_type T, bt_borrow_check Check>
+    consteval bool bt_struct_borrows();  // Defined in bt_struct.h
+
+    template <typename T, bt_borrow_check Check>
+    struct bt_borrows_helper;
+
+    /// True if deserializing into a `T` stores views into the input: that is, if `T` is, or holds
+    /// (in a list, dict, tuple, variant, optional, or bound struct), a std::string_view or
+    /// const_span.  `Check` selects which decoding functions this is about (see bt_borrow_check).
+    template <typename T, bt_borrow_check Check = bt_borrow_check::borrowed>
+    consteval bool bt_borrows() {
+        if constexpr (bt_view_type<T>)
+            return Check != bt_borrow_check::borrowed_only;
+        else if constexpr (requires { bt_borrows_helper<T, Check>::value; })
+            return bt_borrows_helper<T, Check>::value;
+        else if constexpr (bt_struct_type<T>)
+            return bt_struct_borrows<T, Check>();
+        else if constexpr (tuple_like<T>)
+            return []<size_t... I>(std::index_sequence<I...>) {
+                return (bt_borrows<std::tuple_element_t<I, T>, Check>() || ...);
+            }(std::make_index_sequence<std::tuple_size_v<T>>{});
+        else if constexpr (bt_output_dict_container<T>)
+            return bt_borrows<std::remove_cv_t<typename T::value_type::first_type>>() ||
+                   bt_borrows<typename T::value_type::second_type, Check>();
+        else if constexpr (bt_output_list_container<T>)
+            return bt_borrows<typename T::value_type, Check>();
+        else
+            return false;
+    }
+
+    template <typename... Ts, bt_borrow_check Check>
+    struct bt_borrows_helper<std::variant<Ts...>, Check> {
+        static constexpr bool value =
+                ((Check == bt_borrow_check::plain ? !bt_view_type<Ts> && bt_borrows<Ts, Check>()
+                                                  : bt_borrows<Ts, Check>()) ||
+                 ...);
+    };
+    template <typename T, bt_borrow_check Check>
+    struct bt_borrows_helper<std::optional<T>, Check> {
+        static constexpr bool value = bt_borrows<T, Check>();
+    };
+
+    // Types that the plain (non-borrowing) deserialization functions accept: those without
+    // std::string_view or const_span dict keys.
+    template <typename T>
+    concept bt_plain_decodable = !bt_borrows<T, bt_borrow_check::borrowed_only>();
+
     template <>
     struct bt_serialize<bt_value> : bt_serialize<bt_variant> {};
 
+    /// Deserializes any value into a bt_value.  This does not recurse: nested lists and dicts are
+    /// built in place using an explicit stack of open containers, and nesting deeper than
+    /// `max_depth` fails with bt_errc::depth_limit.
     template <>
     struct bt_deserialize<bt_value> {
-        void operator()(std::string_view& s, bt_value& val);
+        size_t max_depth = bt_default_max_depth;
+        bt_errc operator()(std::string_view& s, bt_value& val);
     };
 
     template <typename T>
@@ -520,6 +886,54 @@ std::string bt_serialize(const T& val) {
     return bt_serializer(val);
 }
 
+}  // namespace oxenc
+
+inline size_t std::hash<oxenc::bt_value>::operator()(const oxenc::bt_value& v) const {
+    return std::hash<std::string_view>{}(oxenc::bt_serialize(v));
+}
+
+namespace oxenc {
+
+namespace detail {
+    template <typename T>
+    bt_error try_bt_deserialize_impl(std::string_view s, T& val) {
+        const char* orig = s.data();
+        auto ec = bt_deserialize<T>{}(s, val);
+        if (ec == bt_errc::ok) {
+            if (s.empty())
+                return {};
+            ec = bt_errc::trailing_data;
+        }
+        return {ec, static_cast<size_t>(s.data() - orig)};
+    }
+}  // namespace detail
+
+/// Non-throwing version of `bt_deserialize(s, val)`: deserializes the given string view directly
+/// into `val`, returning a bt_error that is empty on success, or holds the error code and the byte
+/// offset of the failure.  This never throws a deserialization exception, and never allocates
+/// when reporting an error, which makes it suitable for rejecting untrusted input cheaply.
+///
+///     int value;
+///     if (auto err = try_bt_deserialize("i42e", value))
+///         return reject(err.code);
+///
+/// As with `bt_deserialize`, `val` may have been (partially) assigned even if an error is returned.
+///
+/// Types with std::string_view dict keys can only be decoded with the explicit borrowing functions,
+/// and std::string_view or const_span variant alternatives are only matched by them: see
+/// try_bt_deserialize_borrowed().
+template <typename T>
+requires(!std::is_const_v<T> && detail::bt_plain_decodable<T>)
+bt_error try_bt_deserialize(std::string_view s, T& val) {
+    return detail::try_bt_deserialize_impl(s, val);
+}
+
+template <typename T, const_span_type SpanT>
+requires(!std::is_const_v<T> && detail::bt_plain_decodable<T>)
+bt_error try_bt_deserialize(SpanT sp, T& val) {
+    return try_bt_deserialize(detail::span_to_sv(sp), val);
+}
+
 /// Deserializes the given string view directly into `val`.  Usage:
 ///
 ///     std::string encoded = "i42e";
@@ -530,13 +944,10 @@ std::string bt_serialize(const T& val) {
 /// successfully but the parsed string still has remaining content.
 ///
 template <typename T>
-requires(!std::is_const_v<T>)
+requires(!std::is_const_v<T> && detail::bt_plain_decodable<T>)
 void bt_deserialize(std::string_view s, T& val) {
-    detail::bt_deserialize<T>{}(s, val);
-    if (!s.empty())
-        throw bt_deserialize_invalid{
-                "Deserialization failed: did not consume the entire encoded string" +
-                std::to_string(s.size())};
+    if (auto err = try_bt_deserialize(s, val))
+        detail::throw_bt_error(err);
 }
 
 /// Deserializes the given string_view into a `T`, which is returned.
@@ -545,6 +956,7 @@ void bt_deserialize(std::string_view s, T& val) {
 ///     auto mylist = bt_deserialize<std::list<int>>(encoded);
 ///
 template <typename T>
+requires(detail::bt_plain_decodable<T>)
 T bt_deserialize(std::string_view s) {
     T val;
     bt_deserialize(s, val);
@@ -552,12 +964,208 @@ T bt_deserialize(std::string_view s) {
 }
 
 template <typename ReturnT, const_span_type SpanT>
+requires(detail::bt_plain_decodable<ReturnT>)
 ReturnT bt_deserialize(SpanT sp) {
     ReturnT val;
     bt_deserialize(detail::span_to_sv(sp), val);
     return val;
 }
 
+// Deserializing into something holding views of a temporary string would leave them dangling; use
+// an lvalue (and keep it alive), or deserialize into owning types such as std::string instead.
+// (`S` only deduces to std::string for an rvalue std::string).
+template <typename T, std::same_as<std::string> S>
+requires(detail::bt_borrows<T, detail::bt_borrow_check::plain>())
+bt_error try_bt_deserialize(S&& s, T& val) = delete;
+template <typename T, std::same_as<std::string> S>
+requires(detail::bt_borrows<T, detail::bt_borrow_check::plain>())
+void bt_deserialize(S&& s, T& val) = delete;
+template <typename T, std::same_as<std::string> S>
+requires(detail::bt_borrows<T, detail::bt_borrow_check::plain>())
+T bt_deserialize(S&& s) = delete;
+
+/// Borrowing deserialization: deserializes the given data into `val` as `try_bt_deserialize(s,
+/// val)` does, but explicitly for types that borrow from the input.  std::string_view and
+/// const_span values anywhere in `val` (list elements, dict keys and values, tuple elements,
+/// variant alternatives, and bound struct fields) are set to point directly into `s` rather than
+/// being copied, so that, for example, decoding a `std::map<std::string_view, std::string_view>`
+/// allocates nothing but the map nodes.
+///
+/// The plain functions also decode views as list elements, tuple elements, dict values, and bound
+/// struct fields, but only these borrowing functions (and the interning ones, below) decode:
+///
+/// - std::string_view dict keys: a type with these is rejected at compile time by the plain
+///   functions.
+/// - std::string_view and const_span variant alternatives: the plain functions skip these when
+///   choosing the alternative to decode into (so that, for instance, a bt_variant gets a
+///   std::string), while the borrowing functions consider them like any other alternative.
+///
+/// The caller must keep the data referenced by `s` alive and unmodified for as long as `val` is
+/// used.  To make this hard to get wrong, the borrowing functions (and the plain deserialization
+/// functions when given a borrowing type) do not accept a temporary std::string.
+template <typename T>
+requires(!std::is_const_v<T>)
+bt_error try_bt_deserialize_borrowed(std::string_view s, T& val) {
+    detail::bt_decode_scope scope;
+    detail::bt_decode_ctx.borrow = true;
+    return detail::try_bt_deserialize_impl(s, val);
+}
+
+template <typename T, const_span_type SpanT>
+requires(!std::is_const_v<T>)
+bt_error try_bt_deserialize_borrowed(SpanT sp, T& val) {
+    return try_bt_deserialize_borrowed(detail::span_to_sv(sp), val);
+}
+
+/// Throwing version of try_bt_deserialize_borrowed().
+template <typename T>
+requires(!std::is_const_v<T>)
+void bt_deserialize_borrowed(std::string_view s, T& val) {
+    if (auto err = try_bt_deserialize_borrowed(s, val))
+        detail::throw_bt_error(err);
+}
+
+/// Borrowing deserialization of the given data into a `T`, which is returned; see
+/// try_bt_deserialize_borrowed().
+///
+///     std::string_view msg = receive();
+///     auto names = bt_deserialize_borrowed<std::vector<std::string_view>>(msg);
+///     // `names` points into the received data
+template <typename T>
+T bt_deserialize_borrowed(std::string_view s) {
+    T val;
+    bt_deserialize_borrowed(s, val);
+    return val;
+}
+
+template <typename T, const_span_type SpanT>
+T bt_deserialize_borrowed(SpanT sp) {
+    return bt_deserialize_borrowed<T>(detail::span_to_sv(sp));
+}
+
+template <typename T, std::same_as<std::string> S>
+bt_error try_bt_deserialize_borrowed(S&& s, T& val) = delete;
+template <typename T, std::same_as<std::string> S>
+void bt_deserialize_borrowed(S&& s, T& val) = delete;
+template <typename T, std::same_as<std::string> S>
+T bt_deserialize_borrowed(S&& s) = delete;
+
+/// Deserializes the given data into `val` as try_bt_deserialize_borrowed() does, except that
+/// std::string_view dict keys (such as those of a `std::map<std::string_view, T>`, at any depth)
+/// point into the intern table `keys` rather than into `s`.  When decoding many messages with the
+/// same keys, each distinct key is then stored just once, however many decoded values use it, and
+/// the decoded values do not depend on the encoded data staying alive (unless they also hold other
+/// std::string_view or const_span values, which still point into `s`).  `keys` must outlive the
+/// decoded values.
+///
+///     bt_intern_table keys;  // Kept alongside the cache
+///     for (std::string_view msg : messages)
+///         cache.push_back(bt_deserialize_interned<std::map<std::string_view, int>>(msg, keys));
+///
+/// This applies to containers keyed by std::string_view: the std::string keys of other containers
+/// (including bt_dict) own their storage, which for short keys is typically inline in the string
+/// object itself, without any allocation.
+template <typename T>
+requires(!std::is_const_v<T>)
+bt_error try_bt_deserialize_interned(std::string_view s, T& val, bt_intern_table& keys) {
+    detail::bt_decode_scope scope;
+    detail::bt_decode_ctx.keys = &keys;
+    detail::bt_decode_ctx.borrow = true;
+    return detail::try_bt_deserialize_impl(s, val);
+}
+
+template <typename T, const_span_type SpanT>
+requires(!std::is_const_v<T>)
+bt_error try_bt_deserialize_interned(SpanT sp, T& val, bt_intern_table& keys) {
+    return try_bt_deserialize_interned(detail::span_to_sv(sp), val, keys);
+}
+
+/// Throwing version of try_bt_deserialize_interned().
+template <typename T>
+requires(!std::is_const_v<T>)
+void bt_deserialize_interned(std::string_view s, T& val, bt_intern_table& keys) {
+    if (auto err = try_bt_deserialize_interned(s, val, keys))
+        detail::throw_bt_error(err);
+}
+
+/// Deserializes the given data into a `T`, which is returned, with std::string_view dict keys
+/// interned into `keys`; see try_bt_deserialize_interned().
+template <typename T>
+T bt_deserialize_interned(std::string_view s, bt_intern_table& keys) {
+    T val;
+    bt_deserialize_interned(s, val, keys);
+    return val;
+}
+
+template <typename T, const_span_type SpanT>
+T bt_deserialize_interned(SpanT sp, bt_intern_table& keys) {
+    return bt_deserialize_interned<T>(detail::span_to_sv(sp), keys);
+}
+
+/// Deserializes the given data into `val` as try_bt_deserialize() does, but reusing the storage
+/// that `val` already has.  Rather than being cleared and refilled, lists (except for sets) are
+/// decoded element by element into their existing elements, and are then only extended or
+/// truncated at the end; maps and other node-based dicts reuse their nodes; and strings are
+/// assigned in place, keeping their capacity.  When repeatedly decoding messages of the same
+/// shape into the same destination, this makes the steady state free of heap allocations:
+///
+///     std::vector<std::string> names;  // Reused for every message
+///     for (std::string_view msg : messages) {
+///         bt_deserialize_reusing(msg, names);
+///         ...
+///     }
+///
+/// The result is the same as that of try_bt_deserialize() into a newly constructed value: in
+/// particular, bound struct members of a `bt_optional_field` whose key is absent are reset to their
+/// default rather than keeping the previous message's value.  Hash table dicts keep their bucket
+/// arrays, with their nodes parked in a per-thread spare table (which keeps its own buckets) while
+/// being decoded into.  The bt_value decoder does not reuse storage.
+template <typename T>
+requires(!std::is_const_v<T> && detail::bt_plain_decodable<T>)
+bt_error try_bt_deserialize_reusing(std::string_view s, T& val) {
+    detail::bt_decode_scope scope;
+    detail::bt_decode_ctx.reuse = true;
+    return try_bt_deserialize(s, val);
+}
+
+template <typename T, const_span_type SpanT>
+requires(!std::is_const_v<T> && detail::bt_plain_decodable<T>)
+bt_error try_bt_deserialize_reusing(SpanT sp, T& val) {
+    return try_bt_deserialize_reusing(detail::span_to_sv(sp), val);
+}
+
+/// Throwing version of try_bt_deserialize_reusing().
+template <typename T>
+requires(!std::is_const_v<T> && detail::bt_plain_decodable<T>)
+void bt_deserialize_reusing(std::string_view s, T& val) {
+    if (auto err = try_bt_deserialize_reusing(s, val))
+        detail::throw_bt_error(err);
+}
+
+template <typename T, const_span_type SpanT>
+requires(!std::is_const_v<T> && detail::bt_plain_decodable<T>)
+void bt_deserialize_reusing(SpanT sp, T& val) {
+    bt_deserialize_reusing(detail::span_to_sv(sp), val);
+}
+
+template <typename T, std::same_as<std::string> S>
+requires(detail::bt_borrows<T, detail::bt_borrow_check::plain>())
+bt_error try_bt_deserialize_reusing(S&& s, T& val) = delete;
+template <typename T, std::same_as<std::string> S>
+requires(detail::bt_borrows<T, detail::bt_borrow_check::plain>())
+void bt_deserialize_reusing(S&& s, T& val) = delete;
+
+/// Non-throwing version of `bt_get()` (below): deserializes into the given bt_value, returning a
+/// non-empty bt_error on failure.
+inline bt_error try_bt_get(
+        std::string_view s, bt_value& val, size_t max_depth = bt_default_max_depth) {
+    const char* orig = s.data();
+    auto ec = detail::bt_deserialize<bt_value>{max_depth}(s, val);
+    if (ec == bt_errc::ok && !s.empty())
+        ec = bt_errc::trailing_data;
+    return {ec, static_cast<size_t>(s.data() - orig)};
+}
+
 /// Deserializes the given value into a generic `bt_value` type (wrapped std::variant) which is
 /// capable of holding all possible BT-encoded values (including recursion).
 ///
@@ -568,8 +1176,13 @@ ReturnT bt_deserialize(SpanT sp) {
 ///     int v = get_int<int>(val); // fails unless the encoded value was actually an integer that
 ///                                // fits into an `int`
 ///
-inline bt_value bt_get(std::string_view s) {
-    return bt_deserialize<bt_value>(s);
+/// Decoding is not recursive, but lists and dicts nested more than `max_depth` levels deep are
+/// rejected.
+inline bt_value bt_get(std::string_view s, size_t max_depth = bt_default_max_depth) {
+    bt_value val;
+    if (auto err = try_bt_get(s, val, max_depth))
+        detail::throw_bt_error(err);
+    return val;
 }
 
 /// Helper functions to extract a value of some integral type from a bt_value which contains either
@@ -624,6 +1237,8 @@ Tuple get_tuple(const bt_value& x) {
 
 class bt_dict_consumer;
 class bt_list_consumer;
+template <basic_char Char>
+class bt_signature_batch;
 
 namespace detail {
     template <typename T, typename It>
@@ -665,7 +1280,8 @@ namespace detail {
             return T{c.template consume_span<typename T::value_type>()};
         else if constexpr (std::same_as<T, bt_list> || tuple_like<T> || bt_output_list_container<T>)
             return c.template consume_list<T>();
-        else if constexpr (std::same_as<T, bt_dict> || bt_output_dict_container<T>)
+        else if constexpr (
+                std::same_as<T, bt_dict> || bt_output_dict_container<T> || bt_struct_type<T>)
             return c.template consume_dict<T>();
         else if constexpr (std::same_as<T, bt_dict_consumer>)
             return c.consume_dict_consumer();
@@ -675,11 +1291,162 @@ namespace detail {
         }
     }
 
+    template <typename T, typename Consumer>
+    bt_error try_consume_impl(Consumer& c, T& val) {
+        if constexpr (std::integral<T>)
+            return c.template try_consume_integer<T>(val);
+        else if constexpr (string_like<T>) {
+            std::basic_string_view<typename T::value_type> v;
+            auto err = c.template try_consume_string_view<typename T::value_type>(v);
+            if (!err)
+                val = T{v};
+            return err;
+        } else if constexpr (const_span_type<T>) {
+            return c.template try_consume_span<typename T::value_type>(val);
+        } else if constexpr (
+                std::same_as<T, bt_list> || tuple_like<T> || bt_output_list_container<T>)
+            return c.try_consume_list(val);
+        else {
+            static_assert(
+                    std::same_as<T, bt_dict> || bt_output_dict_container<T> || bt_struct_type<T>,
+                    "Unsupported consume type");
+            return c.try_consume_dict(val);
+        }
+    }
+
+}  // namespace detail
+
+/// View of a list of strings that are all `N` bytes long (such as a list of 32-byte pubkeys), as
+/// returned by bt_list_consumer::consume_fixed_list<N>().  The strings are accessed in place in the
+/// encoded data, where each one is at a fixed stride from the previous one: the view is only valid
+/// as long as the encoded data is.
+template <size_t N, basic_char Char = char>
+class bt_fixed_list {
+    const char* first_ = nullptr;  // The first string's data (just after its length prefix)
+    size_t size_ = 0;
+
+    friend class bt_list_consumer;
+    bt_fixed_list(const char* first, size_t size) : first_{first}, size_{size} {}
+
+  public:
+    using value_type = const_span<Char, N>;
+    /// Distance between consecutive strings in the encoded data, i.e. the length of an element
+    /// including its `N:` prefix.
+    static constexpr size_t stride = detail::bt_digits(N) + 1 + N;
+
+    class iterator {
+        const char* p_ = nullptr;
+        friend class bt_fixed_list;
+        explicit iterator(const char* p) : p_{p} {}
+
+      public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = const_span<Char, N>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = value_type;
+
+        iterator() = default;
+        value_type operator*() const { return value_type{reinterpret_cast<const Char*>(p_), N}; }
+        iterator& operator++() {
+            p_ += stride;
+            return *this;
+        }
+        iterator operator++(int) {
+            auto it = *this;
+            ++*this;
+            return it;
+        }
+        bool operator==(const iterator&) const = default;
+    };
+
+    /// Constructs an empty view.
+    bt_fixed_list() = default;
+
+    /// Returns the number of strings in the list.
+    size_t size() const { return size_; }
+    /// Returns true if the list is empty.
+    bool empty() const { return size_ == 0; }
+
+    /// Returns the `i`th string of the list.  `i` is not checked.
+    value_type operator[](size_t i) const {
+        return value_type{reinterpret_cast<const Char*>(first_ + i * stride), N};
+    }
+
+    iterator begin() const { return iterator{first_}; }
+    iterator end() const { return iterator{first_ + size_ * stride}; }
+
+    /// Copies the strings into a vector of fixed-size arrays, with a single allocation.  The
+    /// arrays can use a different character type than the view, e.g. `to_vector<std::byte>()`.
+    template <basic_char T = Char>
+    std::vector<std::array<T, N>> to_vector() const {
+        std::vector<std::array<T, N>> out(size_);
+        for (size_t i = 0; i < size_; i++)
+            std::memcpy(out[i].data(), first_ + i * stride, N);
+        return out;
+    }
+};
+
+namespace detail {
+    // The length prefix of an encoded string of length N, such as `32:`.
+    template <size_t N>
+    inline constexpr auto bt_length_prefix = [] {
+        std::array<char, bt_digits(N) + 1> prefix{};
+        for (size_t i = prefix.size() - 1, n = N; i > 0; n /= 10)
+            prefix[--i] = static_cast<char>('0' + n % 10);
+        prefix.back() = ':';
+        return prefix;
+    }();
+
+    // Validates a list of N-byte strings, setting `count` to the number of strings.  This only has
+    // to compare each element's length prefix against the expected one, and skip over the string;
+    // it only falls back to fully parsing an element to find out what is wrong with it.  Elements
+    // with a non-canonical length prefix (e.g. `032:`) are rejected as `wrong_type`, as are strings
+    // of other lengths.
+    template <size_t N>
+    bt_errc bt_scan_fixed_list(std::string_view& s, size_t& count) {
+        if (s.empty())
+            return bt_errc::unexpected_end;
+        if (s[0] != 'l')
+            return bt_errc::wrong_type;
+        constexpr auto& prefix = bt_length_prefix<N>;
+        constexpr size_t stride = prefix.size() + N;
+        const char* const first = s.data() + 1;
+        const char* const end = s.data() + s.size();
+        const char* p = first;
+        // Requiring a byte after the element means we also always have the next element's first
+        // byte (or the list's `e`).
+        while (static_cast<size_t>(end - p) > stride &&
+               std::memcmp(p, prefix.data(), prefix.size()) == 0)
+            p += stride;
+        count = static_cast<size_t>(p - first) / stride;
+        s.remove_prefix(static_cast<size_t>(p - s.data()));
+        if (!s.empty() && s[0] == 'e') {
+            s.remove_prefix(1);
+            return bt_errc::ok;
+        }
+
+        auto elem_start = s;
+        std::string_view elem;
+        if (auto ec = bt_deserialize<std::string_view>{}(s, elem); ec != bt_errc::ok)
+            return ec;
+        // A valid element here means that it was last in the input, without the list's `e`
+        if (elem.size() == N && s.data() - elem_start.data() == stride)
+            return bt_errc::unexpected_end;
+        s = elem_start;
+        return bt_errc::wrong_type;
+    }
 }  // namespace detail
 
 /// Class that allows you to walk through a bt-encoded list in memory without copying or allocating
 /// memory.  It accesses existing memory directly and so the caller must ensure that the referenced
 /// memory stays valid for the lifetime of the bt_list_consumer object.
+///
+/// Each consuming method comes in two flavours: the plain version (e.g. `consume_integer<T>()`)
+/// that throws a bt_deserialize_invalid exception on failure, and a `try_` version (e.g.
+/// `try_consume_integer<T>(T&)`) that returns a bt_error instead of throwing.  When a `try_` method
+/// fails the consumer is left unchanged, and the error offset is relative to the beginning of the
+/// data the consumer was constructed with.
 class bt_list_consumer {
   protected:
     std::string_view data;            // Remaining data; this gets prefix-removed as we go
@@ -691,6 +1458,23 @@ class bt_list_consumer {
 
     bt_list_consumer(const char* input, size_t size, load_tag) : data{input, size} {}
 
+    // Returns a bt_error for an error code detected at position `pos` of our input.
+    bt_error error_at(bt_errc ec, const char* pos) const {
+        return {ec, static_cast<size_t>(pos - start)};
+    }
+
+    // Invokes `f(s)` on a copy of the remaining data, where `f` returns a bt_errc.  On success the
+    // copy (advanced by `f`) replaces our data; on failure our data is left unchanged and the
+    // error is returned, positioned wherever `f` left the copy.
+    template <typename F>
+    bt_error try_advance(F&& f) {
+        std::string_view s{data};
+        if (auto ec = f(s); ec != bt_errc::ok)
+            return error_at(ec, s.data());
+        data = s;
+        return {};
+    }
+
   public:
     bt_list_consumer(std::string_view data_) :
             bt_list_consumer{data_.data(), data_.size(), load_tag{}} {
@@ -736,6 +1520,13 @@ class bt_list_consumer {
         return detail::consume_impl<T>(*this);
     }
 
+    /// Non-throwing version of consume<T>() that stores the value into `val`.  Supports the same
+    /// types as consume<T>(), except for the consumer types.
+    template <typename T>
+    bt_error try_consume(T& val) {
+        return detail::try_consume_impl<T>(*this, val);
+    }
+
     /// Attempt to parse the next value as a string (and advance just past it).  Throws if the next
     /// value is not a string.
     template <basic_char Char = char>
@@ -744,42 +1535,87 @@ class bt_list_consumer {
     }
     template <basic_char Char = char>
     std::basic_string_view<Char> consume_string_view() {
-        if (data.empty())
-            throw bt_deserialize_invalid{"expected a string, but reached end of data"};
-        else if (!is_string())
-            throw bt_deserialize_invalid_type{"expected a string, but found "s + data.front()};
-        std::string_view next{data}, result;
-        detail::bt_deserialize<std::string_view>{}(next, result);
-        data = next;
-        return {reinterpret_cast<const Char*>(result.data()), result.size()};
+        std::basic_string_view<Char> result;
+        if (auto err = try_consume_string_view(result))
+            detail::throw_bt_error(err);
+        return result;
+    }
+
+    /// Non-throwing version of consume_string_view().
+    template <basic_char Char = char>
+    bt_error try_consume_string_view(std::basic_string_view<Char>& val) {
+        std::string_view result;
+        auto err = try_advance([&result](std::string_view& s) {
+            return detail::bt_deserialize<std::string_view>{}(s, result);
+        });
+        if (!err)
+            val = {reinterpret_cast<const Char*>(result.data()), result.size()};
+        return err;
     }
 
     template <basic_char Char = char>
     const_span<Char> consume_span() {
-        if (data.empty())
-            throw bt_deserialize_invalid{"expected a string, but reached end of data"};
-        else if (!is_string())
-            throw bt_deserialize_invalid_type{"expected a string, but found "s + data.front()};
-        std::string_view next{data};
         const_span<Char> result;
-        detail::bt_deserialize<const_span<Char>>{}(next, result);
-        data = next;
+        if (auto err = try_consume_span(result))
+            detail::throw_bt_error(err);
         return result;
     }
 
+    /// Non-throwing version of consume_span().
+    template <basic_char Char = char>
+    bt_error try_consume_span(const_span<Char>& val) {
+        return try_advance([&val](std::string_view& s) {
+            return detail::bt_deserialize<const_span<Char>>{}(s, val);
+        });
+    }
+
+    /// Consumes a list of strings that are all `N` bytes long, such as a list of 32-byte pubkeys,
+    /// returning a view of the strings in place.  The whole list is validated in one tight pass
+    /// that just checks each element's `N:` prefix, rather than fully parsing each element; the
+    /// strings can then be accessed through the view, or copied out with its to_vector().  Throws
+    /// if the next value is not a list, or if any of its elements is not a string of exactly `N`
+    /// bytes.
+    ///
+    ///     auto pubkeys = c.consume_fixed_list<32, std::byte>();
+    ///     for (const_span<std::byte, 32> pk : pubkeys) { ... }
+    template <size_t N, basic_char Char = char>
+    bt_fixed_list<N, Char> consume_fixed_list() {
+        bt_fixed_list<N, Char> result;
+        if (auto err = try_consume_fixed_list(result))
+            detail::throw_bt_error(err);
+        return result;
+    }
+
+    /// Non-throwing version of consume_fixed_list().
+    template <size_t N, basic_char Char = char>
+    bt_error try_consume_fixed_list(bt_fixed_list<N, Char>& val) {
+        const char* first = data.data() + 1;
+        size_t count;
+        auto err = try_advance(
+                [&count](std::string_view& s) { return detail::bt_scan_fixed_list<N>(s, count); });
+        if (!err)
+            val = {first + detail::bt_length_prefix<N>.size(), count};
+        return err;
+    }
+
     /// Attempts to parse the next value as an integer (and advance just past it).  Throws if the
     /// next value is not an integer.
     template <typename IntType>
     IntType consume_integer() {
-        if (!is_integer())
-            throw bt_deserialize_invalid_type{"next value is not an integer"};
-        std::string_view next{data};
         IntType ret;
-        detail::bt_deserialize<IntType>{}(next, ret);
-        data = next;
+        if (auto err = try_consume_integer(ret))
+            detail::throw_bt_error(err);
         return ret;
     }
 
+    /// Non-throwing version of consume_integer().  Returns a `bt_errc::integer_range` error
+    /// (without advancing) if the value is an integer that does not fit in `IntType`.
+    template <typename IntType>
+    bt_error try_consume_integer(IntType& val) {
+        return try_advance(
+                [&val](std::string_view& s) { return detail::bt_deserialize<IntType>{}(s, val); });
+    }
+
     /// Consumes a list, return it as a list-like type.  Can also be used for tuples/pairs.  This
     /// typically requires dynamic allocation, but only has to parse the data once.  Compare with
     /// consume_list_data() which allows alloc-free traversal, but requires parsing twice (if the
@@ -794,11 +1630,18 @@ class bt_list_consumer {
     /// Same as above, but takes a pre-existing list-like data type.
     template <typename T>
     void consume_list(T& list) {
-        if (!is_list())
-            throw bt_deserialize_invalid_type{"next bt value is not a list"};
-        std::string_view n{data};
-        detail::bt_deserialize<T>{}(n, list);
-        data = n;
+        if (auto err = try_consume_list(list))
+            detail::throw_bt_error(err);
+    }
+
+    /// Non-throwing version of consume_list(list).
+    template <typename T>
+    bt_error try_consume_list(T& list) {
+        return try_advance([&list](std::string_view& s) {
+            if (!s.empty() && s[0] != 'l')
+                return bt_errc::wrong_type;
+            return detail::bt_deserialize<T>{}(s, list);
+        });
     }
 
     /// Consumes a dict, return it as a dict-like type.  This typically requires dynamic allocation,
@@ -814,59 +1657,91 @@ class bt_list_consumer {
     /// Same as above, but takes a pre-existing dict-like data type.
     template <typename T>
     void consume_dict(T& dict) {
-        if (!is_dict())
-            throw bt_deserialize_invalid_type{"next bt value is not a dict"};
-        std::string_view n{data};
-        detail::bt_deserialize<T>{}(n, dict);
-        data = n;
+        if (auto err = try_consume_dict(dict))
+            detail::throw_bt_error(err);
+    }
+
+    /// Non-throwing version of consume_dict(dict).
+    template <typename T>
+    bt_error try_consume_dict(T& dict) {
+        return try_advance([&dict](std::string_view& s) {
+            if (!s.empty() && s[0] != 'd')
+                return bt_errc::wrong_type;
+            return detail::bt_deserialize<T>{}(s, dict);
+        });
     }
 
     /// Attempts to parse the next value as a list and returns the string_view that contains the
-    /// entire thing.  This is recursive into both lists and dicts and likely to be quite
+    /// entire thing.  This descends into nested lists and dicts and is likely to be quite
     /// inefficient for large, nested structures (unless the values only need to be skipped but
     /// aren't separately needed).  This, however, does not require dynamic memory allocation.
     template <basic_char Char = char>
     std::basic_string_view<Char> consume_list_data() {
-        std::basic_string_view<Char> orig{reinterpret_cast<const Char*>(data.data()), data.size()};
-        if (data.size() < 2 || !is_list())
-            throw bt_deserialize_invalid_type{"next bt value is not a list"};
-        data.remove_prefix(1);  // Descend into the sublist, consume the "l"
-        while (!is_finished()) {
-            skip_value();
-            if (data.empty())
-                throw bt_deserialize_invalid{
-                        "bt list consumption failed: hit the end of string before the list was "
-                        "done"};
-        }
-        data.remove_prefix(1);  // Back out from the sublist, consume the "e"
-        orig.remove_suffix(data.size());
-        return orig;
+        std::basic_string_view<Char> result;
+        if (auto err = try_consume_list_data(result))
+            detail::throw_bt_error(err);
+        return result;
+    }
+
+    /// Non-throwing version of consume_list_data().
+    template <basic_char Char = char>
+    bt_error try_consume_list_data(std::basic_string_view<Char>& val) {
+        return try_consume_data<'l'>(val);
     }
 
     /// Attempts to parse the next value as a dict and returns the string_view that contains the
-    /// entire thing.  This is recursive into both lists and dicts and likely to be quite
+    /// entire thing.  This descends into nested lists and dicts and is likely to be quite
     /// inefficient for large, nested structures (unless the values only need to be skipped but
     /// aren't separately needed).  This, however, does not require dynamic memory allocation.
     template <basic_char Char = char>
     std::basic_string_view<Char> consume_dict_data() {
-        std::basic_string_view<Char> orig{reinterpret_cast<const Char*>(data.data()), data.size()};
-        if (data.size() < 2 || !is_dict())
-            throw bt_deserialize_invalid_type{"next bt value is not a dict"};
-        data.remove_prefix(1);  // Descent into the dict, consumer the "d"
-        while (!is_finished()) {
-            consume_string_view();  // Key is always a string
-            if (!data.empty())
-                skip_value();
-            if (data.empty())
-                throw bt_deserialize_invalid{
-                        "bt dict consumption failed: hit the end of string before the dict was "
-                        "done"};
-        }
-        data.remove_prefix(1);  // Back out of the dict, consume the "e"
-        orig.remove_suffix(data.size());
-        return orig;
+        std::basic_string_view<Char> result;
+        if (auto err = try_consume_dict_data(result))
+            detail::throw_bt_error(err);
+        return result;
+    }
+
+    /// Non-throwing version of consume_dict_data().
+    template <basic_char Char = char>
+    bt_error try_consume_dict_data(std::basic_string_view<Char>& val) {
+        return try_consume_data<'d'>(val);
+    }
+
+    /// Returns the encoding of the next value, whatever its type, without decoding it.  This is
+    /// useful for passing values through untouched, e.g. to bt_list_producer::append_encoded().
+    template <basic_char Char = char>
+    std::basic_string_view<Char> consume_value_data() {
+        std::basic_string_view<Char> result;
+        if (auto err = try_consume_value_data(result))
+            detail::throw_bt_error(err);
+        return result;
+    }
+
+    /// Non-throwing version of consume_value_data().
+    template <basic_char Char = char>
+    bt_error try_consume_value_data(std::basic_string_view<Char>& val) {
+        return try_consume_data<'\0'>(val);
+    }
+
+  private:
+    // Consumes the next value, which must start with `Prefix` (unless that is \0), returning the
+    // encoded value in `val`.
+    template <char Prefix, basic_char Char>
+    bt_error try_consume_data(std::basic_string_view<Char>& val) {
+        const char* begin = data.data();
+        auto err = try_advance([](std::string_view& s) {
+            if (s.empty())
+                return bt_errc::unexpected_end;
+            if (Prefix && s[0] != Prefix)
+                return bt_errc::wrong_type;
+            return detail::bt_skip_value(s, bt_max_skip_depth);
+        });
+        if (!err)
+            val = {reinterpret_cast<const Char*>(begin), static_cast<size_t>(data.data() - begin)};
+        return err;
     }
 
+  public:
     /// Shortcut for wrapping `consume_list_data()` in a new list consumer
     bt_list_consumer consume_list_consumer() { return consume_list_data(); }
     /// Shortcut for wrapping `consume_dict_data()` in a new dict consumer
@@ -900,18 +1775,28 @@ class bt_list_consumer {
             return verify(std::move(msg), consume_span<CharT>());
     }
 
+    /// Consumes a signature value like consume_signature(verify), but rather than verifying it
+    /// immediately, adds the signed message and the signature to `batch` for later bulk
+    /// verification.  Returns the batch ticket of the signature; see bt_signature_batch (from
+    /// `oxenc/bt_signature_batch.h`).
+    template <basic_char Char>
+    size_t consume_signature(bt_signature_batch<Char>& batch) {
+        std::basic_string_view<Char> msg{
+                reinterpret_cast<const Char*>(start), static_cast<size_t>(data.data() - start)};
+        auto sig = consume_string_view<Char>();
+        return batch.add(msg, sig);
+    }
+
     /// Consumes a value without returning it.
     void skip_value() {
-        if (is_string())
-            consume_string_view();
-        else if (is_integer())
-            detail::bt_deserialize_integer(data);
-        else if (is_list())
-            consume_list_data();
-        else if (is_dict())
-            consume_dict_data();
-        else
-            throw bt_deserialize_invalid_type{"next bt value has unknown type"};
+        if (auto err = try_skip_value())
+            detail::throw_bt_error(err);
+    }
+
+    /// Non-throwing version of skip_value().
+    bt_error try_skip_value() {
+        return try_advance(
+                [](std::string_view& s) { return detail::bt_skip_value(s, bt_max_skip_depth); });
     }
 
     /// Finishes reading the list by reading through (and ignoring) any remaining values until it
@@ -922,19 +1807,34 @@ class bt_list_consumer {
     /// It is not required to call this, but not calling it will not notice if there is invalid data
     /// later in the list or after the end of the list.
     void finish() {
-        while (!is_finished())
-            skip_value();
+        if (auto err = try_finish())
+            detail::throw_bt_error(err);
+    }
 
-        // If we consumed the entire buffer we should have only the terminating 'e' left (and
-        // `is_finished()` already checked that it is in fact an `e`).
-        if (data.size() != 1)
-            throw bt_deserialize_invalid{"Dict finished without consuming the entire buffer"};
+    /// Non-throwing version of finish().
+    bt_error try_finish() {
+        return try_advance([](std::string_view& s) {
+            while (!s.empty() && s[0] != 'e')
+                if (auto ec = detail::bt_skip_value(s, bt_max_skip_depth); ec != bt_errc::ok)
+                    return ec;
+            if (s.empty())
+                return bt_errc::unexpected_end;
+            // If we consumed the entire buffer we should have only the terminating 'e' left.
+            if (s.size() != 1) {
+                s.remove_prefix(1);
+                return bt_errc::trailing_data;
+            }
+            return bt_errc::ok;
+        });
     }
 };
 
 /// Class that allows you to walk through key-value pairs of a bt-encoded dict in memory without
 /// copying or allocating memory.  It accesses existing memory directly and so the caller must
 /// ensure that the referenced memory stays valid for the lifetime of the bt_dict_consumer object.
+///
+/// As with bt_list_consumer, consuming methods have a throwing version and a non-throwing `try_`
+/// version that returns a bt_error and leaves the consumer unchanged on failure.
 class bt_dict_consumer : private bt_list_consumer {
     std::string_view key_;
 
@@ -943,16 +1843,35 @@ class bt_dict_consumer : private bt_list_consumer {
     /// data (i.e. requires that it be followed by something).  Returns true if the key was consumed
     /// (either now or previously and cached).
     bool consume_key() {
+        bool found;
+        if (auto err = try_consume_key(found))
+            detail::throw_bt_error(err);
+        return found;
+    }
+
+    /// Non-throwing version of consume_key(): sets `found` to the value consume_key() would return.
+    bt_error try_consume_key(bool& found) {
+        found = true;
         if (key_.data())
-            return true;
+            return {};
         if (data.empty())
-            throw bt_deserialize_invalid_type{"expected a key or dict end, found end of string"};
-        if (data[0] == 'e')
-            return false;
-        key_ = bt_list_consumer::consume_string_view();
-        if (data.empty() || data[0] == 'e')
-            throw bt_deserialize_invalid{"dict key isn't followed by a value"};
-        return true;
+            return error_at(bt_errc::unexpected_end, data.data());
+        if (data[0] == 'e') {
+            found = false;
+            return {};
+        }
+        std::string_view k;
+        if (auto err = try_advance([&k](std::string_view& s) {
+                auto ec = detail::bt_deserialize<std::string_view>{}(s, k);
+                if (ec == bt_errc::ok && s.empty())
+                    ec = bt_errc::unexpected_end;
+                else if (ec == bt_errc::ok && s[0] == 'e')
+                    ec = bt_errc::invalid_value;  // key isn't followed by a value
+                return ec;
+            }))
+            return err;
+        key_ = k;
+        return {};
     }
 
     /// Clears the cached key and returns it.  Must have already called consume_key directly or
@@ -963,6 +1882,22 @@ class bt_dict_consumer : private bt_list_consumer {
         return k;
     }
 
+    // Common implementation of the non-throwing value consumers: consumes the key (if not already
+    // consumed), then invokes `f()` to consume the value; on success the key is flushed and stored
+    // in `key`.  Reaching the end of the dict is reported as a `wrong_type` error.
+    template <typename F>
+    bt_error try_next(std::string_view& key, F&& f) {
+        bool found;
+        if (auto err = try_consume_key(found))
+            return err;
+        if (!found)
+            return error_at(bt_errc::wrong_type, data.data());
+        if (auto err = f())
+            return err;
+        key = flush_key();
+        return {};
+    }
+
   public:
     bt_dict_consumer(std::string_view data_) :
             bt_list_consumer{data_.data(), data_.size(), load_tag{}} {
@@ -1022,11 +1957,11 @@ class bt_dict_consumer : private bt_list_consumer {
     /// Throws if the next value is not a string.
     template <basic_char Char = char>
     std::pair<std::string_view, std::basic_string_view<Char>> next_string() {
-        if (!is_string())
-            throw bt_deserialize_invalid_type{"expected a string, but found "s + data.front()};
         std::pair<std::string_view, std::basic_string_view<Char>> ret;
-        ret.second = bt_list_consumer::consume_string_view<Char>();
-        ret.first = flush_key();
+        if (auto err = try_next(ret.first, [this, &ret] {
+                return bt_list_consumer::try_consume_string_view<Char>(ret.second);
+            }))
+            detail::throw_bt_error(err);
         return ret;
     }
 
@@ -1034,11 +1969,11 @@ class bt_dict_consumer : private bt_list_consumer {
     /// Throws if the next value is not a const_span
     template <typename Char = char>
     std::pair<std::string_view, const_span<Char>> next_span() {
-        if (!is_string())
-            throw bt_deserialize_invalid_type{"expected a string, but found "s + data.front()};
         std::pair<std::string_view, const_span<Char>> ret;
-        ret.second = bt_list_consumer::consume_span<Char>();
-        ret.first = flush_key();
+        if (auto err = try_next(ret.first, [this, &ret] {
+                return bt_list_consumer::try_consume_span<Char>(ret.second);
+            }))
+            detail::throw_bt_error(err);
         return ret;
     }
 
@@ -1046,11 +1981,23 @@ class bt_dict_consumer : private bt_list_consumer {
     /// Throws if the next value is not an integer.
     template <typename IntType>
     std::pair<std::string_view, IntType> next_integer() {
-        if (!is_integer())
-            throw bt_deserialize_invalid_type{"next bt dict value is not an integer"};
         std::pair<std::string_view, IntType> ret;
-        ret.second = bt_list_consumer::consume_integer<IntType>();
-        ret.first = flush_key();
+        if (auto err = try_next(ret.first, [this, &ret] {
+                return bt_list_consumer::try_consume_integer<IntType>(ret.second);
+            }))
+            detail::throw_bt_error(err);
+        return ret;
+    }
+
+    /// Consumes a string->list pair where the list contains strings that are all `N` bytes long,
+    /// returning a view of the strings in place; see bt_list_consumer::consume_fixed_list().
+    template <size_t N, basic_char Char = char>
+    std::pair<std::string_view, bt_fixed_list<N, Char>> next_fixed_list() {
+        std::pair<std::string_view, bt_fixed_list<N, Char>> ret;
+        if (auto err = try_next(ret.first, [this, &ret] {
+                return bt_list_consumer::try_consume_fixed_list(ret.second);
+            }))
+            detail::throw_bt_error(err);
         return ret;
     }
 
@@ -1068,10 +2015,11 @@ class bt_dict_consumer : private bt_list_consumer {
     /// Same as above, but takes a pre-existing list-like data type.  Returns the key.
     template <typename T>
     std::string_view next_list(T& list) {
-        if (!is_list())
-            throw bt_deserialize_invalid_type{"next bt value is not a list"};
-        bt_list_consumer::consume_list(list);
-        return flush_key();
+        std::string_view key;
+        if (auto err = try_next(
+                    key, [this, &list] { return bt_list_consumer::try_consume_list(list); }))
+            detail::throw_bt_error(err);
+        return key;
     }
 
     /// Consumes a string->dict pair, return it as a dict-like type.  This typically requires
@@ -1088,42 +2036,61 @@ class bt_dict_consumer : private bt_list_consumer {
     /// Same as above, but takes a pre-existing dict-like data type.  Returns the key.
     template <typename T>
     std::string_view next_dict(T& dict) {
-        if (!is_dict())
-            throw bt_deserialize_invalid_type{"next bt value is not a dict"};
-        bt_list_consumer::consume_dict(dict);
-        return flush_key();
+        std::string_view key;
+        if (auto err = try_next(
+                    key, [this, &dict] { return bt_list_consumer::try_consume_dict(dict); }))
+            detail::throw_bt_error(err);
+        return key;
     }
 
     /// Attempts to parse the next value as a string->list pair and returns the string_view that
-    /// contains the entire thing.  This is recursive into both lists and dicts and likely to be
+    /// contains the entire thing.  This descends into nested lists and dicts and is likely to be
     /// quite inefficient for large, nested structures (unless the values only need to be
     /// skipped but aren't separately needed).  This, however, does not require dynamic memory
     /// allocation.
     template <basic_char Char = char>
     std::pair<std::string_view, std::basic_string_view<Char>> next_list_data() {
-        if (data.size() < 2 || !is_list())
-            throw bt_deserialize_invalid_type{"next bt dict value is not a list"};
-        return {flush_key(), bt_list_consumer::consume_list_data<Char>()};
+        std::pair<std::string_view, std::basic_string_view<Char>> ret;
+        if (auto err = try_next(ret.first, [this, &ret] {
+                return bt_list_consumer::try_consume_list_data<Char>(ret.second);
+            }))
+            detail::throw_bt_error(err);
+        return ret;
     }
 
     /// Same as next_list_data(), but wraps the value in a bt_list_consumer for convenience
     std::pair<std::string_view, bt_list_consumer> next_list_consumer() { return next_list_data(); }
 
     /// Attempts to parse the next value as a string->dict pair and returns the string_view that
-    /// contains the entire thing.  This is recursive into both lists and dicts and likely to be
+    /// contains the entire thing.  This descends into nested lists and dicts and is likely to be
     /// quite inefficient for large, nested structures (unless the values only need to be
     /// skipped but aren't separately needed).  This, however, does not require dynamic memory
     /// allocation.
     template <basic_char Char = char>
     std::pair<std::string_view, std::basic_string_view<Char>> next_dict_data() {
-        if (data.size() < 2 || !is_dict())
-            throw bt_deserialize_invalid_type{"next bt dict value is not a dict"};
-        return {flush_key(), bt_list_consumer::consume_dict_data<Char>()};
+        std::pair<std::string_view, std::basic_string_view<Char>> ret;
+        if (auto err = try_next(ret.first, [this, &ret] {
+                return bt_list_consumer::try_consume_dict_data<Char>(ret.second);
+            }))
+            detail::throw_bt_error(err);
+        return ret;
     }
 
     /// Same as next_dict_data(), but wraps the value in a bt_dict_consumer for convenience
     std::pair<std::string_view, bt_dict_consumer> next_dict_consumer() { return next_dict_data(); }
 
+    /// Returns the next key and the encoding of its value, whatever its type, without decoding the
+    /// value.
+    template <basic_char Char = char>
+    std::pair<std::string_view, std::basic_string_view<Char>> next_value_data() {
+        std::pair<std::string_view, std::basic_string_view<Char>> ret;
+        if (auto err = try_next(ret.first, [this, &ret] {
+                return bt_list_consumer::try_consume_value_data<Char>(ret.second);
+            }))
+            detail::throw_bt_error(err);
+        return ret;
+    }
+
     /// Parses the next value as a string->string pair that has been constructed to contain a
     /// signature produced via bt_dict_producer::append_signature.  Returns a tuple of three
     /// values:
@@ -1205,11 +2172,29 @@ class bt_dict_consumer : private bt_list_consumer {
     ///   however, make a copy of the bt_dict_consumer before calling and use the copy to return
     ///   to the pre-skipped position).
     bool skip_until(std::string_view find) {
-        while (consume_key() && key_ < find) {
+        bool found;
+        if (auto err = try_skip_until(find, found))
+            detail::throw_bt_error(err);
+        return found;
+    }
+
+    /// Non-throwing version of skip_until(); `found` is set to the value skip_until() would
+    /// return.  On failure the consumer is left at its position before the call.
+    bt_error try_skip_until(std::string_view find, bool& found) {
+        auto orig = *this;
+        bool have_key;
+        bt_error err;
+        while (!(err = try_consume_key(have_key)) && have_key && key_ < find) {
             flush_key();
-            skip_value();
+            if ((err = bt_list_consumer::try_skip_value()))
+                break;
+        }
+        if (err) {
+            *this = orig;
+            return err;
         }
-        return key_ == find;
+        found = have_key && key_ == find;
+        return {};
     }
 
     /// This functions nearly identically to skip_until; it will return if we found an exact
@@ -1231,6 +2216,17 @@ class bt_dict_consumer : private bt_list_consumer {
             throw std::out_of_range{"Key " + std::string{find} + " not found!"};
     }
 
+    /// Non-throwing version of required(): returns a `bt_errc::key_not_found` error (positioned at
+    /// the first key greater than `find`, or the end of the dict) if the key does not exist.
+    bt_error try_required(std::string_view find) {
+        bool found;
+        if (auto err = try_skip_until(find, found))
+            return err;
+        if (!found)
+            return error_at(bt_errc::key_not_found, key_.data() ? key_.data() : data.data());
+        return {};
+    }
+
     /// The `consume_*` functions are wrappers around next_whatever that discard the returned
     /// key.
     ///
@@ -1260,6 +2256,11 @@ class bt_dict_consumer : private bt_list_consumer {
         return next_integer<IntType>().second;
     }
 
+    template <size_t N, basic_char Char = char>
+    auto consume_fixed_list() {
+        return next_fixed_list<N, Char>().second;
+    }
+
     template <typename T = bt_list>
     auto consume_list() {
         return next_list<T>().second;
@@ -1288,12 +2289,81 @@ class bt_dict_consumer : private bt_list_consumer {
     std::basic_string_view<Char> consume_dict_data() {
         return next_dict_data<Char>().second;
     }
+    template <basic_char Char = char>
+    std::basic_string_view<Char> consume_value_data() {
+        return next_value_data<Char>().second;
+    }
+
+    /// Non-throwing versions of the `consume_*` methods.  On failure (including when the dict is
+    /// already finished) these return an error and leave the consumer unchanged.
+    template <basic_char Char = char>
+    bt_error try_consume_string_view(std::basic_string_view<Char>& val) {
+        std::string_view k;
+        return try_next(
+                k, [this, &val] { return bt_list_consumer::try_consume_string_view<Char>(val); });
+    }
+    template <basic_char Char = char>
+    bt_error try_consume_span(const_span<Char>& val) {
+        std::string_view k;
+        return try_next(k, [this, &val] { return bt_list_consumer::try_consume_span<Char>(val); });
+    }
+    template <typename IntType>
+    bt_error try_consume_integer(IntType& val) {
+        std::string_view k;
+        return try_next(k, [this, &val] { return bt_list_consumer::try_consume_integer(val); });
+    }
+    template <size_t N, basic_char Char = char>
+    bt_error try_consume_fixed_list(bt_fixed_list<N, Char>& val) {
+        std::string_view k;
+        return try_next(
+                k, [this, &val] { return bt_list_consumer::try_consume_fixed_list(val); });
+    }
+    template <typename T>
+    bt_error try_consume_list(T& list) {
+        std::string_view k;
+        return try_next(k, [this, &list] { return bt_list_consumer::try_consume_list(list); });
+    }
+    template <typename T>
+    bt_error try_consume_dict(T& dict) {
+        std::string_view k;
+        return try_next(k, [this, &dict] { return bt_list_consumer::try_consume_dict(dict); });
+    }
+    template <basic_char Char = char>
+    bt_error try_consume_list_data(std::basic_string_view<Char>& val) {
+        std::string_view k;
+        return try_next(
+                k, [this, &val] { return bt_list_consumer::try_consume_list_data<Char>(val); });
+    }
+    template <basic_char Char = char>
+    bt_error try_consume_dict_data(std::basic_string_view<Char>& val) {
+        std::string_view k;
+        return try_next(
+                k, [this, &val] { return bt_list_consumer::try_consume_dict_data<Char>(val); });
+    }
+    template <basic_char Char = char>
+    bt_error try_consume_value_data(std::basic_string_view<Char>& val) {
+        std::string_view k;
+        return try_next(
+                k, [this, &val] { return bt_list_consumer::try_consume_value_data<Char>(val); });
+    }
 
     /// Shortcut for wrapping `consume_list_data()` in a new list consumer
     bt_list_consumer consume_list_consumer() { return consume_list_data(); }
     /// Shortcut for wrapping `consume_dict_data()` in a new dict consumer
     bt_dict_consumer consume_dict_consumer() { return consume_dict_data(); }
 
+    /// Consumes the next key-value pair without parsing the value.
+    void skip_value() {
+        if (auto err = try_skip_value())
+            detail::throw_bt_error(err);
+    }
+
+    /// Non-throwing version of skip_value().
+    bt_error try_skip_value() {
+        std::string_view k;
+        return try_next(k, [this] { return bt_list_consumer::try_skip_value(); });
+    }
+
     /// Consumes and verifies a signature.  This method, unlike the above consume_ functions, is
     /// a little different from its `next_signature` counterpart: it returns nothing, but takes
     /// a verification function to call with the expected message data and signature.  The
@@ -1330,6 +2400,16 @@ class bt_dict_consumer : private bt_list_consumer {
         }
     }
 
+    /// Consumes a signature value like consume_signature(verify), but rather than verifying it
+    /// immediately, adds the signed message and the signature (as extracted by
+    /// next_signature_view()) to `batch` for later bulk verification.  Returns the batch ticket of
+    /// the signature; see bt_signature_batch (from `oxenc/bt_signature_batch.h`).
+    template <basic_char Char>
+    size_t consume_signature(bt_signature_batch<Char>& batch) {
+        auto [k, msg, sig] = next_signature_view<Char>();
+        return batch.add(msg, sig);
+    }
+
     /// Consumes a value into the given type (string_view, string, integer, bt_dict_consumer,
     /// etc.). This is a shortcut for calling consume_string, consume_integer, etc. based on the
     /// templated type.
@@ -1338,6 +2418,13 @@ class bt_dict_consumer : private bt_list_consumer {
         return detail::consume_impl<T>(*this);
     }
 
+    /// Non-throwing version of consume<T>() that stores the value into `val`.  Supports the same
+    /// types as consume<T>(), except for the consumer types.
+    template <typename T>
+    bt_error try_consume(T& val) {
+        return detail::try_consume_impl<T>(*this, val);
+    }
+
     /// Advances to and requires the given key (as if by calling `required()`) and then throws
     /// if the key was not found; otherwise returns the value parsed into the given type.
     template <typename T>
@@ -1346,6 +2433,14 @@ class bt_dict_consumer : private bt_list_consumer {
         return consume<T>();
     }
 
+    /// Non-throwing version of require<T>(key) that stores the value into `val`.
+    template <typename T>
+    bt_error try_require(std::string_view key, T& val) {
+        if (auto err = try_required(key))
+            return err;
+        return try_consume(val);
+    }
+
     /// Advances to and requires the given key (as if by calling `required()`) and then throws
     /// if the key was not found; otherwise calls consume_signature() with the given
     /// verification function to verify the signature value against the prior dict data.
@@ -1355,6 +2450,15 @@ class bt_dict_consumer : private bt_list_consumer {
         return consume_signature(std::forward<VerifyFunc>(verify));
     }
 
+    /// Advances to and requires the given key (as if by calling `required()`) and then adds the
+    /// signature there to `batch`, as if by calling consume_signature(batch).  Returns the batch
+    /// ticket of the signature.
+    template <basic_char Char>
+    size_t require_signature(std::string_view key, bt_signature_batch<Char>& batch) {
+        required(key);
+        return consume_signature(batch);
+    }
+
     /// Advances to a given key (as if by calling `skip_until`) and then returns std::nullopt if
     /// the key was not found; otherwise returns the value parsed into the given type.  Note
     /// that this will still throw if the key exists but has an incompatible value (e.g. calling
@@ -1366,6 +2470,25 @@ class bt_dict_consumer : private bt_list_consumer {
         return consume<T>();
     }
 
+    /// Non-throwing version of maybe<T>(key): `val` is reset if the key does not exist, and
+    /// otherwise set to the consumed value.  Returns an error if the key exists but its value
+    /// cannot be consumed as a `T`.
+    template <typename T>
+    bt_error try_maybe(std::string_view key, std::optional<T>& val) {
+        bool found;
+        if (auto err = try_skip_until(key, found))
+            return err;
+        if (!found) {
+            val.reset();
+            return {};
+        }
+        T v;
+        auto err = try_consume(v);
+        if (!err)
+            val = std::move(v);
+        return err;
+    }
+
     /// Finishes reading the dict by reading through (and ignoring) any remaining keys until it
     /// reaches the end of the dict, and confirms that the end of the dict is in fact the end of
     /// the input.  Will throw if anything doesn't parse, or if the dict terminates but *isn't*
@@ -1374,14 +2497,28 @@ class bt_dict_consumer : private bt_list_consumer {
     /// It is not required to call this, but not calling it will not notice if there is invalid
     /// data later in the dict or after the end of the dict.
     void finish() {
-        while (!is_finished()) {
+        if (auto err = try_finish())
+            detail::throw_bt_error(err);
+    }
+
+    /// Non-throwing version of finish().  On failure the consumer is left at its position before
+    /// the call.
+    bt_error try_finish() {
+        auto orig = *this;
+        bool have_key;
+        bt_error err;
+        while (!(err = try_consume_key(have_key)) && have_key) {
             flush_key();
-            skip_value();
+            if ((err = bt_list_consumer::try_skip_value()))
+                break;
         }
         // If we consumed the entire buffer we should have only the terminating 'e' left (and
-        // `is_finished()` already checked that it is in fact an `e`).
-        if (data.size() != 1)
-            throw bt_deserialize_invalid{"Dict finished without consuming the entire buffer"};
+        // try_consume_key() already checked that it is in fact an `e`).
+        if (!err && data.size() != 1)
+            err = error_at(bt_errc::trailing_data, data.data() + 1);
+        if (err)
+            *this = orig;
+        return err;
     }
 };
 
@@ -1391,43 +2528,95 @@ inline bt_dict_consumer bt_list_consumer::consume_dict_consumer() {
 
 namespace detail {
 
+    /// Returns the number of leading ASCII digits (0-8) in an 8-byte chunk loaded in little-endian
+    /// order (i.e. with the first character in the lowest byte).
+    inline int swar_count_digits(uint64_t chunk) {
+        // A byte is a digit iff its high nibble is 3 and adding 6 doesn't carry into the high
+        // nibble; this produces a zero byte for every digit.  (A carry out of a non-digit byte
+        // can corrupt the following bytes, but we only look at bytes before the first non-digit).
+        uint64_t x = ((chunk & 0xF0F0F0F0F0F0F0F0) |
+                      (((chunk + 0x0606060606060606) & 0xF0F0F0F0F0F0F0F0) >> 4)) ^
+                     0x3333333333333333;
+        return x ? std::countr_zero(x) / 8 : 8;
+    }
+
+    /// Converts 8 ASCII digits loaded in little-endian order into their value.  Zero bytes in the
+    /// lowest positions are treated as leading zeros, so a chunk of `n` digits shifted left by
+    /// `8*(8-n)` bits converts to the value of those `n` digits.
+    inline uint32_t swar_parse_8_digits(uint64_t chunk) {
+        chunk = ((chunk & 0x0F0F0F0F0F0F0F0F) * 2561) >> 8;
+        chunk = ((chunk & 0x00FF00FF00FF00FF) * 6553601) >> 16;
+        return static_cast<uint32_t>(((chunk & 0x0000FFFF0000FFFF) * 42949672960001) >> 32);
+    }
+
     /// Reads digits into an unsigned 64-bit int.
-    inline uint64_t extract_unsigned(std::string_view& s) {
+    ///
+    /// This consumes up to 8 digits at a time with SWAR ("SIMD within a register") arithmetic as
+    /// long as the accumulated value cannot overflow, then finishes (or handles short inputs near
+    /// the end of the buffer) one digit at a time with an exact overflow check.  Leading zeros are
+    /// accepted.  On overflow `s` is left pointing at the beginning of the digits.
+    inline bt_errc extract_unsigned(std::string_view& s, uint64_t& val) {
+        constexpr uint64_t pow10[9] = {
+                1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000};
+        // Below this value we can always accept another 8 digits without overflow:
+        constexpr uint64_t swar_limit = 100000000000;
+
+        const char* const begin = s.data();
+        const char* p = begin;
+        const char* const end = begin + s.size();
         uint64_t uval = 0;
-        bool once = false;
-        while (!s.empty() && (s[0] >= '0' && s[0] <= '9')) {
-            once = true;
-            uint64_t bigger = uval * 10 + static_cast<uint64_t>(s[0] - '0');
-            s.remove_prefix(1);
-            if (bigger < uval)  // overflow
-                throw bt_deserialize_invalid(
-                        "Integer deserialization failed: value is too large for a 64-bit int");
-            uval = bigger;
+
+        while (end - p >= 8 && uval < swar_limit) {
+            auto chunk = load_little_to_host<uint64_t>(p);
+            int n = swar_count_digits(chunk);
+            if (n == 0)
+                break;
+            uval = uval * pow10[n] + swar_parse_8_digits(chunk << (8 * (8 - n)));
+            p += n;
+            if (n < 8)
+                break;
+        }
+
+        constexpr uint64_t max10 = std::numeric_limits<uint64_t>::max() / 10;
+        constexpr uint64_t maxlast = std::numeric_limits<uint64_t>::max() % 10;
+        for (; p < end && *p >= '0' && *p <= '9'; ++p) {
+            auto digit = static_cast<uint64_t>(*p - '0');
+            if (uval > max10 || (uval == max10 && digit > maxlast))
+                return bt_errc::integer_overflow;
+            uval = uval * 10 + digit;
         }
-        if (!once)
-            throw bt_deserialize_invalid{"Expected 0-9 was not found"};
-        return uval;
+
+        s.remove_prefix(static_cast<size_t>(p - begin));
+        if (p == begin)
+            return s.empty() ? bt_errc::unexpected_end : bt_errc::invalid_value;
+        val = uval;
+        return bt_errc::ok;
     }
 
-    inline void bt_deserialize<std::string_view>::operator()(
+    inline bt_errc bt_deserialize<std::string_view>::operator()(
             std::string_view& s, std::string_view& val) {
-        if (s.size() < 2)
-            throw bt_deserialize_invalid{
-                    "Deserialize failed: given data is not an bt-encoded string"};
+        if (s.empty())
+            return bt_errc::unexpected_end;
         if (s[0] < '0' || s[0] > '9')
-            throw bt_deserialize_invalid_type{"Expected 0-9 but found '"s + s[0] + "'"};
-        auto len = static_cast<size_t>(extract_unsigned(s));
-        if (s.empty() || s[0] != ':')
-            throw bt_deserialize_invalid{"Did not find expected ':' during string deserialization"};
+            return bt_errc::wrong_type;
+        auto orig = s;
+        uint64_t len;
+        if (auto ec = extract_unsigned(s, len); ec != bt_errc::ok)
+            return ec;
+        if (s.empty())
+            return bt_errc::unexpected_end;
+        if (s[0] != ':')
+            return bt_errc::invalid_value;
         s.remove_prefix(1);
 
-        if (len > s.size())
-            throw bt_deserialize_invalid{
-                    "String deserialization failed: encoded string length is longer than the "
-                    "serialized data"};
+        if (len > s.size()) {
+            s = orig;
+            return bt_errc::string_length;
+        }
 
-        val = {s.data(), len};
-        s.remove_prefix(len);
+        val = {s.data(), static_cast<size_t>(len)};
+        s.remove_prefix(static_cast<size_t>(len));
+        return bt_errc::ok;
     }
 
     // Check that we are on a 2's complement architecture.  It's highly unlikely that this code
@@ -1440,94 +2629,360 @@ namespace detail {
                             (uint64_t{1} << 63),
             "Non 2s-complement architecture not supported!");
 
-    inline std::pair<some64, bool> bt_deserialize_integer(std::string_view& s) {
+    inline bt_errc bt_deserialize_integer(std::string_view& s, std::pair<some64, bool>& result) {
+        if (s.empty())
+            return bt_errc::unexpected_end;
+        if (s[0] != 'i')
+            return bt_errc::wrong_type;
         // Smallest possible encoded integer is 3 chars: "i0e"
         if (s.size() < 3)
-            throw bt_deserialize_invalid(
-                    "Deserialization failed: end of string found where integer expected");
-        if (s[0] != 'i')
-            throw bt_deserialize_invalid_type(
-                    "Deserialization failed: expected 'i', found '"s + s[0] + '\'');
+            return bt_errc::unexpected_end;
+        auto orig = s;
         s.remove_prefix(1);
-        std::pair<some64, bool> result;
         auto& [val, negative] = result;
         if (s[0] == '-') {
             negative = true;
             s.remove_prefix(1);
-            val.u64 = extract_unsigned(s);
-            if (val.u64 > (uint64_t{1} << 63))
-                throw bt_deserialize_invalid(
-                        "Deserialization of integer failed: negative integer value is too "
-                        "large "
-                        "for a 64-bit signed int");
+            if (auto ec = extract_unsigned(s, val.u64); ec != bt_errc::ok)
+                return ec;
+            if (val.u64 > (uint64_t{1} << 63)) {
+                s = orig;
+                return bt_errc::integer_overflow;
+            }
             val.i64 = -static_cast<int64_t>(val.u64);
         } else {
-            val.u64 = extract_unsigned(s);
+            negative = false;
+            if (auto ec = extract_unsigned(s, val.u64); ec != bt_errc::ok)
+                return ec;
         }
 
         if (s.empty())
-            throw bt_deserialize_invalid(
-                    "Integer deserialization failed: encountered end of string before integer "
-                    "was "
-                    "finished");
+            return bt_errc::unexpected_end;
         if (s[0] != 'e')
-            throw bt_deserialize_invalid(
-                    "Integer deserialization failed: expected digit or 'e', found '"s + s[0] +
-                    '\'');
+            return bt_errc::invalid_value;
         s.remove_prefix(1);
 
-        return result;
+        return bt_errc::ok;
     }
 
     template struct bt_deserialize<int64_t>;
     template struct bt_deserialize<uint64_t>;
 
-    inline void bt_deserialize<bt_value>::operator()(std::string_view& s, bt_value& val) {
-        if (s.size() < 2)
-            throw bt_deserialize_invalid(
-                    "Deserialization failed: end of string found where bt-encoded value "
-                    "expected");
-
-        switch (s[0]) {
-            case 'd': {
-                bt_dict dict;
-                bt_deserialize<bt_dict>{}(s, dict);
-                val = std::move(dict);
-                break;
+#ifdef OXENC_BT_SSE2
+    /// Parses the `len` (1 to 16) ASCII digits ending just before `e` into `val`, returning false
+    /// if any of them is not a digit.  The 16 bytes before `e` must be readable: this loads them
+    /// all, and masks off the ones before the digits.
+    inline bool bt_parse_digits_before(const char* e, size_t len, uint64_t& val) {
+        const __m128i zero = _mm_setzero_si128();
+        __m128i digits = _mm_sub_epi8(
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(e - 16)), _mm_set1_epi8('0'));
+        const __m128i index = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+        __m128i keep = _mm_cmpgt_epi8(index, _mm_set1_epi8(static_cast<char>(15 - len)));
+        // Non-digits are those above 9 after subtracting '0' (as unsigned bytes)
+        __m128i bad = _mm_and_si128(keep, _mm_subs_epu8(digits, _mm_set1_epi8(9)));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(bad, zero)) != 0xFFFF)
+            return false;
+        digits = _mm_and_si128(digits, keep);
+        // Combine adjacent digits into 2-, then 4-, then 8-digit values
+        const __m128i m10 = _mm_setr_epi16(10, 1, 10, 1, 10, 1, 10, 1);
+        __m128i pairs = _mm_packs_epi32(
+                _mm_madd_epi16(_mm_unpacklo_epi8(digits, zero), m10),
+                _mm_madd_epi16(_mm_unpackhi_epi8(digits, zero), m10));
+        __m128i quads = _mm_madd_epi16(pairs, _mm_setr_epi16(100, 1, 100, 1, 100, 1, 100, 1));
+        __m128i octs = _mm_madd_epi16(
+                _mm_packs_epi32(quads, quads),
+                _mm_setr_epi16(10000, 1, 10000, 1, 10000, 1, 10000, 1));
+        val = static_cast<uint32_t>(_mm_cvtsi128_si32(octs)) * uint64_t{100000000} +
+              static_cast<uint32_t>(_mm_cvtsi128_si32(_mm_srli_si128(octs, 4)));
+        return true;
+    }
+
+    /// Decodes a list of integers into a vector a block of elements at a time.  For each block, a
+    /// scan of 16 bytes at a time finds the `e` delimiters ending the next (up to) 64 elements.
+    /// The elements are then parsed independently of each other, since the delimiters give each
+    /// one's position and number of digits up front: up to 16 digits are checked and converted at
+    /// once, while longer elements, and those too close to either end of the input, use the
+    /// general integer parser.  Because an element's position doesn't depend on parsing the
+    /// previous one, the CPU can overlap the parsing of consecutive elements.  The vector grows a
+    /// whole block at a time, and rather than checking each value against the range of `T`, this
+    /// tracks the smallest and largest values and checks those once at the end.
+    template <std::integral T, typename Alloc>
+    bool bt_deserialize_int_list(std::string_view& s, std::vector<T, Alloc>& out) {
+        if (s.size() < 2 || s[0] != 'l')
+            return false;
+        constexpr size_t block = 64;
+
+        const char* p = s.data() + 1;  // Start of the next element
+        const char* const end = s.data() + s.size();
+        uint64_t hi = 0;   // Largest non-negative value
+        int64_t lo = 0;    // Smallest negative value
+        bool neg = false;  // Whether there are any negative values (including "-0")
+        out.clear();
+        const char* ends[block + 16];
+        const __m128i e = _mm_set1_epi8('e'), one = _mm_set1_epi8(1);
+        for (;;) {
+            // Find the delimiters of the next block of elements.  This is branch-free for chunks
+            // with up to two delimiters (which, as the shortest element is 3 bytes, is nearly all
+            // of them): the first two delimiter positions are always stored (the bit set past the
+            // chunk's 16 keeps missing ones in bounds), and only the count of those that actually
+            // exist is added.  (The count uses psadbw, as std::popcount without -mpopcnt is many
+            // times slower).
+            size_t n = 0;
+            for (const char* q = p; n < block && end - q >= 16; q += 16) {
+                __m128i eq =
+                        _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(q)), e);
+                __m128i sums = _mm_sad_epu8(_mm_and_si128(eq, one), _mm_setzero_si128());
+                auto count = static_cast<size_t>(
+                        _mm_cvtsi128_si32(_mm_add_epi32(sums, _mm_srli_si128(sums, 8))));
+                auto found = static_cast<uint32_t>(_mm_movemask_epi8(eq)) | 0x10000;
+                ends[n] = q + std::countr_zero(found);
+                found &= found - 1;
+                ends[n + 1] = q + std::countr_zero(found);
+                for (size_t i = n + 2; i < n + count; i++) {
+                    found &= found - 1;
+                    ends[i] = q + std::countr_zero(found);
+                }
+                n += count;
             }
-            case 'l': {
-                bt_list list;
-                bt_deserialize<bt_list>{}(s, list);
-                val = std::move(list);
+            n = std::min(n, block);
+
+            // Parse them.  The common case -- an element of up to 16 digits, with 16 bytes
+            // before its delimiter -- is handled without branches beyond the validity checks;
+            // anything else is parsed with the general parser, as are elements near the end of
+            // the input (where there are no more delimiters to find), one at a time.
+            const size_t first = out.size();
+            const size_t want = std::max<size_t>(n, 1);
+            out.resize(first + want);
+            T* const dest = out.data() + first;
+            const char* const fast_from = s.data() + 16;
+            size_t k = 0;
+            for (;; k++) {
+                for (; k < n && ends[k] >= fast_from; k++) {
+                    if (*p != 'i')
+                        break;
+                    bool negative = p[1] == '-';
+                    const char* d = p + 1 + negative;
+                    auto len = static_cast<size_t>(ends[k] - d);
+                    uint64_t mag;
+                    if (len - 1 >= 16 || !bt_parse_digits_before(ends[k], len, mag))
+                        break;
+                    p = ends[k] + 1;
+                    auto v = negative ? uint64_t{0} - mag : mag;
+                    neg |= negative;
+                    hi = std::max(hi, negative ? uint64_t{0} : mag);
+                    lo = std::min(lo, negative ? static_cast<int64_t>(v) : int64_t{0});
+                    dest[k] = static_cast<T>(v);
+                }
+                if (k == want)
+                    break;
+                if (p == end)
+                    return false;
+                if (*p == 'e')
+                    break;  // End of the list
+                std::string_view r{p, static_cast<size_t>(end - p)};
+                std::pair<some64, bool> result;
+                if (*p != 'i' || bt_deserialize_integer(r, result) != bt_errc::ok)
+                    return false;
+                p = r.data();
+                auto [v, negative] = result;
+                if (negative) {
+                    neg = true;
+                    lo = std::min(lo, v.i64);
+                    dest[k] = static_cast<T>(v.i64);
+                } else {
+                    hi = std::max(hi, v.u64);
+                    dest[k] = static_cast<T>(v.u64);
+                }
+            }
+            if (k < want) {
+                out.resize(first + k);
                 break;
             }
-            case 'i': {
-                auto [v, negative] = bt_deserialize_integer(s);
-                if (negative)
-                    val = v.i64;
-                else
-                    val = v.u64;
+        }
+        // p is at the list's `e`
+        constexpr auto tmax = static_cast<uint64_t>(std::numeric_limits<T>::max());
+        constexpr auto tmin = static_cast<int64_t>(std::numeric_limits<T>::min());
+        if (hi > tmax || (std::signed_integral<T> ? lo < tmin : neg))
+            return false;
+        s.remove_prefix(static_cast<size_t>(p + 1 - s.data()));
+        return true;
+    }
+#endif
+
+    inline size_t bt_count_elements(std::string_view s, bool dict) {
+        size_t n = 0;  // Keys and values both count for dicts
+        while (!s.empty() && s[0] != 'e') {
+            if (s[0] == 'i') {
+                auto end = s.find('e', 1);
+                if (end == std::string_view::npos)
+                    return 0;
+                s.remove_prefix(end + 1);
+            } else if (s[0] >= '0' && s[0] <= '9') {
+                // (Length prefixes are short, so this is quicker than extract_unsigned)
+                uint64_t len = 0;
+                size_t i = 0;
+                for (; i < s.size() && i < 19 && s[i] >= '0' && s[i] <= '9'; i++)
+                    len = len * 10 + static_cast<uint64_t>(s[i] - '0');
+                if (i == s.size() || s[i] != ':' || len >= s.size() - i)
+                    return 0;
+                s.remove_prefix(i + 1 + static_cast<size_t>(len));
+            } else if (bt_skip_value(s) != bt_errc::ok) {
+                return 0;
+            }
+            n++;
+        }
+        if (s.empty())
+            return 0;
+        return dict ? n / 2 : n;
+    }
+
+    inline bt_errc bt_skip_value(std::string_view& s, size_t max_depth) {
+        // One bit per open container, set for dicts
+        uint64_t dicts[bt_max_skip_depth / 64];
+        max_depth = std::min(max_depth, bt_max_skip_depth);
+        size_t depth = 0;
+
+        for (;;) {
+            if (s.empty())
+                return bt_errc::unexpected_end;
+            switch (s[0]) {
+                case 'i': {
+                    std::pair<some64, bool> ignored;
+                    if (auto ec = bt_deserialize_integer(s, ignored); ec != bt_errc::ok)
+                        return ec;
+                    break;
+                }
+                case 'l':
+                case 'd': {
+                    if (depth >= max_depth)
+                        return bt_errc::depth_limit;
+                    auto& word = dicts[depth / 64];
+                    auto bit = uint64_t{1} << (depth % 64);
+                    word = s[0] == 'd' ? word | bit : word & ~bit;
+                    depth++;
+                    s.remove_prefix(1);  // Descend into the list/dict, consume the "l"/"d"
+                    break;
+                }
+                default: {
+                    if (s[0] < '0' || s[0] > '9')
+                        return bt_errc::wrong_type;
+                    std::string_view ignored;
+                    if (auto ec = bt_deserialize<std::string_view>{}(s, ignored); ec != bt_errc::ok)
+                        return ec;
+                }
+            }
+
+            // Back out of any finished lists/dicts, and read the key if the next value is in a dict
+            for (;;) {
+                if (depth == 0)
+                    return bt_errc::ok;
+                if (s.empty())
+                    return bt_errc::unexpected_end;
+                if (s[0] == 'e') {
+                    s.remove_prefix(1);
+                    depth--;
+                    continue;
+                }
+                if (dicts[(depth - 1) / 64] >> ((depth - 1) % 64) & 1) {
+                    std::string_view key;  // Key is always a string
+                    if (auto ec = bt_deserialize<std::string_view>{}(s, key); ec != bt_errc::ok)
+                        return ec;
+                    if (!s.empty() && s[0] == 'e')
+                        return bt_errc::invalid_value;  // key isn't followed by a value
+                }
                 break;
             }
-            case '0':
-            case '1':
-            case '2':
-            case '3':
-            case '4':
-            case '5':
-            case '6':
-            case '7':
-            case '8':
-            case '9': {
-                std::string str;
-                bt_deserialize<std::string>{}(s, str);
-                val = std::move(str);
+        }
+    }
+
+    inline bt_errc bt_deserialize<bt_value>::operator()(std::string_view& s, bt_value& val) {
+        // The lists/dicts currently being filled, innermost last.  Exactly one pointer is set.
+        struct open_container {
+            bt_list* list;
+            bt_dict* dict;
+        };
+        std::vector<open_container> stack;
+        // Values of duplicate dict keys still have to be decoded (and validated), but are dropped;
+        // this holds them until we are done.
+        std::list<bt_value> dropped;
+
+        bt_value* slot = &val;
+        for (;;) {
+            if (s.empty())
+                return bt_errc::unexpected_end;
+
+            switch (s[0]) {
+                case 'd':
+                case 'l':
+                    if (stack.size() >= max_depth)
+                        return bt_errc::depth_limit;
+                    if (stack.empty())
+                        stack.reserve(8);
+                    if (s[0] == 'l')
+                        stack.push_back({&slot->emplace<bt_list>(), nullptr});
+                    else
+                        stack.push_back({nullptr, &slot->emplace<bt_dict>()});
+                    s.remove_prefix(1);
+                    break;
+                case 'i': {
+                    std::pair<some64, bool> result;
+                    if (auto ec = bt_deserialize_integer(s, result); ec != bt_errc::ok)
+                        return ec;
+                    auto [v, negative] = result;
+                    if (negative)
+                        *slot = v.i64;
+                    else
+                        *slot = v.u64;
+                    break;
+                }
+                case '0':
+                case '1':
+                case '2':
+                case '3':
+                case '4':
+                case '5':
+                case '6':
+                case '7':
+                case '8':
+                case '9': {
+                    std::string_view str;
+                    if (auto ec = bt_deserialize<std::string_view>{}(s, str); ec != bt_errc::ok)
+                        return ec;
+                    slot->emplace<std::string>(str);
+                    break;
+                }
+                default: return bt_errc::invalid_value;
+            }
+
+            // Close any finished lists/dicts, then find where the next value goes
+            for (;;) {
+                if (stack.empty())
+                    return bt_errc::ok;
+                if (s.empty())
+                    return bt_errc::unexpected_end;
+                if (s[0] == 'e') {
+                    s.remove_prefix(1);
+                    stack.pop_back();
+                    continue;
+                }
+                auto& top = stack.back();
+                if (top.list) {
+                    slot = &top.list->emplace_back();
+                } else {
+                    std::string key;
+                    if (auto ec = bt_deserialize<std::string>{}(s, key); ec != bt_errc::ok)
+                        return ec;
+                    auto& dict = *top.dict;
+                    if (dict.empty() || dict.rbegin()->first < key) {
+                        slot = &dict.emplace_hint(dict.end(), std::move(key), bt_value{})->second;
+                    } else if (auto [it, ins] = dict.try_emplace(std::move(key)); ins) {
+                        slot = &it->second;
+                    } else {
+                        slot = &dropped.emplace_back();  // Duplicate: the first value wins
+                    }
+                }
                 break;
             }
-            default:
-                throw bt_deserialize_invalid(
-                        "Deserialize failed: encountered invalid value '"s + s[0] +
-                        "'; expected one of [0-9idl]");
         }
     }
 
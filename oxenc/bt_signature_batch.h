@@ -0,0 +1,126 @@
+#pragma once
+
+#include <concepts>
+#include <cstddef>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include "bt_serialize.h"
+
+namespace oxenc {
+
+/// Collects signed messages and their signatures from consumers for deferred, bulk verification
+/// (e.g. with a batch signature verification function, which is typically much cheaper per
+/// signature than verifying each one individually).
+///
+/// Signatures are added by passing the batch to a consumer's `consume_signature` or
+/// `require_signature` instead of a verification function: the consumer extracts the signed
+/// message and signature exactly as it would for immediate verification, but instead of verifying
+/// them it adds them to the batch and returns a ticket.  Once the batch has been verified,
+/// `valid(ticket)` says whether that signature was good; until then, and if the batch verification
+/// fails, it is false.  Anything consumed from a message must therefore be treated as unverified
+/// (and discarded if its ticket turns out invalid) until the batch has been verified:
+///
+///     bt_signature_batch<unsigned char> batch;
+///     for (auto& msg : messages) {
+///         bt_dict_consumer d{msg};
+///         auto& p = pending.emplace_back(parse_fields(d));
+///         p.ticket = d.require_signature("~", batch);
+///     }
+///     batch.verify(
+///             [](std::span<const bt_signature_batch<unsigned char>::entry> entries) {
+///                 return ed25519_verify_batch(entries);
+///             },
+///             [](auto msg, auto sig) { return ed25519_verify(msg, sig); });
+///     for (auto& p : pending)
+///         if (batch.valid(p.ticket))
+///             accept(p);
+///
+/// The batch stores views into the consumed data, which must therefore remain valid until the
+/// batch has been verified.
+template <basic_char Char>
+class bt_signature_batch {
+  public:
+    using view_type = std::basic_string_view<Char>;
+
+    /// A signed message and its signature.
+    struct entry {
+        view_type message;
+        view_type signature;
+    };
+
+    /// Adds a message and signature to be verified; returns its ticket for `valid()`.  Consumers
+    /// call this from `consume_signature`/`require_signature`, but it can also be called directly.
+    size_t add(view_type message, view_type signature) {
+        entries_.push_back({message, signature});
+        return entries_.size() - 1;
+    }
+
+    /// Returns the number of signatures added to the batch.
+    size_t size() const { return entries_.size(); }
+    /// Returns true if no signatures have been added.
+    bool empty() const { return entries_.empty(); }
+    /// Returns the number of signatures that have not yet been verified.
+    size_t pending() const { return entries_.size() - results_.size(); }
+
+    /// Returns all messages and signatures added to the batch, indexed by ticket.
+    const std::vector<entry>& entries() const { return entries_; }
+
+    /// Verifies all pending signatures by calling `batch_verify(std::span<const entry>)`, which
+    /// must return true only if every signature in the span is valid.  If it returns false, all of
+    /// the pending signatures are considered invalid.  Returns the result of `batch_verify`.
+    ///
+    /// If `batch_verify` throws the exception is propagated and the signatures remain pending.
+    template <std::predicate<std::span<const entry>> BatchVerify>
+    bool verify(BatchVerify&& batch_verify) {
+        std::span<const entry> todo{entries_.data() + results_.size(), pending()};
+        bool good = todo.empty() || batch_verify(todo);
+        results_.resize(entries_.size(), good);
+        return good;
+    }
+
+    /// Verifies all pending signatures with `batch_verify` as above, but if the batch fails then
+    /// also verifies each pending signature individually by calling `verify_one(message,
+    /// signature)`, so that only the actually bad signatures are considered invalid.  Returns true
+    /// if all of the pending signatures are valid.  (If `verify_one` throws, the signatures it has
+    /// not yet verified are left invalid).
+    template <
+            std::predicate<std::span<const entry>> BatchVerify,
+            std::predicate<view_type, view_type> VerifyOne>
+    bool verify(BatchVerify&& batch_verify, VerifyOne&& verify_one) {
+        const size_t first = results_.size();
+        if (verify(batch_verify))
+            return true;
+        bool all = true;
+        for (size_t i = first; i < results_.size(); i++)
+            all &= results_[i] = verify_one(entries_[i].message, entries_[i].signature);
+        return all;
+    }
+
+    /// Returns true if the signature with the given ticket has been verified and is valid.
+    bool valid(size_t ticket) const { return ticket < results_.size() && results_[ticket]; }
+
+    /// Returns true if every signature in the batch has been verified and is valid.
+    bool all_valid() const {
+        if (pending())
+            return false;
+        for (bool r : results_)
+            if (!r)
+                return false;
+        return true;
+    }
+
+    /// Removes all signatures (verified or not) from the batch.  Previously issued tickets become
+    /// invalid.
+    void clear() {
+        entries_.clear();
+        results_.clear();
+    }
+
+  private:
+    std::vector<entry> entries_;
+    std::vector<bool> results_;  // Verification results of the first results_.size() entries
+};
+
+}  // namespace oxenc
@@ -0,0 +1,620 @@
+#pragma once
+
+#include <algorithm>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <istream>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#ifndef _WIN32
+#include <unistd.h>
+
+#include <cerrno>
+#include <system_error>
+#endif
+
+#include "bt_serialize.h"
+
+namespace oxenc {
+
+class bt_stream_list_consumer;
+class bt_stream_dict_consumer;
+
+/// Default size of the read window of a bt_stream_reader.
+inline constexpr size_t bt_stream_default_window = 64 * 1024;
+
+/// Sequential reader of bt-encoded data from a std::istream, a file descriptor, or any other
+/// source of bytes, for input that is too large (or arrives too slowly) to be loaded in full, such
+/// as bt-encoded logs and archives.  The reader keeps only a fixed-size window of the input, which
+/// is refilled from the source as parsing advances, so memory use is bounded by the window size
+/// plus a few bytes per level of list/dict nesting no matter how large the input is.
+///
+/// The data is accessed through bt_stream_list_consumer and bt_stream_dict_consumer objects
+/// obtained from the reader, which provide the same interface as bt_list_consumer and
+/// bt_dict_consumer.  Because the input can only be read forwards, there are two differences:
+///
+/// - Strings that fit in the window can be consumed as views into it, which are only valid until
+///   the next call on the reader or any of its consumers.  Strings of any size can be consumed as
+///   a std::string, or delivered piece by piece to a callback with `consume_string_chunks()`
+///   without ever being held in memory at once; a string longer than the window can only be read
+///   in those ways, and a dict key must always fit in the window.
+/// - Consuming a list or dict value gives a consumer that reads directly from the stream, and
+///   which must be used before continuing with its parent: using the parent first skips whatever
+///   is left of the child, after which the child may no longer be used.
+///
+/// The input may be a sequence of top-level values (e.g. log records) which are read one after
+/// another; `at_end()` returns true once all of them have been read:
+///
+///     std::ifstream log{"events.bt", std::ios::binary};
+///     bt_stream_reader reader{log};
+///     while (!reader.at_end()) {
+///         auto d = reader.dict_consumer();
+///         auto time = d.require<int64_t>("t");
+///         d.required("payload");
+///         d.consume_string_chunks([&](std::string_view chunk) { out.write(chunk); });
+///     }
+///
+/// Errors in the data throw the same exceptions as the contiguous consumers, with offsets
+/// relative to the beginning of the stream.  The reader refers to its consumers' state and the
+/// source (which it does not own), and so is neither copyable nor movable.
+///
+/// This header (with the iostream and system headers it needs) is not included from bt.h: include
+/// oxenc/bt_stream.h directly.
+class bt_stream_reader {
+  public:
+    /// Reads from an input stream.  Throws std::ios_base::failure if reading fails other than at
+    /// the end of the stream.
+    explicit bt_stream_reader(std::istream& in, size_t window = bt_stream_default_window) :
+            bt_stream_reader{
+                    [&in](char* buf, size_t n) -> size_t {
+                        in.read(buf, static_cast<std::streamsize>(n));
+                        if (in.bad())
+                            throw std::ios_base::failure{"Failed to read bt-encoded stream"};
+                        return static_cast<size_t>(in.gcount());
+                    },
+                    window} {}
+
+    /// Reads from a custom source: `read(char* buf, size_t n)` must read up to `n` bytes into
+    /// `buf`, returning the number of bytes read, which must be 0 only at the end of the input.
+    template <typename Read>
+    requires std::is_invocable_r_v<size_t, Read&, char*, size_t>
+    explicit bt_stream_reader(Read read, size_t window = bt_stream_default_window) :
+            read_{std::move(read)},
+            cap_{std::max<size_t>(window, 64)},
+            buf_{std::make_unique<char[]>(cap_)} {}
+
+#ifndef _WIN32
+    /// Returns a reader for an open file descriptor (which is not closed by the reader).  Throws
+    /// std::system_error if reading fails.
+    static bt_stream_reader from_fd(int fd, size_t window = bt_stream_default_window) {
+        return bt_stream_reader{
+                [fd](char* buf, size_t n) -> size_t {
+                    ssize_t r;
+                    while ((r = ::read(fd, buf, n)) < 0 && errno == EINTR) {}
+                    if (r < 0)
+                        throw std::system_error{
+                                errno, std::generic_category(), "Failed to read bt-encoded fd"};
+                    return static_cast<size_t>(r);
+                },
+                window};
+    }
+#endif
+
+    bt_stream_reader(const bt_stream_reader&) = delete;
+    bt_stream_reader& operator=(const bt_stream_reader&) = delete;
+
+    /// Skips anything left of the current top-level value and returns true if there are no more
+    /// values in the input.
+    bool at_end() {
+        close_to(0);
+        return !fill(1);
+    }
+
+    /// Skips anything left of the current top-level value and begins reading the next one, which
+    /// must be a list.  Throws std::runtime_error if it is not (or if there is no more input).
+    inline bt_stream_list_consumer list_consumer();
+
+    /// Same as list_consumer(), but for a dict.
+    inline bt_stream_dict_consumer dict_consumer();
+
+    /// Skips the next top-level value.
+    void skip_value() {
+        close_to(0);
+        skip();
+    }
+
+    /// Returns the offset in the stream of the next unread byte.
+    size_t offset() const { return offset_; }
+
+  private:
+    friend class bt_stream_list_consumer;
+    friend class bt_stream_dict_consumer;
+
+    std::function<size_t(char*, size_t)> read_;
+    size_t cap_;
+    std::unique_ptr<char[]> buf_;
+    size_t pos_ = 0;  // Position of the next unread byte in buf_
+    size_t end_ = 0;  // End of the data in buf_
+    size_t offset_ = 0;  // Stream offset of buf_[pos_]
+    bool eof_ = false;
+    uint64_t next_id_ = 0;
+    std::vector<uint64_t> open_;  // Ids of the open lists/dicts, outermost first
+
+    size_t available() const { return end_ - pos_; }
+    std::string_view window() const { return {buf_.get() + pos_, available()}; }
+
+    // Makes at least `n` (<= cap_) bytes available, if the input has that many; returns false if
+    // it doesn't.
+    bool fill(size_t n) {
+        if (available() >= n)
+            return true;
+        if (cap_ - pos_ < n) {
+            std::memmove(buf_.get(), buf_.get() + pos_, available());
+            end_ -= pos_;
+            pos_ = 0;
+        }
+        while (available() < n && !eof_) {
+            size_t r = read_(buf_.get() + end_, cap_ - end_);
+            eof_ = r == 0;
+            end_ += r;
+        }
+        return available() >= n;
+    }
+
+    void consume(size_t n) {
+        pos_ += n;
+        offset_ += n;
+    }
+
+    [[noreturn]] void fail(bt_errc ec, size_t at_offset) const {
+        detail::throw_bt_error({ec, at_offset});
+    }
+    [[noreturn]] void fail(bt_errc ec) const { fail(ec, offset_); }
+
+    char peek() {
+        if (!fill(1))
+            fail(bt_errc::unexpected_end);
+        return buf_[pos_];
+    }
+    std::optional<char> peek(size_t i) {
+        if (!fill(i + 1))
+            return std::nullopt;
+        return buf_[pos_ + i];
+    }
+
+    // Parses a short token (integer or string length) with `parse(std::string_view&) -> bt_errc`.
+    // Tokens of canonical encodings are at most 22 bytes, so making 64 available always suffices.
+    template <typename Parse>
+    void token(Parse&& parse) {
+        fill(64);
+        std::string_view s = window();
+        if (auto ec = parse(s); ec != bt_errc::ok)
+            fail(ec, offset_ + static_cast<size_t>(s.data() - window().data()));
+        consume(static_cast<size_t>(s.data() - window().data()));
+    }
+
+    template <std::integral IntType>
+    IntType consume_int() {
+        if (peek() != 'i')
+            fail(bt_errc::wrong_type);
+        IntType val;
+        token([&val](std::string_view& s) { return detail::bt_deserialize<IntType>{}(s, val); });
+        return val;
+    }
+
+    // Reads a string length prefix, returning the length.
+    size_t string_length() {
+        char c = peek();
+        if (c < '0' || c > '9')
+            fail(bt_errc::wrong_type);
+        uint64_t len;
+        token([&len](std::string_view& s) {
+            if (auto ec = detail::extract_unsigned(s, len); ec != bt_errc::ok)
+                return ec;
+            if (s.empty())
+                return bt_errc::unexpected_end;
+            if (s[0] != ':')
+                return bt_errc::invalid_value;
+            s.remove_prefix(1);
+            return bt_errc::ok;
+        });
+        if (len > std::numeric_limits<size_t>::max())
+            fail(bt_errc::string_length);
+        return static_cast<size_t>(len);
+    }
+
+    // Reads a string which must fit in the window, returning a view of it in the window.
+    std::string_view string_view() {
+        size_t start = offset_;
+        size_t len = string_length();
+        if (len > cap_)
+            fail(bt_errc::string_limit, start);
+        if (!fill(len))
+            fail(bt_errc::string_length, start);
+        std::string_view s{buf_.get() + pos_, len};
+        consume(len);
+        return s;
+    }
+
+    // Reads a string of any length, passing it in pieces to `f(std::string_view)`; returns the
+    // string length.
+    template <typename F>
+    size_t string_chunks(F&& f) {
+        size_t start = offset_;
+        size_t len = string_length();
+        for (size_t left = len; left > 0;) {
+            if (!fill(1))
+                fail(bt_errc::string_length, start);
+            size_t n = std::min(left, available());
+            std::string_view piece{buf_.get() + pos_, n};
+            consume(n);
+            left -= n;
+            f(piece);
+        }
+        return len;
+    }
+
+    // Skips one complete value.
+    void skip() {
+        const size_t max_depth = bt_default_max_depth;
+        uint64_t dicts[bt_default_max_depth / 64];
+        size_t depth = 0;
+        bool want_key = false;
+        auto in_dict = [&] { return dicts[(depth - 1) / 64] >> ((depth - 1) % 64) & 1; };
+        auto discard = [](std::string_view) {};
+        do {
+            char c = peek();
+            if (depth > 0 && c == 'e') {
+                if (!want_key && in_dict())
+                    fail(bt_errc::invalid_value);  // key without a value
+                consume(1);
+                --depth;
+                want_key = depth > 0 && in_dict();
+                continue;
+            }
+            if (want_key) {
+                string_chunks(discard);
+                want_key = false;
+                continue;
+            }
+            if (c == 'l' || c == 'd') {
+                if (depth >= max_depth)
+                    fail(bt_errc::depth_limit);
+                auto& word = dicts[depth / 64];
+                auto bit = uint64_t{1} << (depth % 64);
+                word = c == 'd' ? word | bit : word & ~bit;
+                ++depth;
+                want_key = c == 'd';
+                consume(1);
+                continue;
+            }
+            if (c == 'i')
+                token([](std::string_view& s) {
+                    std::pair<detail::some64, bool> ignored;
+                    return detail::bt_deserialize_integer(s, ignored);
+                });
+            else if (c >= '0' && c <= '9')
+                string_chunks(discard);
+            else
+                fail(bt_errc::invalid_value);
+            want_key = depth > 0 && in_dict();
+        } while (depth > 0);
+    }
+
+    // Begins a list or dict, returning its id.
+    uint64_t open(char type) {
+        if (peek() != type)
+            fail(bt_errc::wrong_type);
+        consume(1);
+        open_.push_back(next_id_);
+        return next_id_++;
+    }
+
+    // Skips the rest of any open lists/dicts nested more than `depth` deep.
+    void close_to(size_t depth) {
+        while (open_.size() > depth) {
+            while (peek() != 'e')
+                skip();
+            consume(1);
+            open_.pop_back();
+        }
+    }
+
+    // Called before each operation of a consumer of the list/dict `id` at `depth`: finishes any
+    // nested consumers, and checks that the consumer is still current.
+    void sync(size_t depth, uint64_t id) {
+        if (open_.size() < depth || open_[depth - 1] != id)
+            throw std::logic_error{"bt stream consumer used after it was finished or skipped"};
+        close_to(depth);
+    }
+
+    // Finishes the list/dict at `depth`, which must be the innermost open one.
+    void close() {
+        while (peek() != 'e')
+            skip();
+        consume(1);
+        open_.pop_back();
+    }
+};
+
+/// Consumer for a list being read from a bt_stream_reader; see bt_stream_reader for details.
+/// This is a lightweight handle referring to the reader, which must outlive it.
+class bt_stream_list_consumer {
+  protected:
+    bt_stream_reader* r_;
+    uint64_t id_;
+    size_t depth_;
+
+    friend class bt_stream_reader;
+    friend class bt_stream_dict_consumer;
+
+    bt_stream_list_consumer(bt_stream_reader& r, char type) :
+            r_{&r}, id_{r.open(type)}, depth_{r.open_.size()} {}
+
+    bt_stream_reader& reader() const {
+        r_->sync(depth_, id_);
+        return *r_;
+    }
+
+    char peek_value() const { return reader().peek(); }
+
+  public:
+    /// Returns true if the next value indicates the end of the list
+    bool is_finished() const { return peek_value() == 'e'; }
+    /// Returns true if the next element looks like an encoded string
+    bool is_string() const {
+        char c = peek_value();
+        return c >= '0' && c <= '9';
+    }
+    /// Returns true if the next element looks like an encoded integer
+    bool is_integer() const { return peek_value() == 'i'; }
+    /// Returns true if the next element looks like an encoded negative integer
+    bool is_negative_integer() const { return is_integer() && r_->peek(1) == '-'; }
+    /// Returns true if the next element looks like an encoded non-negative integer
+    bool is_unsigned_integer() const {
+        if (!is_integer())
+            return false;
+        auto c = r_->peek(1);
+        return c && *c >= '0' && *c <= '9';
+    }
+    /// Returns true if the next element looks like an encoded list
+    bool is_list() const { return peek_value() == 'l'; }
+    /// Returns true if the next element looks like an encoded dict
+    bool is_dict() const { return peek_value() == 'd'; }
+
+    /// Consumes the next value as a string, returning a view into the reader's window which is
+    /// valid until the next call on the reader or any of its consumers.  Throws (with
+    /// bt_errc::string_limit) if the string is longer than the window.
+    std::string_view consume_string_view() { return reader().string_view(); }
+
+    /// Consumes the next value as a string, returning a copy.
+    std::string consume_string() {
+        std::string s;
+        reader().string_chunks([&s](std::string_view piece) { s += piece; });
+        return s;
+    }
+
+    /// Consumes the next value as a string of any length, passing it to `f(std::string_view)` in
+    /// one or more pieces (or none at all, for an empty string).  Returns the string length.
+    template <std::invocable<std::string_view> F>
+    size_t consume_string_chunks(F&& f) {
+        return reader().string_chunks(std::forward<F>(f));
+    }
+
+    /// Consumes the next value as an integer of the given type.
+    template <std::integral IntType>
+    IntType consume_integer() {
+        return reader().template consume_int<IntType>();
+    }
+
+    /// Consumes the next value as a list, returning a consumer for it.  The returned consumer
+    /// must be used before this one is used again.
+    bt_stream_list_consumer consume_list_consumer() { return {reader(), 'l'}; }
+
+    /// Consumes the next value as a dict, returning a consumer for it.  The returned consumer
+    /// must be used before this one is used again.
+    inline bt_stream_dict_consumer consume_dict_consumer();
+
+    /// Consumes the next value as the given type: an integral type, std::string, or
+    /// std::string_view (see consume_string_view()).
+    template <typename T>
+    T consume() {
+        if constexpr (std::integral<T>)
+            return consume_integer<T>();
+        else if constexpr (std::same_as<T, std::string_view>)
+            return consume_string_view();
+        else {
+            static_assert(std::same_as<T, std::string>, "Unsupported consume type");
+            return consume_string();
+        }
+    }
+
+    /// Consumes a value without returning it.
+    void skip_value() { reader().skip(); }
+
+    /// Reads through any remaining values to the end of the list.  The consumer may not be used
+    /// afterwards.
+    void finish() { reader().close(); }
+
+    /// Returns the offset in the stream of the next unread byte.
+    size_t offset() const { return r_->offset(); }
+};
+
+/// Consumer for a dict being read from a bt_stream_reader; see bt_stream_reader for details.  The
+/// current key is copied out of the reader's window, and so remains valid until the next key is
+/// read.
+class bt_stream_dict_consumer : private bt_stream_list_consumer {
+    friend class bt_stream_reader;
+    friend class bt_stream_list_consumer;
+
+    std::string key_;
+    bool have_key_ = false;
+
+    bt_stream_dict_consumer(bt_stream_reader& r, char type) : bt_stream_list_consumer{r, type} {}
+
+    // Reads the next key, if not already read; returns false at the end of the dict.
+    bool consume_key() {
+        if (have_key_)
+            return true;
+        auto& r = reader();
+        if (r.peek() == 'e')
+            return false;
+        key_ = r.string_view();
+        if (r.peek() == 'e')
+            r.fail(bt_errc::invalid_value);
+        have_key_ = true;
+        return true;
+    }
+
+    // Reads the key (throwing if at the end of the dict), then returns `f()`, which consumes the
+    // value.  The key is only used up once `f()` succeeds, so that after a failed (typed) consume
+    // the same key and value can still be read.
+    template <typename F>
+    decltype(auto) next(F&& f) {
+        if (!consume_key())
+            r_->fail(bt_errc::wrong_type);
+        if constexpr (std::is_void_v<decltype(f())>) {
+            f();
+            have_key_ = false;
+        } else {
+            decltype(auto) result = f();
+            have_key_ = false;
+            return result;
+        }
+    }
+
+  public:
+    using bt_stream_list_consumer::offset;
+
+    /// Returns true if the next value indicates the end of the dict
+    bool is_finished() { return !consume_key(); }
+    /// Returns true if the next value looks like an encoded string
+    bool is_string() { return consume_key() && bt_stream_list_consumer::is_string(); }
+    /// Returns true if the next value looks like an encoded integer
+    bool is_integer() { return consume_key() && bt_stream_list_consumer::is_integer(); }
+    /// Returns true if the next value looks like an encoded negative integer
+    bool is_negative_integer() {
+        return consume_key() && bt_stream_list_consumer::is_negative_integer();
+    }
+    /// Returns true if the next value looks like an encoded non-negative integer
+    bool is_unsigned_integer() {
+        return consume_key() && bt_stream_list_consumer::is_unsigned_integer();
+    }
+    /// Returns true if the next value looks like an encoded list
+    bool is_list() { return consume_key() && bt_stream_list_consumer::is_list(); }
+    /// Returns true if the next value looks like an encoded dict
+    bool is_dict() { return consume_key() && bt_stream_list_consumer::is_dict(); }
+
+    /// Returns the key of the next pair.
+    std::string_view key() {
+        if (!consume_key())
+            throw bt_deserialize_invalid{"Cannot access next key: at the end of the dict"};
+        return key_;
+    }
+
+    /// The consume_* methods consume the next key and its value; see bt_stream_list_consumer.
+    std::string_view consume_string_view() {
+        return next([this] { return bt_stream_list_consumer::consume_string_view(); });
+    }
+    std::string consume_string() {
+        return next([this] { return bt_stream_list_consumer::consume_string(); });
+    }
+    template <std::invocable<std::string_view> F>
+    size_t consume_string_chunks(F&& f) {
+        return next([&] { return bt_stream_list_consumer::consume_string_chunks(f); });
+    }
+    template <std::integral IntType>
+    IntType consume_integer() {
+        return next([this] { return bt_stream_list_consumer::consume_integer<IntType>(); });
+    }
+    bt_stream_list_consumer consume_list_consumer() {
+        return next([this] { return bt_stream_list_consumer::consume_list_consumer(); });
+    }
+    bt_stream_dict_consumer consume_dict_consumer() {
+        return next([this] { return bt_stream_list_consumer::consume_dict_consumer(); });
+    }
+
+    /// Consumes the next value as the given type; see bt_stream_list_consumer::consume().
+    template <typename T>
+    T consume() {
+        return next([this] { return bt_stream_list_consumer::consume<T>(); });
+    }
+
+    /// Consumes the next key-value pair without parsing the value.
+    void skip_value() {
+        next([this] { bt_stream_list_consumer::skip_value(); });
+    }
+
+    /// Skips ahead until we find the first key >= the given key or reach the end of the dict.
+    /// Returns true if we found an exact match, false if we reached some greater value or the
+    /// end.  As with bt_dict_consumer, this assumes the keys are sorted.
+    bool skip_until(std::string_view find) {
+        while (consume_key() && key_ < find)
+            skip_value();
+        return have_key_ && key_ == find;
+    }
+
+    /// Advances to the given key, throwing std::out_of_range if it does not exist.
+    void required(std::string_view find) {
+        if (!skip_until(find))
+            throw std::out_of_range{"Key " + std::string{find} + " not found!"};
+    }
+
+    /// Advances to and requires the given key, then consumes its value as a `T`.
+    template <typename T>
+    T require(std::string_view key) {
+        required(key);
+        return consume<T>();
+    }
+
+    /// Advances to the given key, returning std::nullopt if it does not exist and otherwise its
+    /// value as a `T`.
+    template <typename T>
+    std::optional<T> maybe(std::string_view key) {
+        if (!skip_until(key))
+            return std::nullopt;
+        return consume<T>();
+    }
+
+    /// Reads through any remaining keys and values to the end of the dict.  The consumer may not
+    /// be used afterwards.
+    void finish() {
+        while (consume_key())
+            skip_value();
+        bt_stream_list_consumer::finish();
+    }
+};
+
+inline bt_stream_dict_consumer bt_stream_list_consumer::consume_dict_consumer() {
+    return {reader(), 'd'};
+}
+
+inline bt_stream_list_consumer bt_stream_reader::list_consumer() {
+    close_to(0);
+    if (!fill(1))
+        throw std::runtime_error{"Cannot create a bt_list_consumer with no data"};
+    if (buf_[pos_] != 'l')
+        throw std::runtime_error{"Cannot create a bt_list_consumer with non-list data"};
+    return {*this, 'l'};
+}
+
+inline bt_stream_dict_consumer bt_stream_reader::dict_consumer() {
+    close_to(0);
+    if (!fill(1))
+        throw std::runtime_error{"Cannot create a bt_dict_consumer with no data"};
+    if (buf_[pos_] != 'd')
+        throw std::runtime_error{"Cannot create a bt_dict_consumer with non-dict data"};
+    return {*this, 'd'};
+}
+
+}  // namespace oxenc
@@ -0,0 +1,553 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "bt_producer.h"
+#include "bt_serialize.h"
+
+/** \file
+ * Declarative binding between C++ structs and bt-encoded dicts.  A struct is described by a
+ * `bt_fields` function, found via ADL, that returns a tuple of field descriptors mapping dict keys
+ * to data members:
+ *
+ *     namespace app {
+ *     struct Peer {
+ *         std::string pubkey;
+ *         std::optional<uint16_t> port;
+ *         std::vector<std::string> tags;
+ *         int version = 1;
+ *     };
+ *     constexpr auto bt_fields(std::type_identity<Peer>) {
+ *         using namespace oxenc;
+ *         return std::tuple<
+ *                 bt_field<"k", &Peer::pubkey>,
+ *                 bt_field<"p", &Peer::port>,
+ *                 bt_field<"t", &Peer::tags>,
+ *                 bt_optional_field<"v", &Peer::version>>{};
+ *     }
+ *     }
+ *
+ * or, when the dict keys are just the member names:
+ *
+ *     OXENC_BT_FIELDS(Peer, pubkey, port, tags);
+ *
+ * (either of which must be in the struct's namespace, or be a friend defined inside the struct).
+ *
+ * Such a struct can then be used anywhere a dict can: `bt_deserialize<Peer>(data)`,
+ * `try_bt_deserialize(data, peer)`, as the element type of a list, as the member of another bound
+ * struct, or with the consumer classes (e.g. `consumer.require<Peer>("peer")`).
+ *
+ * Fields whose member type is a std::optional are optional, and are reset if the key is absent; a
+ * `bt_optional_field` leaves its member untouched (e.g. at its default value) if the key is absent
+ * (except when decoding with bt_deserialize_reusing, which resets it to its default, so that it
+ * doesn't keep the previous message's value); any other field is required, and a missing key fails
+ * with bt_errc::key_not_found.  Unknown keys are skipped.
+ *
+ * The key table is sorted at compile time, and decoding is a single merge walk of the (sorted)
+ * encoded dict against it, decoding each value directly into its member: there is no intermediate
+ * bt_value, and no separate search for each key.  Because of this the encoded dict keys must be in
+ * ascending order (as the bt encoding requires); unsorted or duplicate keys fail with
+ * bt_errc::not_canonical.
+ *
+ * Serialization (`bt_serialize(peer)`, `bt_serialize_to(peer, begin, end)`, or appending to a
+ * producer with `append_struct`/`append_fields`) works the other way around: each key is
+ * pre-encoded at compile time (e.g. `1:k`), the fields are written in the compile-time sorted key
+ * order (skipping empty std::optionals), and the exact encoded size is computed first
+ * (`bt_serialized_size(peer)`) so that the output is written directly, in one piece, without going
+ * through an ostream.
+ */
+
+namespace oxenc {
+
+/// Fixed-size string literal wrapper used to pass dict keys as template arguments.
+template <size_t N>
+struct bt_key_literal {
+    char str[N];
+    constexpr bt_key_literal(const char (&s)[N]) { std::copy_n(s, N, str); }
+    constexpr std::string_view view() const { return {str, N - 1}; }
+};
+
+namespace detail {
+    // The bt-encoded form of a dict key, such as `4:name`.
+    template <bt_key_literal Key>
+    inline constexpr auto bt_encoded_key_chars = [] {
+        constexpr auto key = Key.view();
+        constexpr size_t digits = bt_digits(key.size());
+        std::array<char, digits + 1 + key.size()> enc{};
+        for (size_t i = digits, n = key.size(); i > 0; n /= 10)
+            enc[--i] = static_cast<char>('0' + n % 10);
+        enc[digits] = ':';
+        std::copy(key.begin(), key.end(), enc.begin() + digits + 1);
+        return enc;
+    }();
+
+    template <typename C, typename M>
+    M member_type_helper(M C::*);
+    template <typename C, typename M>
+    C class_type_helper(M C::*);
+
+    template <typename T>
+    inline constexpr bool is_std_optional = false;
+    template <typename T>
+    inline constexpr bool is_std_optional<std::optional<T>> = true;
+}  // namespace detail
+
+/// Describes a struct field stored under dict key `Key` in data member `Member` (a pointer to
+/// member).  The field is required unless the member is a std::optional.
+template <bt_key_literal Key, auto Member>
+struct bt_field {
+    static_assert(std::is_member_object_pointer_v<decltype(Member)>);
+    using struct_type = decltype(detail::class_type_helper(Member));
+    using value_type = decltype(detail::member_type_helper(Member));
+    static constexpr std::string_view key = Key.view();
+    static constexpr std::string_view encoded_key{
+            detail::bt_encoded_key_chars<Key>.data(), detail::bt_encoded_key_chars<Key>.size()};
+    static constexpr auto member = Member;
+    static constexpr bool required = !detail::is_std_optional<value_type>;
+};
+
+/// Describes an optional struct field that, unlike a std::optional member, is left unchanged if
+/// the key is not present.
+template <bt_key_literal Key, auto Member>
+struct bt_optional_field : bt_field<Key, Member> {
+    static constexpr bool required = false;
+};
+
+namespace detail {
+    template <typename T>
+    using bt_fields_tuple = decltype(bt_fields(std::type_identity<T>{}));
+
+    template <typename T>
+    inline constexpr size_t bt_field_count = std::tuple_size_v<bt_fields_tuple<T>>;
+
+    template <typename T, size_t I>
+    using bt_field_t = std::tuple_element_t<I, bt_fields_tuple<T>>;
+
+    struct bt_sorted_key {
+        std::string_view key;
+        size_t field;  // index into the bt_fields tuple
+        bool required;
+    };
+
+    // The field keys of T, sorted at compile time.
+    template <typename T>
+    inline constexpr auto bt_sorted_keys = []<size_t... I>(std::index_sequence<I...>) {
+        std::array<bt_sorted_key, sizeof...(I)> keys{
+                {{bt_field_t<T, I>::key, I, bt_field_t<T, I>::required}...}};
+        std::sort(keys.begin(), keys.end(), [](const auto& a, const auto& b) {
+            return a.key < b.key;
+        });
+        return keys;
+    }(std::make_index_sequence<bt_field_count<T>>{});
+
+    template <typename T>
+    constexpr bool bt_keys_unique() {
+        const auto& keys = bt_sorted_keys<T>;
+        for (size_t i = 1; i < keys.size(); i++)
+            if (keys[i - 1].key == keys[i].key)
+                return false;
+        return true;
+    }
+
+    template <typename T, size_t I>
+    bt_errc bt_decode_field(std::string_view& s, T& val) {
+        using F = bt_field_t<T, I>;
+        auto& member = val.*(F::member);
+        if constexpr (is_std_optional<typename F::value_type>) {
+            using U = typename F::value_type::value_type;
+            return bt_deserialize<U>{}(s, member.emplace());
+        } else {
+            return bt_deserialize<typename F::value_type>{}(s, member);
+        }
+    }
+
+    // Calls bt_decode_field<T, I> for the runtime field index `field`.
+    template <typename T, size_t... I>
+    bt_errc bt_decode_field(
+            std::string_view& s, T& val, size_t field, std::index_sequence<I...>) {
+        bt_errc ec = bt_errc::ok;
+        (void)((field == I && ((ec = bt_decode_field<T, I>(s, val)), true)) || ...);
+        return ec;
+    }
+
+    // Called for a field whose key is absent: resets the member if it is a std::optional.  When
+    // reusing storage, `val` may hold the previous message's values, so a bt_optional_field
+    // member is also reset, to its value in a default-constructed struct (as a new struct, which
+    // plain decoding would have created, has).
+    template <typename T, size_t I>
+    void bt_field_absent(T& val) {
+        using F = bt_field_t<T, I>;
+        if constexpr (is_std_optional<typename F::value_type>) {
+            (val.*(F::member)).reset();
+        } else if (bt_decode_ctx.reuse) {
+            if constexpr (std::is_default_constructible_v<T>) {
+                static const T defaults{};
+                val.*(F::member) = defaults.*(F::member);
+            } else {
+                val.*(F::member) = typename F::value_type{};
+            }
+        }
+    }
+
+    template <typename T, size_t... I>
+    void bt_field_absent(T& val, size_t field, std::index_sequence<I...>) {
+        (void)((field == I && (bt_field_absent<T, I>(val), true)) || ...);
+    }
+
+    // Whether any field of the struct borrows from the input (see bt_borrows).
+    template <bt_struct_type T, bt_borrow_check Check>
+    consteval bool bt_struct_borrows() {
+        return []<size_t... I>(std::index_sequence<I...>) {
+            return (bt_borrows<typename bt_field_t<T, I>::value_type, Check>() || ...);
+        }(std::make_index_sequence<bt_field_count<T>>{});
+    }
+
+    /// Deserializes a bt-encoded dict into a struct with bt_fields.
+    template <bt_struct_type T>
+    struct bt_deserialize<T> {
+        static_assert(bt_keys_unique<T>(), "bt_fields contains duplicate keys");
+
+        bt_errc operator()(std::string_view& s, T& val) {
+            constexpr auto& keys = bt_sorted_keys<T>;
+            constexpr auto fields = std::make_index_sequence<keys.size()>{};
+
+            if (s.empty())
+                return bt_errc::unexpected_end;
+            if (s[0] != 'd')
+                return bt_errc::wrong_type;
+            s.remove_prefix(1);
+
+            size_t next = 0;  // Next unmatched entry of `keys`
+            std::string_view prev;
+            const char* key_pos;
+            // Called as we pass by keys that aren't in the input
+            auto missing = [&](size_t until_key) {
+                for (; next < until_key; next++) {
+                    if (keys[next].required) {
+                        s = {key_pos, static_cast<size_t>(s.data() + s.size() - key_pos)};
+                        return true;
+                    }
+                    bt_field_absent(val, keys[next].field, fields);
+                }
+                return false;
+            };
+
+            for (;;) {
+                if (s.empty())
+                    return bt_errc::unexpected_end;
+                key_pos = s.data();
+                if (s[0] == 'e')
+                    break;
+                std::string_view key;
+                if (auto ec = bt_deserialize<std::string_view>{}(s, key); ec != bt_errc::ok)
+                    return ec;
+                if (prev.data() && key <= prev) {
+                    s = {key_pos, static_cast<size_t>(s.data() + s.size() - key_pos)};
+                    return bt_errc::not_canonical;
+                }
+                prev = key;
+                if (s.empty())
+                    return bt_errc::unexpected_end;
+                if (s[0] == 'e')
+                    return bt_errc::invalid_value;  // key without a value
+
+                size_t match = next;
+                while (match < keys.size() && keys[match].key < key)
+                    match++;
+                if (missing(match))
+                    return bt_errc::key_not_found;
+                if (next < keys.size() && keys[next].key == key) {
+                    if (auto ec = bt_decode_field(s, val, keys[next].field, fields);
+                        ec != bt_errc::ok)
+                        return ec;
+                    next++;
+                } else if (auto ec = bt_skip_value(s); ec != bt_errc::ok) {
+                    return ec;
+                }
+            }
+            if (missing(keys.size()))
+                return bt_errc::key_not_found;
+            s.remove_prefix(1);  // Consume the 'e'
+            return bt_errc::ok;
+        }
+    };
+
+    // Direct encoding into a pre-sized buffer, used for serializing bound structs.  For each
+    // supported type, `bt_encoded_size(v)` returns the exact size of the encoding of `v`, and
+    // `bt_encode(out, v)` writes exactly that many bytes at `out`, returning the end pointer.
+    // Types without a direct encoder fall back to (and produce the same output as) bt_serialize.
+
+    template <typename T>
+    size_t bt_encoded_size(const T& v);
+    template <typename T>
+    char* bt_encode(char* out, const T& v);
+
+    template <std::integral T>
+    using bt_wide_int = std::conditional_t<std::signed_integral<T>, int64_t, uint64_t>;
+
+    template <std::integral T>
+    size_t bt_integer_size(T val) {
+        auto v = static_cast<bt_wide_int<T>>(val);
+        if constexpr (std::signed_integral<T>)
+            if (v < 0)
+                return 3 + bt_digits(uint64_t{0} - static_cast<uint64_t>(v));
+        return 2 + bt_digits(static_cast<uint64_t>(v));
+    }
+
+    template <std::integral T>
+    char* bt_write_integer(char* out, T val) {
+        auto v = static_cast<bt_wide_int<T>>(val);
+#ifndef OXENC_APPLE_TO_CHARS_WORKAROUND
+        return std::to_chars(out, out + 20, v).ptr;
+#else
+        return apple_to_chars10(out, v);
+#endif
+    }
+
+    inline size_t bt_string_size(size_t len) {
+        return bt_digits(len) + 1 + len;
+    }
+
+    inline char* bt_write_string(char* out, const void* data, size_t len) {
+        out = bt_write_integer(out, len);
+        *out++ = ':';
+        if (len)
+            std::memcpy(out, data, len);
+        return out + len;
+    }
+
+    // A string-keyed dict whose iteration order is already the (byte-wise) bt key order, so that
+    // it can be encoded in place.  Other dicts, including maps with other comparators, go through
+    // bt_serialize to be sorted.
+    template <typename T>
+    concept bt_ordered_dict = bt_input_dict_container<T> &&
+                              std::same_as<typename T::key_type, std::string> && requires {
+                                  typename T::key_compare;
+                              } && (std::same_as<typename T::key_compare, std::less<std::string>> ||
+                                    std::same_as<typename T::key_compare, std::less<>>);
+
+    template <typename T, size_t I>
+    size_t bt_field_size(const T& val) {
+        using F = bt_field_t<T, I>;
+        const auto& member = val.*(F::member);
+        if constexpr (is_std_optional<typename F::value_type>)
+            return member ? F::encoded_key.size() + bt_encoded_size(*member) : 0;
+        else
+            return F::encoded_key.size() + bt_encoded_size(member);
+    }
+
+    template <typename T, size_t I>
+    char* bt_encode_field(char* out, const T& val) {
+        using F = bt_field_t<T, I>;
+        const auto& member = val.*(F::member);
+        if constexpr (is_std_optional<typename F::value_type>)
+            if (!member)
+                return out;
+        std::memcpy(out, F::encoded_key.data(), F::encoded_key.size());
+        out += F::encoded_key.size();
+        if constexpr (is_std_optional<typename F::value_type>)
+            return bt_encode(out, *member);
+        else
+            return bt_encode(out, member);
+    }
+
+    // Size of the fields of a bound struct, without the surrounding `d`/`e`.
+    template <bt_struct_type T>
+    size_t bt_fields_size(const T& val) {
+        return [&]<size_t... I>(std::index_sequence<I...>) {
+            return (bt_field_size<T, I>(val) + ... + 0);
+        }(std::make_index_sequence<bt_field_count<T>>{});
+    }
+
+    // Encodes the fields of a bound struct in sorted key order, without the surrounding `d`/`e`.
+    template <bt_struct_type T>
+    char* bt_encode_fields(char* out, const T& val) {
+        [&]<size_t... J>(std::index_sequence<J...>) {
+            ((out = bt_encode_field<T, bt_sorted_keys<T>[J].field>(out, val)), ...);
+        }(std::make_index_sequence<bt_field_count<T>>{});
+        return out;
+    }
+
+    template <typename T>
+    size_t bt_encoded_size(const T& v) {
+        if constexpr (std::integral<T>)
+            return bt_integer_size(v);
+        else if constexpr (string_like<T>)
+            return bt_string_size(v.size());
+        else if constexpr (bt_struct_type<T>)
+            return 2 + bt_fields_size(v);
+        else if constexpr (tuple_like<T>)
+            return std::apply(
+                    [](const auto&... e) { return 2 + (bt_encoded_size(e) + ... + 0); }, v);
+        else if constexpr (bt_ordered_dict<T>) {
+            size_t n = 2;
+            for (const auto& [k, e] : v)
+                n += bt_string_size(k.size()) + bt_encoded_size(e);
+            return n;
+        } else if constexpr (bt_input_list_container<T>) {
+            size_t n = 2;
+            for (const auto& e : v)
+                n += bt_encoded_size(e);
+            return n;
+        } else
+            return oxenc::bt_serialize(v).size();
+    }
+
+    template <typename T>
+    char* bt_encode(char* out, const T& v) {
+        if constexpr (std::integral<T>) {
+            *out++ = 'i';
+            out = bt_write_integer(out, v);
+            *out++ = 'e';
+            return out;
+        } else if constexpr (string_like<T>) {
+            return bt_write_string(out, v.data(), v.size());
+        } else if constexpr (bt_struct_type<T>) {
+            *out++ = 'd';
+            out = bt_encode_fields(out, v);
+            *out++ = 'e';
+            return out;
+        } else if constexpr (tuple_like<T>) {
+            *out++ = 'l';
+            std::apply([&out](const auto&... e) { ((out = bt_encode(out, e)), ...); }, v);
+            *out++ = 'e';
+            return out;
+        } else if constexpr (bt_ordered_dict<T>) {
+            *out++ = 'd';
+            for (const auto& [k, e] : v) {
+                out = bt_write_string(out, k.data(), k.size());
+                out = bt_encode(out, e);
+            }
+            *out++ = 'e';
+            return out;
+        } else if constexpr (bt_input_list_container<T>) {
+            *out++ = 'l';
+            for (const auto& e : v)
+                out = bt_encode(out, e);
+            *out++ = 'e';
+            return out;
+        } else {
+            auto enc = oxenc::bt_serialize(v);
+            std::memcpy(out, enc.data(), enc.size());
+            return out + enc.size();
+        }
+    }
+
+    /// Serializes a struct with bt_fields to an ostream (e.g. when nested inside some other
+    /// serialized container).
+    template <bt_struct_type T>
+    struct bt_serialize<T> {
+        void operator()(std::ostream& os, const T& val) {
+            std::string enc(bt_encoded_size(val), '\0');
+            bt_encode(enc.data(), val);
+            os.write(enc.data(), static_cast<std::streamsize>(enc.size()));
+        }
+    };
+
+}  // namespace detail
+
+/// Returns the exact size of the bt-encoding of a struct with a bt_fields description, without
+/// encoding it.
+template <bt_struct_type T>
+size_t bt_serialized_size(const T& val) {
+    return detail::bt_encoded_size(val);
+}
+
+/// Serializes a struct with a bt_fields description into a std::string.  This overload is used
+/// instead of the generic `bt_serialize(val)`: it allocates the exact size needed and then writes
+/// the encoded value directly into it.
+template <bt_struct_type T>
+std::string bt_serialize(const T& val) {
+    std::string enc(detail::bt_encoded_size(val), '\0');
+    detail::bt_encode(enc.data(), val);
+    return enc;
+}
+
+/// Serializes a struct with a bt_fields description into the buffer [begin, end), returning a
+/// pointer just past the last byte written.  Throws std::length_error (without writing anything)
+/// if the buffer is too small; bt_serialized_size() returns the size required.
+template <bt_struct_type T>
+char* bt_serialize_to(const T& val, char* begin, char* end) {
+    if (detail::bt_encoded_size(val) > static_cast<size_t>(end - begin))
+        throw std::length_error{"Cannot serialize struct: buffer size exceeded"};
+    return detail::bt_encode(begin, val);
+}
+
+template <bt_struct_type T>
+void bt_list_producer::append_struct(const T& val) {
+    if (has_child)
+        throw std::logic_error{"Cannot append to list when a sublist is active"};
+    buffer_append_with(
+            detail::bt_encoded_size(val), [&val](char* out) { detail::bt_encode(out, val); });
+    append_intermediate_ends();
+}
+
+template <bt_struct_type T>
+void bt_dict_producer::append_struct(std::string_view key, const T& val) {
+    if (has_child)
+        throw std::logic_error{"Cannot append to list when a sublist is active"};
+    check_incrementing_key(key);
+    append_impl(key);
+    buffer_append_with(
+            detail::bt_encoded_size(val), [&val](char* out) { detail::bt_encode(out, val); });
+    append_intermediate_ends();
+}
+
+template <bt_struct_type T>
+void bt_dict_producer::append_fields(const T& val) {
+    if (has_child)
+        throw std::logic_error{"Cannot append to list when a sublist is active"};
+#ifndef NDEBUG
+    [&]<size_t... J>(std::index_sequence<J...>) {
+        auto check = [&]<size_t I>() {
+            using F = detail::bt_field_t<T, I>;
+            if constexpr (detail::is_std_optional<typename F::value_type>)
+                if (!(val.*(F::member)))
+                    return;
+            check_incrementing_key(F::key);
+        };
+        (check.template operator()<detail::bt_sorted_keys<T>[J].field>(), ...);
+    }(std::make_index_sequence<detail::bt_field_count<T>>{});
+#endif
+    buffer_append_with(
+            detail::bt_fields_size(val), [&val](char* out) { detail::bt_encode_fields(out, val); });
+    append_intermediate_ends();
+}
+
+}  // namespace oxenc
+
+// Helpers for OXENC_BT_FIELDS: applies a macro to each of the variadic arguments, separating the
+// results with commas.
+#define OXENC_BT_PARENS ()
+#define OXENC_BT_EXPAND(...) \
+    OXENC_BT_EXPAND3(OXENC_BT_EXPAND3(OXENC_BT_EXPAND3(OXENC_BT_EXPAND3(__VA_ARGS__))))
+#define OXENC_BT_EXPAND3(...) \
+    OXENC_BT_EXPAND2(OXENC_BT_EXPAND2(OXENC_BT_EXPAND2(OXENC_BT_EXPAND2(__VA_ARGS__))))
+#define OXENC_BT_EXPAND2(...) \
+    OXENC_BT_EXPAND1(OXENC_BT_EXPAND1(OXENC_BT_EXPAND1(OXENC_BT_EXPAND1(__VA_ARGS__))))
+#define OXENC_BT_EXPAND1(...) __VA_ARGS__
+#define OXENC_BT_FOR_EACH(macro, S, ...) \
+    __VA_OPT__(OXENC_BT_EXPAND(OXENC_BT_FOR_EACH_HELPER(macro, S, __VA_ARGS__)))
+#define OXENC_BT_FOR_EACH_HELPER(macro, S, a, ...) \
+    macro(S, a) __VA_OPT__(, OXENC_BT_FOR_EACH_AGAIN OXENC_BT_PARENS(macro, S, __VA_ARGS__))
+#define OXENC_BT_FOR_EACH_AGAIN() OXENC_BT_FOR_EACH_HELPER
+#define OXENC_BT_FIELD_BY_NAME(S, member) ::oxenc::bt_field<#member, &S::member>
+
+/// Defines the bt_fields description of struct `S` with a field for each of the given data members,
+/// using the member names as the dict keys.  Must be used in the namespace containing `S`.
+#define OXENC_BT_FIELDS(S, ...)                                                         \
+    [[maybe_unused]] constexpr auto bt_fields(std::type_identity<S>) {                  \
+        return std::tuple<OXENC_BT_FOR_EACH(OXENC_BT_FIELD_BY_NAME, S, __VA_ARGS__)>{}; \
+    }
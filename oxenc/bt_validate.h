@@ -0,0 +1,154 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <string_view>
+
+#include "bt_serialize.h"
+#include "span.h"
+
+namespace oxenc {
+
+/// Limits and options for bt_validate().  The defaults accept any well-formed value with up to
+/// bt_default_max_depth levels of list/dict nesting: the same values that bt_get() and the other
+/// decoders accept by default.
+struct bt_validate_limits {
+    /// Hard upper bound on `max_depth`, equal to the default: bt_validate keeps one fixed-size
+    /// frame per nesting level on the stack (rather than allocating), so larger values are clamped
+    /// to this.
+    static constexpr size_t max_depth_cap = bt_default_max_depth;
+
+    /// Maximum list/dict nesting depth: a top-level list or dict is depth 1, a list inside it is
+    /// depth 2, and so on.  0 only allows a top-level string or integer.  Defaults to (and is
+    /// capped at) bt_default_max_depth.
+    size_t max_depth = bt_default_max_depth;
+
+    /// Maximum total number of values (strings, integers, lists and dicts, but not dict keys) in
+    /// the input, including the top-level value.
+    size_t max_elements = std::numeric_limits<size_t>::max();
+
+    /// Maximum length of any string value or dict key.
+    size_t max_string_length = std::numeric_limits<size_t>::max();
+
+    /// If true then also require the canonical encoding: dict keys must be strictly ascending
+    /// (i.e. sorted and unique), and integers and string lengths must not have leading zeros (nor
+    /// may an integer be encoded as `-0`).
+    bool canonical = false;
+};
+
+namespace detail {
+    struct bt_validate_frame {
+        std::string_view last_key;  // Only used for dicts (and only when checking canonical form)
+        bool dict;
+    };
+}  // namespace detail
+
+/// Checks that `data` contains exactly one well-formed bt-encoded value, without decoding it and
+/// without allocating memory.  Returns an empty bt_error if the data is valid, otherwise the error
+/// code and offset of the first problem found.  In addition to structural validity this enforces
+/// the given limits, and (optionally) canonical encoding.  Integers must fit in a 64-bit signed or
+/// unsigned integer, just as for bt_deserialize.
+///
+/// This makes a single forward pass over the data using an explicit (stack-allocated) frame stack
+/// rather than recursion; string payloads are skipped without being read and digits are parsed 8
+/// at a time, so the cost is dominated by the encoded structure rather than the payload size.
+///
+///     if (auto err = bt_validate(msg, {.max_depth = 8, .max_string_length = 4096}))
+///         return reject(err);
+inline bt_error bt_validate(std::string_view data, const bt_validate_limits& limits = {}) {
+    const char* const begin = data.data();
+    std::string_view s{data};
+    auto fail = [begin](bt_errc ec, const char* at) {
+        return bt_error{ec, static_cast<size_t>(at - begin)};
+    };
+
+    detail::bt_validate_frame stack[bt_validate_limits::max_depth_cap];
+    const size_t max_depth = std::min(limits.max_depth, bt_validate_limits::max_depth_cap);
+    size_t depth = 0;
+    size_t elements = 0;
+
+    // Parses a string (value or key) from `s`, enforcing the string limits.
+    auto parse_string = [&](std::string_view& str) -> bt_error {
+        const char* at = s.data();
+        if (limits.canonical && s.size() >= 2 && s[0] == '0' && s[1] != ':')
+            return fail(bt_errc::not_canonical, at);
+        if (auto ec = detail::bt_deserialize<std::string_view>{}(s, str); ec != bt_errc::ok)
+            return fail(ec, s.data());
+        if (str.size() > limits.max_string_length)
+            return fail(bt_errc::string_limit, at);
+        return {};
+    };
+
+    for (;;) {
+        if (s.empty())
+            return fail(bt_errc::unexpected_end, s.data());
+
+        if (depth > 0) {
+            auto& frame = stack[depth - 1];
+            if (s[0] == 'e') {
+                s.remove_prefix(1);
+                if (--depth == 0)
+                    break;
+                continue;
+            }
+            if (frame.dict) {
+                const char* at = s.data();
+                std::string_view key;
+                if (auto err = parse_string(key))
+                    return err;
+                if (limits.canonical) {
+                    if (frame.last_key.data() && key <= frame.last_key)
+                        return fail(bt_errc::not_canonical, at);
+                    frame.last_key = key;
+                }
+                if (s.empty())
+                    return fail(bt_errc::unexpected_end, s.data());
+                if (s[0] == 'e')
+                    return fail(bt_errc::invalid_value, s.data());  // key without a value
+            }
+        }
+
+        if (++elements > limits.max_elements)
+            return fail(bt_errc::element_limit, s.data());
+
+        switch (s[0]) {
+            case 'l':
+            case 'd':
+                if (depth >= max_depth)
+                    return fail(bt_errc::depth_limit, s.data());
+                stack[depth++] = {{}, s[0] == 'd'};
+                s.remove_prefix(1);
+                continue;
+            case 'i': {
+                if (limits.canonical && s.size() >= 3 &&
+                    (s[1] == '-' ? s[2] == '0' : s[1] == '0' && s[2] != 'e'))
+                    return fail(bt_errc::not_canonical, s.data());
+                std::pair<detail::some64, bool> ignored;
+                if (auto ec = detail::bt_deserialize_integer(s, ignored); ec != bt_errc::ok)
+                    return fail(ec, s.data());
+                break;
+            }
+            default: {
+                if (s[0] < '0' || s[0] > '9')
+                    return fail(bt_errc::invalid_value, s.data());
+                std::string_view ignored;
+                if (auto err = parse_string(ignored))
+                    return err;
+            }
+        }
+        if (depth == 0)
+            break;
+    }
+
+    if (!s.empty())
+        return fail(bt_errc::trailing_data, s.data());
+    return {};
+}
+
+template <const_span_type SpanT>
+bt_error bt_validate(SpanT data, const bt_validate_limits& limits = {}) {
+    return bt_validate(detail::span_to_sv(data), limits);
+}
+
+}  // namespace oxenc
@@ -4,12 +4,15 @@
 // needing to include the full bt_serialize.h header.
 
 #include <concepts>
+#include <cstddef>
 #include <cstdint>
+#include <functional>
 #include <list>
 #include <map>
 #include <string>
 #include <string_view>
 #include <type_traits>
+#include <utility>
 #include <variant>
 
 #include "span.h"
@@ -78,4 +81,33 @@ struct bt_value : bt_variant {
     bt_value(const char* s) : bt_value{std::string_view{s}} {}
 };
 
+/// Compares two bt_values by what they would encode to, rather than by variant alternative: an
+/// int64_t and a uint64_t holding the same number are equal (so `bt_value{0}` equals the value
+/// decoded from `i0e`, which is a uint64_t), as are a std::string and a std::string_view with the
+/// same contents.  Lists and dicts compare element by element.
+inline bool operator==(const bt_value& a, const bt_value& b) {
+    return std::visit(
+            []<typename A, typename B>(const A& x, const B& y) -> bool {
+                if constexpr (std::integral<A> && std::integral<B>)
+                    return std::cmp_equal(x, y);
+                else if constexpr (
+                        std::convertible_to<const A&, std::string_view> &&
+                        std::convertible_to<const B&, std::string_view>)
+                    return std::string_view{x} == std::string_view{y};
+                else if constexpr (std::same_as<A, B>)
+                    return x == y;
+                else
+                    return false;
+            },
+            static_cast<const bt_variant&>(a),
+            static_cast<const bt_variant&>(b));
+}
+
 }  // namespace oxenc
+
+/// Hashes a bt_value consistently with its operator==, by hashing its (always canonical) encoding;
+/// this equals the bt_hash (see bt_compare.h) of any encoding of the same value.
+template <>
+struct std::hash<oxenc::bt_value> {
+    size_t operator()(const oxenc::bt_value& v) const;  // Defined in bt_serialize.h
+};
@@ -69,6 +69,11 @@ concept bt_input_list_container =
             typename T::value_type;
         };
 
+/// Satisfied by structs that have a `bt_fields` description (found via ADL) that binds dict keys to
+/// data members; see bt_struct.h.
+template <typename T>
+concept bt_struct_type = requires { bt_fields(std::type_identity<T>{}); };
+
 template <typename R, typename T>
 concept const_contiguous_range_t =
         std::ranges::contiguous_range<R const> &&
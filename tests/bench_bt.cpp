@@ -0,0 +1,639 @@
+#include <deque>
+#include <random>
+
+#include "common.h"
+#include "oxenc/bt_parallel.h"
+
+// Microbenchmarks for the bt decoder hot paths.  These are hidden from the default test run; run
+// them with:
+//
+//     ./tests "[benchmark]"
+
+namespace {
+
+// The previous digit-at-a-time implementation of detail::extract_unsigned, kept for comparison.
+bt_errc extract_unsigned_scalar(std::string_view& s, uint64_t& val) {
+    uint64_t uval = 0;
+    bool once = false;
+    while (!s.empty() && (s[0] >= '0' && s[0] <= '9')) {
+        once = true;
+        uint64_t bigger = uval * 10 + static_cast<uint64_t>(s[0] - '0');
+        if (bigger < uval)
+            return bt_errc::integer_overflow;
+        s.remove_prefix(1);
+        uval = bigger;
+    }
+    if (!once)
+        return bt_errc::invalid_value;
+    val = uval;
+    return bt_errc::ok;
+}
+
+// Builds a buffer of `count` encoded values, each being a number followed by a one-char delimiter,
+// with numbers drawn from `gen`.
+template <typename Gen>
+std::string make_numbers(size_t count, Gen&& gen) {
+    std::string buf;
+    for (size_t i = 0; i < count; i++) {
+        buf += std::to_string(gen());
+        buf += ':';
+    }
+    return buf;
+}
+
+template <typename Extract>
+uint64_t parse_all(std::string_view s, Extract&& extract) {
+    uint64_t sum = 0, v = 0;
+    while (!s.empty()) {
+        if (extract(s, v) != bt_errc::ok)
+            break;
+        sum += v;
+        s.remove_prefix(1);  // delimiter
+    }
+    return sum;
+}
+
+struct bench_record {
+    int64_t id;
+    std::string_view key;
+    std::optional<std::string_view> note;
+    int64_t timestamp;
+    std::vector<int64_t> values;
+};
+constexpr auto bt_fields(std::type_identity<bench_record>) {
+    return std::tuple<
+            bt_field<"#", &bench_record::id>,
+            bt_field<"k", &bench_record::key>,
+            bt_field<"n", &bench_record::note>,
+            bt_field<"t", &bench_record::timestamp>,
+            bt_field<"v", &bench_record::values>>{};
+}
+
+}  // namespace
+
+TEST_CASE("extract_unsigned benchmark", "[.][benchmark][bt][integer]") {
+    std::mt19937_64 rng{42};
+
+    // String length prefixes: mostly short keys and values with a spike at 32/64 (pubkeys,
+    // signatures, hashes) and the occasional large blob.
+    auto lengths = make_numbers(10000, [&] {
+        auto r = rng() % 100;
+        return r < 50   ? rng() % 16
+               : r < 80 ? (r % 2 ? 32 : 64)
+               : r < 98 ? rng() % 1000
+                        : rng() % 1000000;
+    });
+    // Integers: millisecond timestamps, small counters, and 64-bit amounts/ids.
+    auto integers = make_numbers(10000, [&] {
+        auto r = rng() % 3;
+        return r == 0 ? 1700000000000 + rng() % 100000000000 : r == 1 ? rng() % 1000 : rng();
+    });
+
+    auto swar = [](std::string_view& s, uint64_t& v) { return detail::extract_unsigned(s, v); };
+    REQUIRE(parse_all(lengths, swar) == parse_all(lengths, extract_unsigned_scalar));
+    REQUIRE(parse_all(integers, swar) == parse_all(integers, extract_unsigned_scalar));
+
+    BENCHMARK("lengths: scalar") {
+        return parse_all(lengths, extract_unsigned_scalar);
+    };
+    BENCHMARK("lengths: swar") {
+        return parse_all(lengths, swar);
+    };
+    BENCHMARK("integers: scalar") {
+        return parse_all(integers, extract_unsigned_scalar);
+    };
+    BENCHMARK("integers: swar") {
+        return parse_all(integers, swar);
+    };
+}
+
+TEST_CASE("bt_validate benchmark", "[.][benchmark][bt][validate]") {
+    std::mt19937_64 rng{42};
+
+    // A list of dicts resembling a batch of signed records.
+    bt_list records;
+    for (int i = 0; i < 2000; i++) {
+        bt_dict r;
+        r["#"] = static_cast<int64_t>(rng() % 1000000);
+        r["k"] = std::string(32, static_cast<char>('a' + i % 26));
+        r["s"] = std::string(64, 'z');
+        r["t"] = static_cast<int64_t>(1700000000000 + rng() % 100000000000);
+        r["v"] = bt_list{"hello", static_cast<int64_t>(i), bt_list{}};
+        records.push_back(std::move(r));
+    }
+    auto encoded = bt_serialize(records);
+    REQUIRE_FALSE(bt_validate(encoded, {.canonical = true}));
+
+    BENCHMARK("bt_deserialize<bt_value>") {
+        return bt_deserialize<bt_value>(encoded);
+    };
+    BENCHMARK("bt_validate") {
+        return bt_validate(encoded);
+    };
+    BENCHMARK("bt_validate (canonical)") {
+        return bt_validate(encoded, {.canonical = true});
+    };
+}
+
+TEST_CASE("bt_value decoding benchmark", "[.][benchmark][bt][bt_value]") {
+    std::mt19937_64 rng{42};
+
+    bt_list records;
+    for (int i = 0; i < 2000; i++) {
+        bt_dict r;
+        r["#"] = static_cast<int64_t>(rng() % 1000000);
+        r["k"] = std::string(32, static_cast<char>('a' + i % 26));
+        r["t"] = static_cast<int64_t>(1700000000000 + rng() % 100000000000);
+        r["v"] = bt_list{"hello", static_cast<int64_t>(i), bt_list{bt_dict{{"x", 1}}}};
+        records.push_back(std::move(r));
+    }
+    auto flat = bt_serialize(records);
+
+    std::string nested;
+    for (int i = 0; i < 200; i++)
+        nested += "l1:a";
+    nested.append(200, 'e');
+    std::string skippable = "l" + flat;
+    skippable += nested;
+    skippable += 'e';
+
+    BENCHMARK("records") {
+        return bt_get(flat);
+    };
+    BENCHMARK("nested 200") {
+        return bt_get(nested);
+    };
+    BENCHMARK("skip") {
+        bt_list_consumer c{skippable};
+        c.skip_value();
+        c.skip_value();
+        return c.is_finished();
+    };
+}
+
+TEST_CASE("bt struct binding benchmark", "[.][benchmark][bt][struct]") {
+    std::mt19937_64 rng{42};
+    std::vector<std::string> records;
+    for (int i = 0; i < 1000; i++) {
+        bt_dict r;
+        r["#"] = static_cast<int64_t>(rng() % 1000000);
+        r["k"] = std::string(32, static_cast<char>('a' + i % 26));
+        r["t"] = static_cast<int64_t>(1700000000000 + rng() % 100000000000);
+        r["v"] = bt_list{1, 2, 3, static_cast<int64_t>(i)};
+        r["x"] = "unused";
+        records.push_back(bt_serialize(r));
+    }
+
+    BENCHMARK("bt_dict_consumer") {
+        int64_t sum = 0;
+        for (auto& rec : records) {
+            bench_record r;
+            bt_dict_consumer d{rec};
+            r.id = d.require<int64_t>("#");
+            r.key = d.require<std::string_view>("k");
+            r.note = d.maybe<std::string_view>("n");
+            r.timestamp = d.require<int64_t>("t");
+            r.values = d.require<std::vector<int64_t>>("v");
+            d.finish();
+            sum += r.id + r.timestamp + static_cast<int64_t>(r.values.size());
+        }
+        return sum;
+    };
+    BENCHMARK("bound struct") {
+        int64_t sum = 0;
+        for (auto& rec : records) {
+            auto r = bt_deserialize<bench_record>(rec);
+            sum += r.id + r.timestamp + static_cast<int64_t>(r.values.size());
+        }
+        return sum;
+    };
+}
+
+TEST_CASE("bt struct serialization benchmark", "[.][benchmark][bt][struct]") {
+    std::mt19937_64 rng{42};
+    std::string key(32, 'k');
+    std::vector<bench_record> records;
+    for (int i = 0; i < 1000; i++)
+        records.push_back(
+                {static_cast<int64_t>(rng() % 1000000),
+                 key,
+                 i % 3 ? std::nullopt : std::optional<std::string_view>{"note"},
+                 static_cast<int64_t>(1700000000000 + rng() % 100000000000),
+                 {1, 2, 3, static_cast<int64_t>(i)}});
+
+    auto to_dict = [](const bench_record& r) {
+        bt_dict d{{"#", r.id}, {"k", r.key}, {"t", r.timestamp}};
+        if (r.note)
+            d["n"] = *r.note;
+        bt_list v;
+        for (auto x : r.values)
+            v.push_back(x);
+        d["v"] = std::move(v);
+        return d;
+    };
+    for (auto& r : records)
+        REQUIRE(bt_serialize(r) == bt_serialize(to_dict(r)));
+
+    BENCHMARK("bt_dict") {
+        size_t total = 0;
+        for (auto& r : records)
+            total += bt_serialize(to_dict(r)).size();
+        return total;
+    };
+    BENCHMARK("bt_dict_producer") {
+        size_t total = 0;
+        for (auto& r : records) {
+            bt_dict_producer d;
+            d.append("#", r.id);
+            d.append("k", r.key);
+            if (r.note)
+                d.append("n", *r.note);
+            d.append("t", r.timestamp);
+            d.append_list("v").extend(r.values.begin(), r.values.end());
+            total += d.view().size();
+        }
+        return total;
+    };
+    BENCHMARK("bound struct") {
+        size_t total = 0;
+        for (auto& r : records)
+            total += bt_serialize(r).size();
+        return total;
+    };
+}
+
+TEST_CASE("bt dict dispatch benchmark", "[.][benchmark][bt][dict]") {
+    // A message with 16 keys, all handled
+    bt_dict msg;
+    for (char c = 'a'; c < 'q'; c++)
+        msg[std::string{"field_"} + c] = static_cast<int64_t>(c);
+    auto enc = bt_serialize(msg);
+
+    BENCHMARK("if/else chain") {
+        int64_t sum = 0;
+        bt_dict_consumer d{enc};
+        while (!d.is_finished()) {
+            auto key = d.key();
+            // clang-format off
+            if (key == "field_a") sum += d.consume_integer<int64_t>() * 1;
+            else if (key == "field_b") sum += d.consume_integer<int64_t>() * 2;
+            else if (key == "field_c") sum += d.consume_integer<int64_t>() * 3;
+            else if (key == "field_d") sum += d.consume_integer<int64_t>() * 4;
+            else if (key == "field_e") sum += d.consume_integer<int64_t>() * 5;
+            else if (key == "field_f") sum += d.consume_integer<int64_t>() * 6;
+            else if (key == "field_g") sum += d.consume_integer<int64_t>() * 7;
+            else if (key == "field_h") sum += d.consume_integer<int64_t>() * 8;
+            else if (key == "field_i") sum += d.consume_integer<int64_t>() * 9;
+            else if (key == "field_j") sum += d.consume_integer<int64_t>() * 10;
+            else if (key == "field_k") sum += d.consume_integer<int64_t>() * 11;
+            else if (key == "field_l") sum += d.consume_integer<int64_t>() * 12;
+            else if (key == "field_m") sum += d.consume_integer<int64_t>() * 13;
+            else if (key == "field_n") sum += d.consume_integer<int64_t>() * 14;
+            else if (key == "field_o") sum += d.consume_integer<int64_t>() * 15;
+            else if (key == "field_p") sum += d.consume_integer<int64_t>() * 16;
+            else d.skip_value();
+            // clang-format on
+        }
+        return sum;
+    };
+    BENCHMARK("consume_dict_dispatch") {
+        int64_t sum = 0;
+        auto add = [&sum](int64_t mul) { return [&sum, mul](int64_t v) { sum += v * mul; }; };
+        consume_dict_dispatch(
+                bt_dict_consumer{enc},
+                bt_on<"field_a">(add(1)),
+                bt_on<"field_b">(add(2)),
+                bt_on<"field_c">(add(3)),
+                bt_on<"field_d">(add(4)),
+                bt_on<"field_e">(add(5)),
+                bt_on<"field_f">(add(6)),
+                bt_on<"field_g">(add(7)),
+                bt_on<"field_h">(add(8)),
+                bt_on<"field_i">(add(9)),
+                bt_on<"field_j">(add(10)),
+                bt_on<"field_k">(add(11)),
+                bt_on<"field_l">(add(12)),
+                bt_on<"field_m">(add(13)),
+                bt_on<"field_n">(add(14)),
+                bt_on<"field_o">(add(15)),
+                bt_on<"field_p">(add(16)));
+        return sum;
+    };
+}
+
+TEST_CASE("bt parallel list decoding benchmark", "[.][benchmark][bt][parallel]") {
+    std::mt19937_64 rng{42};
+    bt_list records;
+    for (int i = 0; i < 20000; i++) {
+        bt_dict r;
+        r["#"] = static_cast<int64_t>(rng() % 1000000);
+        r["k"] = std::string(32, static_cast<char>('a' + i % 26));
+        r["t"] = static_cast<int64_t>(1700000000000 + rng() % 100000000000);
+        r["v"] = bt_list{1, 2, 3, static_cast<int64_t>(i)};
+        records.push_back(std::move(r));
+    }
+    auto enc = bt_serialize(records);
+    REQUIRE(bt_deserialize_parallel<bt_value>(enc).size() == 20000);
+
+    BENCHMARK("bt_value: sequential") {
+        return bt_deserialize<std::vector<bt_value>>(enc).size();
+    };
+    BENCHMARK("bt_value: parallel") {
+        return bt_deserialize_parallel<bt_value>(enc).size();
+    };
+    BENCHMARK("bound struct: sequential") {
+        return bt_deserialize<std::vector<bench_record>>(enc).size();
+    };
+    BENCHMARK("bound struct: parallel") {
+        return bt_deserialize_parallel<bench_record>(enc).size();
+    };
+}
+
+TEST_CASE("bt integer list decoding benchmark", "[.][benchmark][bt][integer]") {
+    std::mt19937_64 rng{42};
+    std::vector<uint64_t> timestamps;
+    std::vector<int> indices;
+    for (int i = 0; i < 10000; i++) {
+        timestamps.push_back(1700000000000 + rng() % 100000000000);
+        indices.push_back(static_cast<int>(rng() % 1000) - 100);
+    }
+    auto enc_ts = bt_serialize(timestamps);
+    auto enc_idx = bt_serialize(indices);
+    REQUIRE(bt_deserialize<std::vector<uint64_t>>(enc_ts) == timestamps);
+    REQUIRE(bt_deserialize<std::vector<int>>(enc_idx) == indices);
+
+    // std::deque goes through the general per-element list decoder
+    BENCHMARK("timestamps: general decoder (deque)") {
+        return bt_deserialize<std::deque<uint64_t>>(enc_ts).size();
+    };
+    BENCHMARK("timestamps: vector fast path") {
+        return bt_deserialize<std::vector<uint64_t>>(enc_ts).size();
+    };
+    BENCHMARK("small ints: general decoder (deque)") {
+        return bt_deserialize<std::deque<int>>(enc_idx).size();
+    };
+    BENCHMARK("small ints: vector fast path") {
+        return bt_deserialize<std::vector<int>>(enc_idx).size();
+    };
+}
+
+TEST_CASE("bt fixed-length string list benchmark", "[.][benchmark][bt][list]") {
+    std::mt19937_64 rng{42};
+    std::vector<std::string> pubkeys(10000);
+    for (auto& pk : pubkeys) {
+        pk.resize(32);
+        for (auto& c : pk)
+            c = static_cast<char>(rng());
+    }
+    auto enc = bt_serialize(pubkeys);
+    auto wrapped = "l" + enc + "e";  // consume_fixed_list consumes the list as a value
+    REQUIRE(bt_list_consumer{wrapped}.consume_fixed_list<32>().to_vector<char>().size() == 10000);
+
+    BENCHMARK("consume_span per element") {
+        std::vector<std::array<std::byte, 32>> out;
+        out.reserve(pubkeys.size());
+        bt_list_consumer l{enc};
+        while (!l.is_finished()) {
+            auto pk = l.consume_span<std::byte>();
+            if (pk.size() != 32)
+                throw std::runtime_error{"bad pubkey"};
+            std::copy(pk.begin(), pk.end(), out.emplace_back().begin());
+        }
+        return out.size();
+    };
+    BENCHMARK("consume_fixed_list view") {
+        return bt_list_consumer{wrapped}.consume_fixed_list<32, std::byte>().size();
+    };
+    BENCHMARK("consume_fixed_list to_vector") {
+        return bt_list_consumer{wrapped}.consume_fixed_list<32>().to_vector<std::byte>().size();
+    };
+    BENCHMARK("memcpy of the encoded list") {
+        std::vector<char> copy(enc.size());
+        std::memcpy(copy.data(), enc.data(), enc.size());
+        return copy.size();
+    };
+}
+
+TEST_CASE("bt key interning benchmark", "[.][benchmark][bt][dict][intern]") {
+    // A repeated-schema corpus: 1000 messages with the same keys, several of them too long for
+    // std::string's inline storage.
+    std::vector<std::string> corpus;
+    for (int i = 0; i < 1000; i++)
+        corpus.push_back(bt_serialize(std::map<std::string, int>{
+                {"t", i},
+                {"public_ip", 0x0a000000 + i},
+                {"storage_port", 22021},
+                {"storage_lmq_port", 22020},
+                {"storage_server_version", 2},
+                {"last_uptime_proof", 1700000000 + i},
+                {"swarm_id", i % 37}}));
+
+    BENCHMARK("std::string keys") {
+        std::vector<std::map<std::string, int>> cache;
+        cache.reserve(corpus.size());
+        for (auto& msg : corpus)
+            cache.push_back(bt_deserialize<std::map<std::string, int>>(msg));
+        return cache.size();
+    };
+    BENCHMARK("interned std::string_view keys") {
+        bt_intern_table keys;
+        std::vector<std::map<std::string_view, int>> cache;
+        cache.reserve(corpus.size());
+        for (auto& msg : corpus)
+            cache.push_back(bt_deserialize_interned<std::map<std::string_view, int>>(msg, keys));
+        return cache.size();
+    };
+}
+
+TEST_CASE("bt reusing deserialization benchmark", "[.][benchmark][bt][reuse]") {
+    // Same-shaped messages decoded over and over into the same destination
+    std::vector<std::string> strs;
+    std::map<std::string, std::string> dict;
+    for (int i = 0; i < 20; i++) {
+        strs.push_back(std::string(40, static_cast<char>('a' + i)) + std::to_string(i));
+        dict.emplace("some_long_key_name_" + std::to_string(i), strs.back());
+    }
+    auto enc_list = bt_serialize(strs);
+    auto enc_dict = bt_serialize(dict);
+
+    BENCHMARK("vector<string>: bt_deserialize") {
+        bt_deserialize(enc_list, strs);
+        return strs.size();
+    };
+    BENCHMARK("vector<string>: bt_deserialize_reusing") {
+        bt_deserialize_reusing(enc_list, strs);
+        return strs.size();
+    };
+    BENCHMARK("map<string, string>: bt_deserialize") {
+        bt_deserialize(enc_dict, dict);
+        return dict.size();
+    };
+    BENCHMARK("map<string, string>: bt_deserialize_reusing") {
+        bt_deserialize_reusing(enc_dict, dict);
+        return dict.size();
+    };
+}
+
+TEST_CASE("bt container pre-sizing benchmark", "[.][benchmark][bt][list]") {
+    std::vector<std::string> strs;
+    std::unordered_map<std::string, int> map;
+    for (int i = 0; i < 10000; i++) {
+        strs.push_back(std::string(32, static_cast<char>('a' + i % 26)));
+        map["key" + std::to_string(i)] = i;
+    }
+    auto enc_strs = bt_serialize(strs);
+    auto enc_map = bt_serialize(map);
+
+    BENCHMARK("vector<string>") {
+        return bt_deserialize<std::vector<std::string>>(enc_strs).size();
+    };
+    BENCHMARK("unordered_map<string, int>") {
+        return bt_deserialize<std::unordered_map<std::string, int>>(enc_map).size();
+    };
+    BENCHMARK("count only") {
+        return detail::bt_count_elements(std::string_view{enc_strs}.substr(1), false);
+    };
+}
+
+TEST_CASE("bt semantic equality and hashing benchmark", "[.][benchmark][bt][compare]") {
+    std::map<std::string, std::vector<int64_t>> dict;
+    for (int i = 0; i < 100; i++)
+        dict["key" + std::to_string(i)] = {i, -i, i * 1000};
+    auto a = bt_serialize(dict);
+    auto b = a;
+    b[b.size() - 4]++;  // different last value
+
+    BENCHMARK("bt_equal") { return bt_equal(a, b); };
+    BENCHMARK("decode + bt_value ==") { return bt_get(a) == bt_get(b); };
+    BENCHMARK("bt_hash") { return bt_hash(a); };
+    BENCHMARK("decode + std::hash<bt_value>") { return std::hash<bt_value>{}(bt_get(a)); };
+}
+
+TEST_CASE("bt path query benchmark", "[.][benchmark][bt][path]") {
+    bt_list swarm;
+    for (int i = 0; i < 20; i++)
+        swarm.push_back(bt_dict{
+                {"ip", "10.0.0." + std::to_string(i)},
+                {"port", 22000 + i},
+                {"pubkey", std::string(32, static_cast<char>('a' + i))}});
+    auto msg = bt_serialize(bt_dict{
+            {"id", 42},
+            {"result", bt_dict{{"hardfork", 19}, {"height", 1234567}, {"swarm", std::move(swarm)}}},
+            {"status", "OK"}});
+
+    const bt_path pubkey{"result.swarm[3].pubkey"};
+    BENCHMARK("bt_path") { return pubkey.find(msg)->size(); };
+    BENCHMARK("consumer chain") {
+        bt_dict_consumer d{msg};
+        d.required("result");
+        auto result = d.consume_dict_consumer();
+        result.required("swarm");
+        auto sw = result.consume_list_consumer();
+        for (int i = 0; i < 3; i++)
+            sw.skip_value();
+        auto node = sw.consume_dict_consumer();
+        node.required("pubkey");
+        return node.consume_string_view().size();
+    };
+    BENCHMARK("full decode") {
+        auto v = bt_get(msg);
+        auto& node = var::get<bt_dict>(*std::next(
+                var::get<bt_list>(var::get<bt_dict>(var::get<bt_dict>(v).at("result")).at("swarm"))
+                        .begin(),
+                3));
+        return var::get<std::string>(node.at("pubkey")).size();
+    };
+
+    const bt_path_set fields{"id", "result.height", "result.swarm[3].pubkey", "status"};
+    std::vector<std::optional<std::string_view>> vals;
+    BENCHMARK("bt_path_set, 4 paths") {
+        return fields.try_find(msg, vals).code;
+    };
+}
+
+TEST_CASE("bt encoded patching benchmark", "[.][benchmark][bt][patch]") {
+    bt_dict state;
+    for (int i = 0; i < 1000; i++)
+        state["entry" + std::to_string(i)] = bt_dict{{"id", i}, {"data", std::string(50, 'x')}};
+    state["count"] = 0;
+    auto blob = bt_serialize(state);
+    const bt_path count{"count"};
+
+    BENCHMARK("bt_path::set") { return count.set(blob, *count.get<int64_t>(blob) + 1); };
+    BENCHMARK("decode, modify, re-encode") {
+        auto v = bt_get(blob);
+        auto& n = var::get<bt_dict>(v)["count"];
+        n = var::get<uint64_t>(n) + 1;
+        blob = bt_serialize(v);
+        return blob.size();
+    };
+}
+
+TEST_CASE("bt dict merging benchmark", "[.][benchmark][bt][merge]") {
+    bt_dict defaults, overrides;
+    for (int i = 0; i < 200; i++) {
+        auto section = "section" + std::to_string(i);
+        bt_dict sub;
+        for (int j = 0; j < 10; j++)
+            sub["option" + std::to_string(j)] = std::string(20, 'x');
+        if (i % 10 == 0)
+            overrides[section] = bt_dict{{"option3", "changed"}};
+        defaults[section] = std::move(sub);
+    }
+    auto base = bt_serialize(defaults), overlay = bt_serialize(overrides);
+
+    BENCHMARK("bt_merge") { return bt_merge(base, overlay, {.recursive = true}).size(); };
+    BENCHMARK("decode, merge bt_dicts, re-encode") {
+        auto b = bt_deserialize<bt_dict>(base);
+        auto o = bt_deserialize<bt_dict>(overlay);
+        for (auto& [k, v] : o) {
+            auto& sub = var::get<bt_dict>(b[k]);
+            for (auto& [k2, v2] : var::get<bt_dict>(v))
+                sub[k2] = std::move(v2);
+        }
+        return bt_serialize(b).size();
+    };
+}
+
+TEST_CASE("bt dict diff and apply benchmark", "[.][benchmark][bt][diff]") {
+    bt_dict state;
+    for (int i = 0; i < 1000; i++)
+        state["node" + std::to_string(i)] =
+                bt_dict{{"height", 1000 + i}, {"pubkey", std::string(32, 'k')}, {"up", 1}};
+    auto old = bt_serialize(state);
+    var::get<bt_dict>(state["node17"])["height"] = 2000;
+    state.erase("node500");
+    auto now = bt_serialize(state);
+    auto delta = bt_diff(old, now);
+    REQUIRE(delta.size() < 64);
+
+    BENCHMARK("bt_diff") { return bt_diff(old, now).size(); };
+    BENCHMARK("bt_apply") { return bt_apply(old, delta).size(); };
+    BENCHMARK("decode + re-encode (for comparison)") {
+        return bt_serialize(bt_deserialize<bt_dict>(now)).size();
+    };
+}
+
+TEST_CASE("bt JSON transcoding benchmark", "[.][benchmark][bt][json]") {
+    bt_list nodes;
+    for (int i = 0; i < 500; i++)
+        nodes.push_back(bt_dict{
+                {"address", "10.0.0." + std::to_string(i % 256)},
+                {"height", 1000000 + i},
+                {"name", "node \"" + std::to_string(i) + "\""},
+                {"ports", bt_list{22020, 22021}}});
+    auto bt = bt_serialize(bt_dict{{"id", 17}, {"nodes", std::move(nodes)}});
+    auto json = bt_to_json(bt);
+    // The same object with "id" moved last, so that json_to_bt has to sort the top level
+    std::string reversed = "{";
+    reversed += json.substr(json.find("\"nodes\""), json.size() - json.find("\"nodes\"") - 1);
+    reversed += ",\"id\":17}";
+    REQUIRE(json_to_bt(reversed) == bt);
+
+    BENCHMARK("bt_to_json") { return bt_to_json(bt).size(); };
+    BENCHMARK("json_to_bt") { return json_to_bt(json).size(); };
+    BENCHMARK("json_to_bt (unsorted top level)") { return json_to_bt(reversed).size(); };
+    BENCHMARK("bt_get<bt_dict> + re-encode (for comparison)") {
+        return bt_serialize(bt_get(bt)).size();
+    };
+}
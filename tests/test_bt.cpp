@@ -1,8 +1,23 @@
+#include <deque>
 #include <limits>
 #include <map>
+#include <memory>
+#include <numeric>
+#include <random>
 #include <set>
+#include <unordered_set>
+#include <unordered_map>
+#include <sstream>
 
 #include "common.h"
+#include "oxenc/bt_parallel.h"
+#include "oxenc/bt_stream.h"
+
+#ifndef _WIN32
+#include <fstream>
+
+#include "oxenc/bt_mapped_file.h"
+#endif
 
 TEST_CASE("bt basic value serialization", "[bt][serialization]") {
     int x = 42;
@@ -640,6 +655,92 @@ TEST_CASE("bt append_signature", "[bt][signature]") {
     }
 }
 
+TEST_CASE("bt deferred signature verification", "[bt][signature]") {
+    // Signs with a fake "signature": the sum of the message bytes.
+    auto sign = [](std::string_view msg) {
+        return std::to_string(std::accumulate(msg.begin(), msg.end(), 0));
+    };
+    auto check = [&sign](std::string_view msg, std::string_view sig) { return sign(msg) == sig; };
+
+    std::vector<std::string> msgs;
+    for (int i = 0; i < 4; i++) {
+        bt_dict_producer d;
+        d.append("a", i);
+        d.append("b", std::string(static_cast<size_t>(i), 'x'));
+        d.append_signature("~", sign);
+        msgs.emplace_back(d.view());
+    }
+    bt_list_producer l;
+    l.append("hi");
+    l.append_signature(sign);
+    msgs.emplace_back(l.view());
+    msgs[2][5] = '9';  // Break the signature of message 2 (a=9 instead of a=2)
+
+    bt_signature_batch<char> batch;
+    std::vector<std::pair<int, size_t>> pending;
+    for (size_t i = 0; i < 4; i++) {
+        bt_dict_consumer d{msgs[i]};
+        auto a = d.require<int>("a");
+        if (i % 2)
+            d.skip_value();
+        auto ticket = i % 2 ? d.consume_signature(batch) : d.require_signature("~", batch);
+        pending.emplace_back(a, ticket);
+        CHECK(d.is_finished());
+    }
+    bt_list_consumer lc{msgs[4]};
+    lc.skip_value();
+    auto lticket = lc.consume_signature(batch);
+    CHECK(lc.is_finished());
+
+    REQUIRE(batch.size() == 5);
+    CHECK(batch.pending() == 5);
+    CHECK(batch.entries()[0].message == "d1:ai0e1:b0:");
+    CHECK(batch.entries()[0].signature == sign("d1:ai0e1:b0:"));
+    CHECK(batch.entries()[4].message == "l2:hi");
+    for (auto& [a, ticket] : pending)
+        CHECK_FALSE(batch.valid(ticket));  // Not verified yet
+
+    size_t batch_calls = 0;
+    auto batch_verify = [&](std::span<const bt_signature_batch<char>::entry> entries) {
+        ++batch_calls;
+        return std::all_of(entries.begin(), entries.end(), [&](auto& e) {
+            return check(e.message, e.signature);
+        });
+    };
+
+    SECTION("batch only") {
+        CHECK_FALSE(batch.verify(batch_verify));
+        for (auto& [a, ticket] : pending)
+            CHECK_FALSE(batch.valid(ticket));
+        CHECK_FALSE(batch.valid(lticket));
+    }
+    SECTION("batch with individual fallback") {
+        CHECK_FALSE(batch.verify(batch_verify, check));
+        CHECK(batch.pending() == 0);
+        CHECK_FALSE(batch.all_valid());
+        std::vector<int> accepted;
+        for (auto& [a, ticket] : pending)
+            if (batch.valid(ticket))
+                accepted.push_back(a);
+        CHECK(accepted == std::vector<int>{0, 1, 3});  // Not 9
+        CHECK(batch.valid(lticket));
+
+        // Later additions are verified separately
+        bt_dict_consumer d{msgs[3]};
+        auto t = d.require_signature("~", batch);
+        CHECK(batch.pending() == 1);
+        CHECK(batch.verify(batch_verify));
+        CHECK(batch.valid(t));
+        CHECK(batch_calls == 2);
+
+        batch.clear();
+        CHECK(batch.empty());
+        CHECK_FALSE(batch.valid(t));
+        CHECK(batch.verify(batch_verify));
+        CHECK(batch_calls == 2);
+    }
+}
+
 TEST_CASE("bt trailing garbage detection", "[bt][deserialization][trailing-garbage]") {
     REQUIRE_THROWS(bt_deserialize<bt_dict>("de🤔"));
     REQUIRE_NOTHROW(bt_deserialize<bt_dict>("de"));
@@ -668,6 +769,1772 @@ TEST_CASE("bt trailing garbage detection", "[bt][deserialization][trailing-garba
     REQUIRE_NOTHROW(dc3.finish());
 }
 
+TEST_CASE("bt non-throwing deserialization", "[bt][deserialization][try]") {
+    int x = 0;
+    CHECK_FALSE(try_bt_deserialize("i42e", x));
+    CHECK(x == 42);
+
+    CHECK(try_bt_deserialize("i42", x) == bt_error{bt_errc::unexpected_end, 3});
+    CHECK(try_bt_deserialize("i4x2e", x) == bt_error{bt_errc::invalid_value, 2});
+    CHECK(try_bt_deserialize("4:abcd", x) == bt_error{bt_errc::wrong_type, 0});
+    CHECK(try_bt_deserialize("i123ejunk", x) == bt_error{bt_errc::trailing_data, 5});
+    CHECK(try_bt_deserialize("i99999999999999999999e", x).code == bt_errc::integer_overflow);
+
+    uint8_t small;
+    CHECK(try_bt_deserialize("i256e", small) == bt_error{bt_errc::integer_range, 0});
+    CHECK(try_bt_deserialize("li1ei256ee", small).code == bt_errc::wrong_type);
+    std::vector<uint8_t> smalls;
+    CHECK(try_bt_deserialize("li1ei256ee", smalls) == bt_error{bt_errc::integer_range, 4});
+
+    std::string str;
+    CHECK(try_bt_deserialize("10:abc", str) == bt_error{bt_errc::string_length, 0});
+    std::pair<int, int> pair;
+    CHECK(try_bt_deserialize("li1ei2ei3ee", pair) == bt_error{bt_errc::tuple_size, 7});
+    std::variant<std::string, int> var;
+    CHECK(try_bt_deserialize("le", var) == bt_error{bt_errc::no_variant_match, 0});
+
+    bt_value val;
+    CHECK_FALSE(try_bt_get("d1:ali1ei2eee", val));
+    CHECK(try_bt_get("d1:ali1ei2eeX", val) == bt_error{bt_errc::wrong_type, 12});
+    CHECK(try_bt_get("d1:ali1ei2e", val) == bt_error{bt_errc::unexpected_end, 11});
+
+    // The throwing API reports the same failures via exceptions:
+    CHECK_THROWS_AS(bt_deserialize<int>("4:abcd"), bt_deserialize_invalid_type);
+    CHECK_THROWS_AS(bt_deserialize<uint8_t>("i256e"), bt_deserialize_invalid);
+
+    bt_list_consumer lc{"li1e3:abci-1eli2eed1:ai3eee"};
+    std::string_view sv;
+    CHECK(lc.try_consume_string_view(sv) == bt_error{bt_errc::wrong_type, 1});
+    unsigned u;
+    CHECK_FALSE(lc.try_consume_integer(u));
+    CHECK(u == 1);
+    CHECK(lc.try_consume_integer(u) == bt_error{bt_errc::wrong_type, 4});
+    CHECK_FALSE(lc.try_consume_string_view(sv));
+    CHECK(sv == "abc");
+    CHECK(lc.try_consume_integer(u) == bt_error{bt_errc::integer_range, 9});
+    int i;
+    CHECK_FALSE(lc.try_consume(i));
+    CHECK(i == -1);
+    std::vector<int> ints;
+    CHECK_FALSE(lc.try_consume_list(ints));
+    CHECK(ints == std::vector{2});
+    CHECK_FALSE(lc.try_finish());
+
+    bt_list_consumer bad{"li1e3:xe"};
+    CHECK_FALSE(bad.try_skip_value());
+    CHECK(bad.try_skip_value() == bt_error{bt_errc::string_length, 4});
+    CHECK(bad.try_finish() == bt_error{bt_errc::string_length, 4});
+
+    bt_dict_consumer dc{"d1:ai1e1:b3:xyz1:cli1ei2eee"};
+    CHECK(dc.try_required("0") == bt_error{bt_errc::key_not_found, 3});
+    CHECK(dc.try_require("b", i) == bt_error{bt_errc::wrong_type, 10});
+    std::optional<std::string> maybe_str;
+    CHECK_FALSE(dc.try_maybe("b", maybe_str));
+    CHECK(maybe_str == "xyz");
+    CHECK_FALSE(dc.try_maybe("bb", maybe_str));
+    CHECK_FALSE(maybe_str);
+    std::tuple<int, int> tup;
+    CHECK_FALSE(dc.try_require("c", tup));
+    CHECK(tup == std::tuple{1, 2});
+    CHECK(dc.try_consume_integer(i).code == bt_errc::wrong_type);
+    CHECK_FALSE(dc.try_finish());
+
+    bt_dict_consumer dc2{"d1:ai1e1:b"};
+    CHECK(dc2.try_finish() == bt_error{bt_errc::unexpected_end, 10});
+    CHECK(dc2.key() == "a");
+    CHECK_THROWS_AS(dc2.finish(), bt_deserialize_invalid);
+}
+
+TEST_CASE("bt integer and string length parsing", "[bt][deserialization][integer]") {
+    // Values of every digit count, both at the end of the buffer and followed by more data (so
+    // that both the 8-byte and the byte-at-a-time paths get exercised).
+    uint64_t v = 0;
+    for (int digits = 1; digits <= 20; digits++) {
+        v = v * 10 + static_cast<uint64_t>(digits % 10);
+        auto enc = bt_serialize(v);
+        CHECK(bt_deserialize<uint64_t>(enc) == v);
+        CHECK(bt_deserialize<std::vector<uint64_t>>(bt_serialize(std::vector{v, v})) ==
+              std::vector<uint64_t>{v, v});
+    }
+
+    CHECK(bt_deserialize<uint64_t>("i18446744073709551615e") ==
+          std::numeric_limits<uint64_t>::max());
+    CHECK(bt_deserialize<uint64_t>("i000000000000000000000000000018446744073709551615e") ==
+          std::numeric_limits<uint64_t>::max());
+    CHECK(bt_deserialize<int>("i-0000000000000000000042e") == -42);
+    CHECK(bt_deserialize<int>("i00e") == 0);
+
+    int64_t i;
+    uint64_t u;
+    CHECK(try_bt_deserialize("i18446744073709551616e", u).code == bt_errc::integer_overflow);
+    CHECK(try_bt_deserialize("i18446744073709551620e", u).code == bt_errc::integer_overflow);
+    CHECK(try_bt_deserialize("i90000000000000000000e", u).code == bt_errc::integer_overflow);
+    CHECK(try_bt_deserialize("i100000000000000000000e", u).code == bt_errc::integer_overflow);
+    CHECK(try_bt_deserialize("i-9223372036854775809e", i).code == bt_errc::integer_overflow);
+    CHECK(try_bt_deserialize("i-99999999999999999999e", i).code == bt_errc::integer_overflow);
+    CHECK(try_bt_deserialize("iee", i) == bt_error{bt_errc::invalid_value, 1});
+    CHECK(try_bt_deserialize("i-e", i) == bt_error{bt_errc::invalid_value, 2});
+    CHECK(try_bt_deserialize("i12345678x1234e", i) == bt_error{bt_errc::invalid_value, 9});
+
+    std::string long_str(123456, 'x');
+    CHECK(bt_deserialize<std::string>(bt_serialize(long_str)) == long_str);
+    CHECK(bt_deserialize<std::string>("00000000003:abc") == "abc");
+    std::string_view sv;
+    CHECK(try_bt_deserialize("99999999999999999999999:x", sv).code == bt_errc::integer_overflow);
+    CHECK(try_bt_deserialize("12345678901:x", sv) == bt_error{bt_errc::string_length, 0});
+}
+
+TEST_CASE("bt validation", "[bt][validate]") {
+    CHECK_FALSE(bt_validate("i42e"));
+    CHECK_FALSE(bt_validate("0:"));
+    CHECK_FALSE(bt_validate("le"));
+    CHECK_FALSE(bt_validate("d1:ai1e1:bl3:abcdeee"));
+    CHECK_FALSE(bt_validate(bt_serialize(std::vector{1, 2, 3})));
+
+    CHECK(bt_validate("") == bt_error{bt_errc::unexpected_end, 0});
+    CHECK(bt_validate("li1e") == bt_error{bt_errc::unexpected_end, 4});
+    CHECK(bt_validate("i1ei2e") == bt_error{bt_errc::trailing_data, 3});
+    CHECK(bt_validate("lxe") == bt_error{bt_errc::invalid_value, 1});
+    CHECK(bt_validate("d1:ae") == bt_error{bt_errc::invalid_value, 4});
+    CHECK(bt_validate("di1ei2ee") == bt_error{bt_errc::wrong_type, 1});
+    CHECK(bt_validate("l5:abce") == bt_error{bt_errc::string_length, 1});
+    CHECK(bt_validate("li99999999999999999999ee").code == bt_errc::integer_overflow);
+
+    // Depth: each list/dict is one level
+    CHECK_FALSE(bt_validate("lllleeee", {.max_depth = 4}));
+    CHECK(bt_validate("lllleeee", {.max_depth = 3}) == bt_error{bt_errc::depth_limit, 3});
+    CHECK(bt_validate("le", {.max_depth = 0}) == bt_error{bt_errc::depth_limit, 0});
+    CHECK_FALSE(bt_validate("i0e", {.max_depth = 0}));
+    std::string deep(1000, 'l');
+    deep.append(1000, 'e');
+    CHECK(bt_validate(deep).code == bt_errc::depth_limit);
+    CHECK(bt_validate(deep, {.max_depth = 100000}) ==
+          bt_error{bt_errc::depth_limit, bt_validate_limits::max_depth_cap});
+    // By default exactly what bt_get accepts is valid
+    std::string at_limit(bt_default_max_depth, 'l');
+    at_limit.append(bt_default_max_depth, 'e');
+    CHECK_FALSE(bt_validate(at_limit));
+    CHECK_NOTHROW(bt_get(at_limit));
+    CHECK(bt_validate("l" + at_limit + "e") ==
+          bt_error{bt_errc::depth_limit, bt_default_max_depth});
+    CHECK_THROWS_AS(bt_get("l" + at_limit + "e"), bt_deserialize_invalid);
+
+    // Elements counts every value (including the outer one) but not dict keys
+    CHECK_FALSE(bt_validate("d1:ai1e1:bli2ei3eee", {.max_elements = 5}));
+    CHECK(bt_validate("d1:ai1e1:bli2ei3eee", {.max_elements = 4}) ==
+          bt_error{bt_errc::element_limit, 14});
+
+    // String limits apply to keys as well as values
+    CHECK_FALSE(bt_validate("d3:abc3:defe", {.max_string_length = 3}));
+    CHECK(bt_validate("d3:abc4:defge", {.max_string_length = 3}) ==
+          bt_error{bt_errc::string_limit, 6});
+    CHECK(bt_validate("d4:abcd3:defe", {.max_string_length = 3}) ==
+          bt_error{bt_errc::string_limit, 1});
+
+    // Non-canonical encodings are accepted unless canonical checking is requested
+    for (std::string_view nc :
+         {"i-0e", "i01e", "i-01e", "01:a", "d1:bi1e1:ai2ee", "d1:ai1e1:ai2ee"}) {
+        CHECK_FALSE(bt_validate(nc));
+        CHECK(bt_validate(nc, {.canonical = true}).code == bt_errc::not_canonical);
+    }
+    CHECK(bt_validate("d1:a0:1:a0:e", {.canonical = true}) == bt_error{bt_errc::not_canonical, 6});
+    CHECK_FALSE(bt_validate("d0:i0e1:ai-1e2:aai10e1:b0:e", {.canonical = true}));
+    CHECK_FALSE(bt_validate("ld1:ai1eed1:ai1eee", {.canonical = true}));
+
+    // Everything bt_serialize produces is canonical
+    bt_dict d{{"z", 1}, {"a", bt_list{-3, "xyz", bt_dict{{"", 0}}}}, {"m", ""}};
+    CHECK_FALSE(bt_validate(bt_serialize(d), {.canonical = true}));
+}
+
+TEST_CASE("bt iterative decoding and skipping", "[bt][deserialization][depth]") {
+    auto v = bt_get("d1:ali1eld1:bi-2eeee1:c3:xyz1:di18446744073709551615ee");
+    auto& d = var::get<bt_dict>(v);
+    REQUIRE(d.size() == 3);
+    auto& a = var::get<bt_list>(d["a"]);
+    REQUIRE(a.size() == 2);
+    CHECK(var::get<uint64_t>(a.front()) == 1);
+    auto& inner = var::get<bt_list>(a.back());
+    REQUIRE(inner.size() == 1);
+    CHECK(var::get<int64_t>(var::get<bt_dict>(inner.front())["b"]) == -2);
+    CHECK(var::get<std::string>(d["c"]) == "xyz");
+    CHECK(var::get<uint64_t>(d["d"]) == std::numeric_limits<uint64_t>::max());
+
+    // Duplicate keys are decoded but dropped: the first value wins
+    auto dup = var::get<bt_dict>(bt_get("d1:ai1e1:ali2ee1:bi3ee"));
+    CHECK(dup.size() == 2);
+    CHECK(var::get<uint64_t>(dup["a"]) == 1);
+    CHECK(bt_deserialize<std::map<std::string, int>>("d1:ai1e1:ai2ee") ==
+          std::map<std::string, int>{{"a", 1}});
+
+    bt_value val;
+    CHECK(try_bt_get("d1:ali1e", val) == bt_error{bt_errc::unexpected_end, 8});
+    CHECK(try_bt_get("d1:ae", val) == bt_error{bt_errc::invalid_value, 4});
+    CHECK(try_bt_get("lli1exe", val) == bt_error{bt_errc::invalid_value, 5});
+    CHECK(try_bt_get("di1ei2ee", val) == bt_error{bt_errc::wrong_type, 1});
+    CHECK(try_bt_get("lei1e", val) == bt_error{bt_errc::trailing_data, 2});
+
+    // Hostile nesting fails cleanly rather than exhausting the stack
+    std::string deep(300000, 'l');
+    deep.append(300000, 'e');
+    CHECK(try_bt_get(deep, val) == bt_error{bt_errc::depth_limit, bt_default_max_depth});
+    CHECK_THROWS_AS(bt_get(deep), bt_deserialize_invalid);
+    std::string_view sv{deep};
+    CHECK(detail::bt_skip_value(sv) == bt_errc::depth_limit);
+    CHECK(sv.size() == deep.size() - bt_default_max_depth);
+    sv = deep;
+    CHECK(detail::bt_skip_value(sv, 1000000) == bt_errc::depth_limit);
+    CHECK(sv.size() == deep.size() - bt_max_skip_depth);
+    bt_list_consumer deep_list{deep};
+    CHECK(deep_list.try_skip_value() == bt_error{bt_errc::depth_limit, bt_max_skip_depth + 1});
+
+    // The consumers skip through anything up to bt_max_skip_depth, beyond the decoding default
+    std::string skippable = "l" + std::string(600, 'l') + std::string(600, 'e') + "e";
+    bt_list_consumer skip_list{skippable};
+    CHECK_NOTHROW(skip_list.skip_value());
+    CHECK(skip_list.is_finished());
+    bt_list_consumer data_list{skippable};
+    CHECK(data_list.consume_list_data().size() == 1200);
+    CHECK_NOTHROW(bt_list_consumer{skippable}.finish());
+
+    // The depth limit is configurable, and counts lists and dicts alike
+    CHECK_FALSE(try_bt_get("ld1:aleee", val, 3));
+    CHECK(try_bt_get("ld1:aleee", val, 2) == bt_error{bt_errc::depth_limit, 5});
+    CHECK_FALSE(try_bt_get("i1e", val, 0));
+    std::string ok_deep(1000, 'l');
+    ok_deep.append(1000, 'e');
+    CHECK_FALSE(try_bt_get(ok_deep, val, 1000));
+    sv = ok_deep;
+    CHECK(detail::bt_skip_value(sv, 1000) == bt_errc::ok);
+    CHECK(sv.empty());
+    for (size_t depth = 0; depth < 1000; depth++) {
+        REQUIRE(var::holds_alternative<bt_list>(val));
+        auto& l = var::get<bt_list>(val);
+        if (depth < 999) {
+            REQUIRE(l.size() == 1);
+            bt_value next = std::move(l.front());
+            val = std::move(next);
+        } else {
+            CHECK(l.empty());
+        }
+    }
+
+    // Skipping alternates correctly between list and dict frames
+    sv = "ld1:ald1:bleee1:cli1eeee2:xx";
+    CHECK(detail::bt_skip_value(sv) == bt_errc::ok);
+    CHECK(sv == "2:xx");
+    sv = "ldl1:ae1:bee";
+    CHECK(detail::bt_skip_value(sv) == bt_errc::wrong_type);  // dict keys must be strings
+}
+
+namespace {
+// Reassembles bt_push_parser events back into an encoded value.
+struct push_reencoder {
+    std::string out;
+    size_t max_depth = 0;
+    void operator()(const bt_push_event& ev) {
+        max_depth = std::max(max_depth, ev.depth);
+        switch (ev.type) {
+            case bt_push_event::kind::list_begin: out += 'l'; break;
+            case bt_push_event::kind::dict_begin: out += 'd'; break;
+            case bt_push_event::kind::end: out += 'e'; break;
+            case bt_push_event::kind::integer:
+                out += ev.negative ? bt_serialize(ev.i64) : bt_serialize(ev.u64);
+                break;
+            case bt_push_event::kind::key:
+            case bt_push_event::kind::string:
+                if (ev.offset == 0) {
+                    out += std::to_string(ev.size);
+                    out += ':';
+                }
+                out += ev.data;
+                break;
+        }
+    }
+};
+}  // namespace
+
+TEST_CASE("bt push parser", "[bt][push]") {
+    std::string msg = bt_serialize(bt_dict{
+            {"", ""},
+            {"a", bt_list{1, -2, std::numeric_limits<int64_t>::min(), bt_list{}, bt_dict{}}},
+            {"long", std::string(1000, 'x')},
+            {"max", std::numeric_limits<uint64_t>::max()},
+            {"nested", bt_dict{{"x", bt_list{bt_list{"y"}}}}}});
+
+    // Any way of splitting up the message gives the same events
+    for (size_t chunk_size : {1, 2, 3, 7, 64, 100000}) {
+        bt_push_parser parser;
+        push_reencoder h;
+        std::string_view in{msg};
+        while (!in.empty() && !parser.complete()) {
+            auto chunk = in.substr(0, chunk_size);
+            REQUIRE(parser.feed(chunk, h) == chunk.size());
+            REQUIRE_FALSE(parser.failed());
+            in.remove_prefix(chunk.size());
+        }
+        CHECK(parser.complete());
+        CHECK(parser.status() == bt_push_status::complete);
+        CHECK(parser.consumed() == msg.size());
+        CHECK(h.out == msg);
+        CHECK(h.max_depth == 4);
+    }
+
+    // Completion is reported partway through a chunk; the rest belongs to the next message
+    std::string two = "li1e3:abce" "4:next";
+    bt_push_parser parser;
+    CHECK(parser.feed(std::string_view{two}.substr(0, 7)) == 7);
+    CHECK(parser.status() == bt_push_status::need_more);
+    CHECK(parser.depth() == 1);
+    CHECK(parser.feed(std::string_view{two}.substr(7)) == 3);
+    CHECK(parser.complete());
+    CHECK(parser.consumed() == 10);
+    CHECK(parser.feed("i1e") == 0);
+    parser.reset();
+    push_reencoder h;
+    CHECK(parser.feed(std::string_view{two}.substr(10), h) == 6);
+    CHECK(parser.complete());
+    CHECK(h.out == "4:next");
+
+    // Byte spans work too
+    parser.reset();
+    std::vector<unsigned char> bytes{'i', '-', '4', '2', 'e'};
+    h.out.clear();
+    CHECK(parser.feed(std::span<const unsigned char>{bytes}, h) == 5);
+    CHECK(h.out == "i-42e");
+
+    // Errors report the offset from the start of the message, however the message was split
+    auto error_for = [](std::string_view in, size_t max_depth = bt_default_max_depth) {
+        bt_push_parser p{max_depth};
+        for (auto c : in)
+            if (p.feed(std::string_view{&c, 1}) != 1)
+                break;
+        bt_push_parser p2{max_depth};
+        p2.feed(in);
+        REQUIRE(p.error() == p2.error());
+        return p.failed() ? p.error() : bt_error{};
+    };
+    CHECK(error_for("li1ex") == bt_error{bt_errc::invalid_value, 4});
+    CHECK(error_for("d1:ae") == bt_error{bt_errc::invalid_value, 4});
+    CHECK(error_for("di1ei2ee") == bt_error{bt_errc::wrong_type, 1});
+    CHECK(error_for("i-e") == bt_error{bt_errc::invalid_value, 2});
+    CHECK(error_for("iee") == bt_error{bt_errc::invalid_value, 1});
+    CHECK(error_for("i12a") == bt_error{bt_errc::invalid_value, 3});
+    CHECK(error_for("3x") == bt_error{bt_errc::invalid_value, 1});
+    CHECK(error_for("i18446744073709551616e") == bt_error{bt_errc::integer_overflow, 20});
+    CHECK(error_for("i-9223372036854775809e") == bt_error{bt_errc::integer_overflow, 21});
+    CHECK_FALSE(error_for("i-9223372036854775808e"));
+    CHECK(error_for("llleee", 2) == bt_error{bt_errc::depth_limit, 2});
+    CHECK_FALSE(error_for("llleee", 3));
+    CHECK_FALSE(error_for("li1e"));  // Incomplete, but not an error
+}
+
+namespace bt_struct_test {
+struct Endpoint {
+    std::string host;
+    std::optional<uint16_t> port;
+};
+OXENC_BT_FIELDS(Endpoint, host, port);
+
+struct Peer {
+    std::string_view pubkey;
+    int version = 1;
+    std::vector<Endpoint> endpoints;
+    std::optional<Endpoint> primary;
+    std::list<std::string> tags;
+};
+constexpr auto bt_fields(std::type_identity<Peer>) {
+    using namespace oxenc;
+    // Deliberately not in key order
+    return std::tuple<
+            bt_field<"k", &Peer::pubkey>,
+            bt_optional_field<"v", &Peer::version>,
+            bt_field<"e", &Peer::endpoints>,
+            bt_field<"p", &Peer::primary>,
+            bt_optional_field<"#", &Peer::tags>>{};
+}
+
+struct Reversed {
+    std::map<std::string, int, std::greater<>> m;
+};
+OXENC_BT_FIELDS(Reversed, m);
+
+struct Setting {
+    std::string name;
+    int level = 3;
+    bool operator==(const Setting&) const = default;
+};
+constexpr auto bt_fields(std::type_identity<Setting>) {
+    using namespace oxenc;
+    return std::tuple<bt_field<"n", &Setting::name>, bt_optional_field<"l", &Setting::level>>{};
+}
+}  // namespace bt_struct_test
+
+TEST_CASE("bt struct binding", "[bt][struct]") {
+    using namespace bt_struct_test;
+    static_assert(bt_struct_type<Peer>);
+    static_assert(!bt_struct_type<bt_dict>);
+
+    auto enc = bt_serialize(bt_dict{
+            {"#", bt_list{"a", "b"}},
+            {"e", bt_list{bt_dict{{"host", "example.com"}, {"port", 443}}, bt_dict{{"host", "h"}}}},
+            {"k", "KEY"},
+            {"unknown", bt_dict{{"x", bt_list{1, 2}}}},
+            {"v", 3}});
+    auto peer = bt_deserialize<Peer>(enc);
+    CHECK(peer.pubkey == "KEY");
+    CHECK(peer.pubkey.data() >= enc.data());  // string_view members point into the input
+    CHECK(peer.version == 3);
+    REQUIRE(peer.endpoints.size() == 2);
+    CHECK(peer.endpoints[0].host == "example.com");
+    CHECK(peer.endpoints[0].port == 443);
+    CHECK(peer.endpoints[1].host == "h");
+    CHECK_FALSE(peer.endpoints[1].port);
+    CHECK_FALSE(peer.primary);
+    CHECK(peer.tags == std::list<std::string>{"a", "b"});
+
+    // Absent std::optional fields are reset, absent bt_optional_fields are left alone
+    Peer p2;
+    p2.version = 7;
+    p2.primary.emplace();
+    CHECK_FALSE(try_bt_deserialize("d1:ele1:k0:1:pd4:host1:xee", p2));
+    CHECK(p2.version == 7);
+    REQUIRE(p2.primary);
+    CHECK(p2.primary->host == "x");
+    CHECK_FALSE(try_bt_deserialize("d1:ele1:k0:e", p2));
+    CHECK_FALSE(p2.primary);
+
+    // Required fields
+    CHECK(try_bt_deserialize("d1:ele1:k0:e", p2) == bt_error{});
+    CHECK(try_bt_deserialize("d1:ele1:pdee", p2) == bt_error{bt_errc::key_not_found, 6});
+    CHECK(try_bt_deserialize("d1:ele1:k0:1:pdee", p2) == bt_error{bt_errc::key_not_found, 15});
+    CHECK(try_bt_deserialize("d1:k0:e", p2) == bt_error{bt_errc::key_not_found, 1});
+    CHECK(try_bt_deserialize("d1:#le1:ele1:k0:", p2) == bt_error{bt_errc::unexpected_end, 16});
+    CHECK_THROWS_AS(bt_deserialize<Endpoint>("d4:porti1ee"), std::out_of_range);
+
+    // Wrong types, bad values, and unsorted keys
+    CHECK(try_bt_deserialize("le", p2) == bt_error{bt_errc::wrong_type, 0});
+    CHECK(try_bt_deserialize("d1:ei1e1:k0:e", p2) == bt_error{bt_errc::wrong_type, 4});
+    Endpoint ep;
+    CHECK(try_bt_deserialize("d4:host0:4:porti70000ee", ep) ==
+          bt_error{bt_errc::integer_range, 15});
+    CHECK(try_bt_deserialize("d4:porti1e4:host0:e", ep) == bt_error{bt_errc::key_not_found, 1});
+    CHECK(try_bt_deserialize("d4:host0:4:porti1e4:host0:e", ep) ==
+          bt_error{bt_errc::not_canonical, 18});
+    CHECK(try_bt_deserialize("d4:host0:4:host0:e", ep) == bt_error{bt_errc::not_canonical, 9});
+    CHECK(try_bt_deserialize("d4:host0:4:porte", ep) == bt_error{bt_errc::invalid_value, 15});
+
+    // Works with the consumers, too
+    auto nested = bt_serialize(bt_dict{{"a", 1}, {"ep", bt_dict{{"host", "z"}}}});
+    bt_dict_consumer dc{nested};
+    CHECK(dc.require<Endpoint>("ep").host == "z");
+    bt_list_consumer lc{"ld4:host1:aed4:host1:b4:porti2eee"};
+    CHECK(lc.consume<Endpoint>().host == "a");
+    CHECK(lc.try_consume(ep) == bt_error{});
+    CHECK(ep.port == 2);
+}
+
+TEST_CASE("bt struct serialization", "[bt][struct][producer]") {
+    using namespace bt_struct_test;
+    static_assert(bt_field<"host", &Endpoint::host>::encoded_key == "4:host");
+
+    Peer peer;
+    peer.pubkey = "KEY";
+    peer.version = -12;
+    peer.endpoints = {{"example.com", 443}, {"h", std::nullopt}};
+    peer.tags = {"a", "b"};
+    auto expected = bt_serialize(bt_dict{
+            {"#", bt_list{"a", "b"}},
+            {"e", bt_list{bt_dict{{"host", "example.com"}, {"port", 443}}, bt_dict{{"host", "h"}}}},
+            {"k", "KEY"},
+            {"v", -12}});
+
+    auto enc = bt_serialize(peer);
+    CHECK(enc == expected);
+    CHECK(bt_serialized_size(peer) == enc.size());
+    auto back = bt_deserialize<Peer>(enc);
+    CHECK(back.version == -12);
+    CHECK(bt_serialize(back) == enc);
+
+    peer.primary = Endpoint{"p", 0};
+    enc = bt_serialize(peer);
+    CHECK(enc.ends_with("1:pd4:host1:p4:porti0ee1:vi-12ee"));
+    CHECK(bt_serialized_size(peer) == enc.size());
+
+    // Nested inside generically serialized containers
+    CHECK(bt_serialize(std::vector<Endpoint>{{"a", 1}}) == "ld4:host1:a4:porti1eee");
+
+    // Maps not in bt key order get sorted
+    Reversed r{{{"a", 1}, {"b", 2}}};
+    CHECK(bt_serialize(r) == "d1:md1:ai1e1:bi2eee");
+    CHECK(bt_serialized_size(r) == 19);
+
+    // Into a fixed buffer
+    char buf[64];
+    Endpoint ep{"x", 65535};
+    auto* end = bt_serialize_to(ep, buf, buf + sizeof(buf));
+    CHECK(std::string_view{buf, static_cast<size_t>(end - buf)} == "d4:host1:x4:porti65535ee");
+    CHECK_THROWS_AS(bt_serialize_to(ep, buf, buf + 23), std::length_error);
+    CHECK(bt_serialize_to(ep, buf, buf + 24) == buf + 24);
+
+    // Appended to producers
+    auto external_buffer = GENERATE(true, false);
+    auto lp = external_buffer ? bt_list_producer{buf, sizeof(buf)} : bt_list_producer{};
+    lp.append_struct(ep);
+    lp.append(1);
+    CHECK(lp.view() == "ld4:host1:x4:porti65535eei1ee");
+
+    auto dp = external_buffer ? bt_dict_producer{buf, sizeof(buf)} : bt_dict_producer{};
+    dp.append("a", 1);
+    dp.append_struct("ep", Endpoint{"y", std::nullopt});
+    dp.append("z", 2);
+    CHECK(dp.view() == "d1:ai1e2:epd4:host1:ye1:zi2ee");
+
+    auto dp2 = external_buffer ? bt_dict_producer{buf, sizeof(buf)} : bt_dict_producer{};
+    dp2.append("a", 1);
+    dp2.append_fields(ep);
+    dp2.append("z", 2);
+    CHECK(dp2.view() == "d1:ai1e4:host1:x4:porti65535e1:zi2ee");
+
+    if (external_buffer) {
+        bt_list_producer toosmall{buf, 20};
+        CHECK_THROWS_AS(toosmall.append_struct(ep), std::length_error);
+        CHECK(toosmall.view() == "le");
+    }
+}
+
+TEST_CASE("bt dict key dispatch", "[bt][dict][consumer]") {
+    auto enc = bt_serialize(bt_dict{
+            {"a", 1},
+            {"b", "hello"},
+            {"c", bt_list{1, 2, 3}},
+            {"d", bt_dict{{"x", 1}}},
+            {"zz", -4}});
+
+    int64_t a = 0, zz = 0;
+    std::string_view b;
+    std::vector<int> c;
+    std::vector<std::string> others;
+    consume_dict_dispatch(
+            bt_dict_consumer{enc},
+            bt_on<"zz">([&](int64_t v) { zz = v; }),
+            bt_on<"b">([&](std::string_view v) { b = v; }),
+            bt_on<"a">([&](bt_dict_consumer& d) { a = d.consume_integer<int64_t>(); }),
+            bt_on<"c">([&](std::vector<int> v) { c = std::move(v); }),
+            bt_on_other([&](std::string_view key, bt_dict_consumer&) {
+                others.emplace_back(key);
+            }));
+    CHECK(a == 1);
+    CHECK(b == "hello");
+    CHECK(c == std::vector<int>{1, 2, 3});
+    CHECK(zz == -4);
+    CHECK(others == std::vector<std::string>{"d"});
+
+    // Unknown keys and unconsumed values are skipped; the consumer ends at the end of the dict
+    bt_dict_consumer d{enc};
+    int seen = 0;
+    consume_dict_dispatch(
+            d,
+            bt_on<"c">([&](bt_dict_consumer&) { ++seen; }),
+            bt_on<"d">([&](bt_dict_consumer& d) {
+                CHECK(d.consume_dict_consumer().require<int>("x") == 1);
+                ++seen;
+            }));
+    CHECK(seen == 2);
+    CHECK(d.is_finished());
+    CHECK_NOTHROW(d.finish());
+
+    // Unsorted input still dispatches every key
+    std::vector<std::string> order;
+    auto record = [&](std::string_view k) { return [&order, k](int) { order.emplace_back(k); }; };
+    consume_dict_dispatch(
+            bt_dict_consumer{"d1:bi1e1:ai2e1:ci3e1:ai4ee"},
+            bt_on<"a">(record("a")),
+            bt_on<"b">(record("b")),
+            bt_on<"c">(record("c")));
+    CHECK(order == std::vector<std::string>{"b", "a", "c", "a"});
+
+    // Errors propagate
+    CHECK_THROWS_AS(
+            consume_dict_dispatch(bt_dict_consumer{"d1:a1:xe"}, bt_on<"a">([](int) {})),
+            bt_deserialize_invalid_type);
+    CHECK_THROWS_AS(
+            consume_dict_dispatch(bt_dict_consumer{"d1:ai1e1:b"}, bt_on<"a">([](int) {})),
+            bt_deserialize_invalid);
+}
+
+namespace bt_parallel_test {
+// An integer whose decoding throws for a multiple of 100
+struct picky {
+    int64_t value;
+};
+}  // namespace bt_parallel_test
+
+template <>
+struct oxenc::detail::bt_deserialize<bt_parallel_test::picky> {
+    bt_errc operator()(std::string_view& s, bt_parallel_test::picky& val) {
+        if (auto ec = bt_deserialize<int64_t>{}(s, val.value); ec != bt_errc::ok)
+            return ec;
+        if (val.value % 100 == 0)
+            throw std::runtime_error{"picky " + std::to_string(val.value)};
+        return bt_errc::ok;
+    }
+};
+
+TEST_CASE("bt parallel list decoding", "[bt][list][parallel]") {
+    using namespace bt_struct_test;
+    std::vector<Endpoint> eps;
+    for (int i = 0; i < 1000; i++)
+        eps.push_back(
+                {"host" + std::to_string(i),
+                 i % 3 ? std::nullopt : std::optional<uint16_t>(static_cast<uint16_t>(i))});
+    auto enc = bt_serialize(eps);
+
+    bt_parallel_options opts{.threads = 4, .min_bytes_per_thread = 1};
+    auto decoded = bt_deserialize_parallel<Endpoint>(enc, opts);
+    REQUIRE(decoded.size() == eps.size());
+    for (size_t i = 0; i < eps.size(); i++) {
+        CHECK(decoded[i].host == eps[i].host);
+        CHECK(decoded[i].port == eps[i].port);
+    }
+    CHECK(bt_deserialize_parallel<int>("li1ei2ei3ee", opts) == std::vector<int>{1, 2, 3});
+    CHECK(bt_deserialize_parallel<int>("le", opts).empty());
+    // Default options (too small for more than one thread)
+    CHECK(bt_deserialize_parallel<std::string>("l1:a2:bce") == std::vector<std::string>{"a", "bc"});
+
+    // Errors match the sequential decoder's exactly
+    auto same_as_sequential = [&](std::string in) {
+        std::vector<Endpoint> seq, par;
+        auto seq_err = try_bt_deserialize(in, seq);
+        auto par_err = try_bt_deserialize_parallel(in, par, opts);
+        CHECK(par_err == seq_err);
+        CHECK(par.size() == seq.size());
+        return par_err;
+    };
+    CHECK_FALSE(same_as_sequential(enc));
+    auto bad = enc;
+    bad.replace(bad.find("d4:host7:host500"), 1, "l");  // A list element instead of a dict
+    CHECK(same_as_sequential(bad).code == bt_errc::wrong_type);
+    bad = enc;
+    bad.replace(bad.find("4:porti999e"), 11, "4:porti-99e");  // Out of range
+    bad.replace(bad.find("4:porti600e"), 11, "4:porti-60e");  // (and a later one)
+    CHECK(same_as_sequential(bad).code == bt_errc::integer_range);
+    bad = enc;
+    bad.replace(bad.find("7:host700"), 1, "x");  // Structurally invalid
+    CHECK(same_as_sequential(bad).code == bt_errc::wrong_type);
+    CHECK(same_as_sequential(enc.substr(0, enc.size() - 1)).code == bt_errc::unexpected_end);
+    CHECK(same_as_sequential(enc + "e").code == bt_errc::trailing_data);
+    CHECK(same_as_sequential("d1:ai1ee").code == bt_errc::wrong_type);
+    CHECK(same_as_sequential("").code == bt_errc::unexpected_end);
+
+    std::vector<Endpoint> partial;
+    CHECK(try_bt_deserialize_parallel(bad, partial, opts).code == bt_errc::wrong_type);
+    CHECK(partial.size() == 700);
+    CHECK_THROWS_AS(bt_deserialize_parallel<Endpoint>(bad, opts), bt_deserialize_invalid);
+
+    // Bools (decoded sequentially, as std::vector<bool> elements can't be written concurrently)
+    std::vector<bool> bools;
+    for (int i = 0; i < 1000; i++)
+        bools.push_back(i % 3 == 0);
+    CHECK(bt_deserialize_parallel<bool>(bt_serialize(bools), opts) == bools);
+
+    // Whether the first failure in element order is an error or an exception, that is the one we
+    // get, even when a later thread also fails
+    using bt_parallel_test::picky;
+    auto picky_list = [](size_t error_at, size_t throw_at) {
+        std::string enc = "l";
+        for (size_t i = 0; i < 1000; i++) {
+            if (i == error_at) {
+                enc += "1:x";
+                continue;
+            }
+            enc += 'i';
+            enc += std::to_string(i == throw_at ? i * 100 : i * 100 + 1);
+            enc += 'e';
+        }
+        return enc + "e";
+    };
+    std::vector<picky> pickies;
+    CHECK(try_bt_deserialize_parallel(picky_list(5, 900), pickies, opts).code ==
+          bt_errc::wrong_type);
+    CHECK(pickies.size() == 5);
+    CHECK_THROWS_WITH(
+            try_bt_deserialize_parallel(picky_list(900, 5), pickies, opts), "picky 500");
+    CHECK_THROWS_WITH(
+            try_bt_deserialize_parallel(picky_list(1000, 990), pickies, opts), "picky 99000");
+}
+
+#ifndef _WIN32
+TEST_CASE("bt memory-mapped files", "[bt][mmap]") {
+    auto dir = std::filesystem::temp_directory_path();
+    auto path = dir / ("oxenc-test-" + std::to_string(::getpid()) + ".bt");
+    auto write = [&path](std::string_view data) {
+        std::ofstream f{path, std::ios::binary | std::ios::trunc};
+        f.write(data.data(), static_cast<std::streamsize>(data.size()));
+    };
+
+    std::string big(100000, 'x');
+    auto enc = bt_serialize(bt_dict{{"a", 1}, {"big", big}, {"list", bt_list{1, 2, 3}}});
+    write(enc);
+    {
+        bt_mapped_file f{path};
+        CHECK(f.size() == enc.size());
+        CHECK(f.view() == enc);
+        auto d = f.dict_consumer();
+        CHECK(d.require<int>("a") == 1);
+        auto b = d.require<std::string_view>("big");
+        CHECK(b == big);
+        CHECK(f.offset_of(b.data()) == 19);
+        f.dont_need(0, f.offset_of(b.data()) + b.size());
+        f.will_need(f.offset_of(b.data()) + b.size(), 100);
+        CHECK(d.require<std::vector<int>>("list") == std::vector<int>{1, 2, 3});
+        CHECK_THROWS_AS(f.list_consumer(), std::runtime_error);
+
+        f.advise(bt_mapped_file::access_pattern::random);
+        auto v = bt_get(f.view());
+        CHECK(var::get<std::string>(var::get<bt_dict>(v).at("big")) == big);
+
+        bt_mapped_file g{std::move(f)};
+        CHECK(f.empty());
+        CHECK(g.view() == enc);
+    }
+
+    write("");
+    {
+        bt_mapped_file f{path, bt_mapped_file::access_pattern::normal};
+        CHECK(f.empty());
+        CHECK(f.view().empty());
+        f.will_need(0, 10);  // no-op
+    }
+
+    std::filesystem::remove(path);
+    CHECK_THROWS_AS(bt_mapped_file{path}, std::system_error);
+}
+#endif
+
+TEST_CASE("bt segmented consumers", "[bt][consumer][segmented]") {
+    std::string long_str(200, 'z');
+    auto enc = bt_serialize(bt_dict{
+            {"alpha", -1234567890123},
+            {"beta", bt_list{1, "two", bt_dict{{"x", 3}}, bt_list{}}},
+            {"gamma", long_str},
+            {"skipped", bt_list{bt_list{bt_list{"deep", 42}}, bt_dict{{"k", "v"}}}},
+            {"zeta", 18446744073709551615ULL}});
+
+    auto check = [&](std::span<const std::string_view> segs) {
+        bt_segmented_dict_consumer d{segs};
+        CHECK(d.key() == "alpha");
+        CHECK(d.is_negative_integer());
+        CHECK(d.consume_integer<int64_t>() == -1234567890123);
+        CHECK(d.key() == "beta");
+        {
+            auto l = d.consume_list_consumer();
+            CHECK(l.consume_integer<int>() == 1);
+            CHECK(l.is_string());
+            CHECK(l.consume_string_view() == "two");
+            auto sub = l.consume_dict_consumer();
+            CHECK(sub.require<int>("x") == 3);
+            sub.finish();
+            CHECK(l.consume_list_consumer().is_finished());
+            CHECK(l.is_finished());
+        }
+        auto g = d.consume_segmented_string();
+        CHECK(g.size() == long_str.size());
+        CHECK(g == long_str);
+        CHECK(g.str() == long_str);
+        CHECK(d.require<uint64_t>("zeta") == 18446744073709551615ULL);
+        CHECK(d.is_finished());
+        d.finish();
+
+        bt_segmented_dict_consumer d2{segs};
+        CHECK(d2.require<std::string_view>("gamma") == long_str);
+        CHECK_FALSE(d2.maybe<int>("omega"));
+        CHECK(d2.key() == "skipped");
+        auto s = d2.consume_list_consumer();
+        CHECK(s.consume_list_consumer().consume_list_consumer().consume_string() == "deep");
+        CHECK(s.consume_dict_consumer().consume_string() == "v");
+        CHECK(d2.consume_integer<uint64_t>() == 18446744073709551615ULL);
+    };
+
+    std::string_view whole{enc};
+    check(std::span{&whole, 1});
+
+    // Every possible split point, and every pair of split points (which includes empty segments
+    // and single-byte segments)
+    for (size_t i = 0; i <= enc.size(); i++) {
+        std::string_view segs[] = {whole.substr(0, i), whole.substr(i)};
+        check(segs);
+    }
+    for (size_t i = 0; i <= enc.size(); i += 3) {
+        for (size_t j = i; j <= enc.size(); j++) {
+            std::string_view segs[] = {whole.substr(0, i), whole.substr(i, j - i), whole.substr(j)};
+            check(segs);
+        }
+    }
+
+    // One byte per segment
+    std::vector<std::string_view> bytes;
+    for (size_t i = 0; i < enc.size(); i++)
+        bytes.push_back(whole.substr(i, 1));
+    check(bytes);
+    {
+        // A straddling string view is copied; a contiguous one points into the input
+        bt_segmented_dict_consumer d{bytes};
+        auto gamma = d.require<std::string_view>("gamma");
+        CHECK(gamma == long_str);
+        CHECK((gamma.data() < enc.data() || gamma.data() >= enc.data() + enc.size()));
+        std::string_view segs[] = {whole.substr(0, 10), whole.substr(10)};
+        bt_segmented_dict_consumer d2{segs};
+        auto gamma2 = d2.require<std::string_view>("gamma");
+        CHECK(gamma2.data() == enc.data() + enc.find(long_str));
+    }
+
+    // Errors, with offsets relative to the whole input
+    for (size_t i = 0; i <= 6; i++) {
+        std::string bad = "li1ei12345";
+        std::string_view segs[] = {
+                std::string_view{bad}.substr(0, i), std::string_view{bad}.substr(i)};
+        bt_segmented_list_consumer l{segs};
+        CHECK(l.consume_integer<int>() == 1);
+        try {
+            l.consume_integer<int>();
+            FAIL("expected an exception");
+        } catch (const bt_deserialize_invalid& e) {
+            CHECK(std::string_view{e.what()}.find("10") != std::string_view::npos);
+        }
+    }
+    std::string bad = "l5:abcde9:xye";
+    std::string_view segs[] = {std::string_view{bad}.substr(0, 9), std::string_view{bad}.substr(9)};
+    bt_segmented_list_consumer l{segs};
+    CHECK(l.consume_string() == "abcde");
+    CHECK_THROWS_AS(l.consume_string(), bt_deserialize_invalid);
+    CHECK_THROWS_AS(l.consume_integer<int>(), bt_deserialize_invalid_type);
+    CHECK_THROWS_AS(bt_segmented_dict_consumer{segs}, std::runtime_error);
+    std::string trailing = "li1eex";
+    std::string_view tsegs[] = {
+            std::string_view{trailing}.substr(0, 5), std::string_view{trailing}.substr(5)};
+    bt_segmented_list_consumer t{tsegs};
+    CHECK_THROWS_AS(t.finish(), bt_deserialize_invalid);
+
+    // Zero-padded integers and string lengths, longer than a canonical one could be, are accepted
+    // (as they are when contiguous) wherever they are split
+    std::string zeros(150, '0');
+    std::string padded = "ld1:ai";
+    padded += zeros;
+    padded += "1e1:bi2eei";
+    padded += zeros;
+    padded += "42e";
+    padded += zeros;
+    padded += "3:abce";
+    for (size_t i = 0; i <= padded.size(); i += 7) {
+        std::string_view psegs[] = {
+                std::string_view{padded}.substr(0, i), std::string_view{padded}.substr(i)};
+        bt_segmented_list_consumer p{psegs};
+        CHECK(p.consume_dict_consumer().require<int>("b") == 2);
+        CHECK(p.consume_integer<int>() == 42);
+        CHECK(p.consume_string() == "abc");
+        CHECK(p.is_finished());
+    }
+}
+
+TEST_CASE("bt stream reader", "[bt][consumer][stream]") {
+    std::string big(1000, 'b');
+    std::string enc;
+    for (int i = 0; i < 3; i++)
+        enc += bt_serialize(bt_dict{
+                {"big", big},
+                {"i", i},
+                {"neg", -1234567890123},
+                {"nested", bt_list{bt_dict{{"x", bt_list{1, 2}}, {"y", "why"}}, "after"}},
+                {"skipped", bt_list{bt_list{bt_list{big, 42}}, bt_dict{{"k", "v"}}}},
+                {"z", 18446744073709551615ULL}});
+    enc += "li1ei2ee";
+
+    auto check = [&](bt_stream_reader& r) {
+        for (int i = 0; i < 3; i++) {
+            CHECK_FALSE(r.at_end());
+            CHECK_THROWS_AS(r.list_consumer(), std::runtime_error);
+            auto d = r.dict_consumer();
+            CHECK(d.key() == "big");
+            std::string chunked;
+            size_t pieces = 0;
+            CHECK(d.consume_string_chunks([&](std::string_view piece) {
+                chunked += piece;
+                pieces++;
+            }) == big.size());
+            CHECK(chunked == big);
+            CHECK(pieces >= 1);
+            CHECK(d.require<int>("i") == i);
+            CHECK(d.is_negative_integer());
+            CHECK(d.consume_integer<int64_t>() == -1234567890123);
+            auto n = d.consume_list_consumer();
+            auto nd = n.consume_dict_consumer();
+            auto x = nd.consume_list_consumer();
+            CHECK(x.consume_integer<int>() == 1);
+            // Using the parent skips the rest of the children
+            CHECK(n.consume_string_view() == "after");
+            CHECK_THROWS_AS(x.consume_integer<int>(), std::logic_error);
+            CHECK_THROWS_AS(nd.key(), std::logic_error);
+            CHECK(n.is_finished());
+            if (i == 1)
+                continue;  // Leaves the rest of the top-level dict for the reader to skip
+            CHECK(d.require<uint64_t>("z") == 18446744073709551615ULL);
+            CHECK(d.is_finished());
+            d.finish();
+        }
+        auto l = r.list_consumer();
+        CHECK(l.consume<int>() == 1);
+        CHECK(r.offset() == enc.size() - 4);
+        l.finish();
+        CHECK(r.at_end());
+        CHECK_THROWS_AS(r.dict_consumer(), std::runtime_error);
+    };
+
+    {
+        std::istringstream in{enc};
+        bt_stream_reader r{in};
+        check(r);
+    }
+    {
+        // Tiny window: everything straddles refills
+        std::istringstream in{enc};
+        bt_stream_reader r{in, 64};
+        check(r);
+    }
+    {
+        // A source delivering one byte at a time
+        size_t pos = 0;
+        bt_stream_reader r{
+                [&](char* buf, size_t n) -> size_t {
+                    if (pos == enc.size() || n == 0)
+                        return 0;
+                    *buf = enc[pos++];
+                    return 1;
+                },
+                100};
+        check(r);
+    }
+    {
+        // Strings larger than the window can only be read in chunks or copied
+        std::istringstream in{enc};
+        bt_stream_reader r{in, 100};
+        auto d = r.dict_consumer();
+        CHECK_THROWS_AS(d.consume_string_view(), bt_deserialize_invalid);
+    }
+    {
+        std::istringstream in{enc};
+        bt_stream_reader r{in, 100};
+        auto d = r.dict_consumer();
+        CHECK(d.consume_string() == big);
+        CHECK(d.consume<int>() == 0);
+        d.skip_value();
+        d.skip_value();
+        CHECK(d.key() == "skipped");
+        r.skip_value();
+        // Finishes the current record, then skips the second one
+        CHECK(r.offset() == (enc.size() - 8) / 3 * 2);
+    }
+
+#ifndef _WIN32
+    {
+        int fds[2];
+        REQUIRE(::pipe(fds) == 0);
+        std::string msg = "d1:ai1e1:bl3:abcee";
+        REQUIRE(::write(fds[1], msg.data(), msg.size()) == static_cast<ssize_t>(msg.size()));
+        ::close(fds[1]);
+        auto r = bt_stream_reader::from_fd(fds[0]);
+        auto d = r.dict_consumer();
+        CHECK(d.require<int>("a") == 1);
+        CHECK(d.consume_list_consumer().consume_string() == "abc");
+        CHECK(r.at_end());
+        ::close(fds[0]);
+    }
+#endif
+
+    // Errors, with stream offsets
+    std::istringstream bad{"li1ei12345"};
+    bt_stream_reader r{bad, 64};
+    auto l = r.list_consumer();
+    CHECK(l.consume_integer<int>() == 1);
+    try {
+        l.consume_integer<int>();
+        FAIL("expected an exception");
+    } catch (const bt_deserialize_invalid& e) {
+        CHECK(std::string_view{e.what()}.find("byte 10") != std::string_view::npos);
+    }
+    std::istringstream bad2{"l5:abcde9:xye"};
+    bt_stream_reader r2{bad2, 64};
+    auto l2 = r2.list_consumer();
+    CHECK(l2.consume_string() == "abcde");
+    CHECK_THROWS_AS(l2.consume_string(), bt_deserialize_invalid);
+
+    // A failed typed consume leaves the key and value to be read again, as with bt_dict_consumer
+    std::istringstream retry{"d1:a5:hello1:bi3ee"};
+    bt_stream_reader r3{retry, 64};
+    auto d3 = r3.dict_consumer();
+    CHECK_THROWS_AS(d3.consume_integer<int>(), bt_deserialize_invalid_type);
+    CHECK(d3.key() == "a");
+    CHECK(d3.consume_string() == "hello");
+    CHECK(d3.key() == "b");
+    CHECK(d3.consume_integer<int>() == 3);
+    CHECK(d3.is_finished());
+}
+
+template <typename T>
+concept bt_decodes_temporary = requires { bt_deserialize<T>(std::string{}); };
+template <typename T>
+concept bt_decodes_plain = requires(std::string_view s, T& v) {
+    bt_deserialize<T>(s);
+    try_bt_deserialize(s, v);
+};
+
+TEST_CASE("bt borrowing deserialization", "[bt][deserialization][borrow]") {
+    using namespace bt_struct_test;
+    static_assert(detail::bt_borrows<std::string_view>());
+    static_assert(detail::bt_borrows<std::vector<std::string_view>>());
+    static_assert(detail::bt_borrows<std::map<std::string_view, int>>());
+    static_assert(detail::bt_borrows<std::tuple<int, const_span<unsigned char>>>());
+    static_assert(detail::bt_borrows<std::variant<int, std::vector<std::string_view>>>());
+    static_assert(detail::bt_borrows<Peer>());
+    static_assert(!detail::bt_borrows<Endpoint>());
+    static_assert(!detail::bt_borrows<std::map<std::string, std::vector<int>>>());
+    static_assert(!detail::bt_borrows<bt_value>());
+    // Borrowing from a temporary would dangle, so is rejected at compile time
+    static_assert(!bt_decodes_temporary<std::vector<std::string_view>>);
+    static_assert(bt_decodes_temporary<std::vector<std::string>>);
+    // View dict keys need the explicit borrowing functions
+    using detail::bt_borrow_check;
+    static_assert(
+            detail::bt_borrows<std::map<std::string_view, int>, bt_borrow_check::borrowed_only>());
+    static_assert(!detail::bt_borrows<std::map<std::string, std::string_view>,
+                                      bt_borrow_check::borrowed_only>());
+    static_assert(!detail::bt_borrows<Peer, bt_borrow_check::borrowed_only>());
+    static_assert(!bt_decodes_plain<std::map<std::string_view, int>>);
+    static_assert(bt_decodes_plain<std::vector<std::string_view>>);
+    static_assert(bt_decodes_plain<Peer>);
+    // ...while the plain functions skip view variant alternatives, so don't borrow through them
+    static_assert(bt_decodes_plain<bt_variant>);
+    static_assert(bt_decodes_plain<std::variant<int, const_span<unsigned char>>>);
+    static_assert(!detail::bt_borrows<bt_variant, bt_borrow_check::plain>());
+    static_assert(detail::bt_borrows<bt_variant>());
+    static_assert(bt_decodes_temporary<bt_variant>);
+    std::string str_enc = "3:abc";
+    auto plain_var = bt_deserialize<bt_variant>(str_enc);
+    REQUIRE(var::holds_alternative<std::string>(plain_var));
+    CHECK(var::get<std::string>(plain_var) == "abc");
+    auto plain_var2 = bt_deserialize<std::variant<std::string, std::string_view, int64_t>>(str_enc);
+    CHECK(var::holds_alternative<std::string>(plain_var2));
+    CHECK(bt_deserialize<bt_variant>("i-3e") == bt_variant{int64_t{-3}});
+    std::variant<int, std::string_view> view_only;
+    CHECK(try_bt_deserialize(str_enc, view_only).code == bt_errc::no_variant_match);
+    CHECK_FALSE(try_bt_deserialize_borrowed(str_enc, view_only));
+    CHECK(var::get<std::string_view>(view_only).data() == str_enc.data() + 2);
+
+    std::string enc = "l3:abc0:3:defe";
+    auto in_enc = [&enc](std::string_view v) {
+        return v.data() >= enc.data() && v.data() + v.size() <= enc.data() + enc.size();
+    };
+    auto list = bt_deserialize_borrowed<std::vector<std::string_view>>(enc);
+    CHECK(list == std::vector<std::string_view>{"abc", "", "def"});
+    CHECK(in_enc(list[0]));
+    CHECK(in_enc(list[2]));
+
+    enc = bt_serialize(bt_dict{{"a", "apple"}, {"b", bt_list{"x", "y"}}, {"c", 3}});
+    using bytes_list = std::vector<const_span<unsigned char>>;
+    auto dict = bt_deserialize_borrowed<
+            std::map<std::string_view, std::variant<int, std::string_view, bytes_list>>>(enc);
+    REQUIRE(dict.size() == 3);
+    for (auto& [k, v] : dict)
+        CHECK(in_enc(k));
+    CHECK(var::get<std::string_view>(dict["a"]) == "apple");
+    CHECK(in_enc(var::get<std::string_view>(dict["a"])));
+    auto& b = var::get<bytes_list>(dict["b"]);
+    REQUIRE(b.size() == 2);
+    REQUIRE(b[1].size() == 1);
+    CHECK(b[1][0] == 'y');
+    CHECK(var::get<int>(dict["c"]) == 3);
+
+    std::unordered_map<std::string_view, std::string> owned_values;
+    CHECK_FALSE(try_bt_deserialize_borrowed("d1:a1:x1:b1:ye", owned_values));
+    CHECK(owned_values ==
+          std::unordered_map<std::string_view, std::string>{{"a", "x"}, {"b", "y"}});
+
+    std::tuple<int, std::string_view, const_span<std::byte>> tup;
+    enc = "li1e3:abc4:\x01\x02\x03\x04" "e";
+    bt_deserialize_borrowed(enc, tup);
+    CHECK(std::get<0>(tup) == 1);
+    CHECK(in_enc(std::get<1>(tup)));
+    CHECK(std::get<2>(tup).size() == 4);
+    CHECK(static_cast<const void*>(std::get<2>(tup).data()) == enc.data() + 11);
+
+    auto peer = bt_deserialize_borrowed<Peer>(std::string_view{"d1:ele1:k3:KEYe"});
+    CHECK(peer.pubkey == "KEY");
+
+    CHECK(try_bt_deserialize_borrowed("l9:abce", list) == bt_error{bt_errc::string_length, 1});
+    CHECK_THROWS_AS(
+            bt_deserialize_borrowed<std::vector<std::string_view>>("li1ee"),
+            bt_deserialize_invalid_type);
+}
+
+TEST_CASE("bt integer list decoding", "[bt][list][integer]") {
+    // Vectors of integers take a separate fast path; its results (including for invalid input)
+    // must be the same as those of the general list decoder, used here via std::deque.
+    auto same_as_general = [](const std::string& in, auto type_tag) {
+        using T = decltype(type_tag);
+        std::vector<T> fast;
+        std::deque<T> general;
+        auto fast_err = try_bt_deserialize(in, fast);
+        auto general_err = try_bt_deserialize(in, general);
+        CHECK(fast_err == general_err);
+        if (!fast_err)
+            CHECK(std::equal(fast.begin(), fast.end(), general.begin(), general.end()));
+        return fast_err;
+    };
+
+    std::mt19937_64 rng{123};
+    for (int digits : {1, 3, 8, 9, 15, 16, 17, 19, 20}) {
+        std::vector<int64_t> vals;
+        uint64_t mod = 1;
+        for (int i = 0; i < digits && i < 19; i++)
+            mod *= 10;
+        for (int i = 0; i < 300; i++) {
+            auto v = static_cast<int64_t>(rng() % mod);
+            vals.push_back(i % 3 == 0 ? -v : v);
+        }
+        auto enc = bt_serialize(vals);
+        CHECK(bt_deserialize<std::vector<int64_t>>(enc) == vals);
+        CHECK_FALSE(same_as_general(enc, int64_t{}));
+        CHECK(same_as_general(enc, uint64_t{}).code == bt_errc::integer_range);
+        CHECK(same_as_general(enc, int32_t{}).code ==
+              (digits <= 9 ? bt_errc::ok : bt_errc::integer_range));
+        CHECK(same_as_general(enc, int8_t{}).code ==
+              (digits == 1 ? bt_errc::ok : bt_errc::integer_range));
+    }
+    std::vector<uint64_t> big{0, 1, std::numeric_limits<uint64_t>::max(), 12345678901234567890u};
+    CHECK(bt_deserialize<std::vector<uint64_t>>(bt_serialize(big)) == big);
+
+    // Each list has enough elements for several blocks, with the interesting one in the middle
+    auto with = [](std::string_view elem, bool close = true) {
+        std::string enc{"l"};
+        for (int i = 0; i < 200; i++) {
+            if (i == 150) {
+                enc += elem;
+            } else {
+                enc += 'i';
+                enc += std::to_string(i * 7);
+                enc += 'e';
+            }
+        }
+        return close ? enc + "e" : enc;
+    };
+    CHECK_FALSE(same_as_general(with("i00042e"), int{}));
+    CHECK_FALSE(same_as_general(with("i-0e"), int{}));
+    CHECK(same_as_general(with("i-0e"), unsigned{}) ==
+          bt_error{bt_errc::integer_range, with("i-0e").find("i-0e")});
+    CHECK(same_as_general(with("i32768e"), int16_t{}) ==
+          bt_error{bt_errc::integer_range, with("i32768e").find("i32768e")});
+    CHECK_FALSE(same_as_general(with("i-32768e"), int16_t{}));
+    CHECK_FALSE(same_as_general(with("i4294967295e"), uint32_t{}));
+    CHECK(same_as_general(with("i4294967296e"), uint32_t{}).code == bt_errc::integer_range);
+    CHECK(same_as_general(with("i99999999999999999999e"), int64_t{}).code ==
+          bt_errc::integer_overflow);
+    CHECK(same_as_general(with("i12x4e"), int{}).code == bt_errc::invalid_value);
+    CHECK(same_as_general(with("ie"), int{}).code == bt_errc::invalid_value);
+    CHECK(same_as_general(with("i-e"), int{}).code == bt_errc::invalid_value);
+    CHECK(same_as_general(with("1:e"), int{}).code == bt_errc::wrong_type);
+    CHECK(same_as_general(with("", false), int{}).code == bt_errc::unexpected_end);
+    CHECK(same_as_general(with("") + "i1e", int{}).code == bt_errc::trailing_data);
+    CHECK_FALSE(same_as_general("le", int{}));
+    CHECK_FALSE(same_as_general("li7ee", int{}));
+    CHECK(same_as_general("l", int{}).code == bt_errc::unexpected_end);
+    CHECK(same_as_general("li7e", int{}).code == bt_errc::unexpected_end);
+    CHECK(same_as_general("d1:ai1ee", int{}).code == bt_errc::wrong_type);
+
+    // Decoding into a non-empty vector replaces its contents
+    std::vector<int> v{1, 2, 3, 4, 5};
+    bt_deserialize("li9ee", v);
+    CHECK(v == std::vector<int>{9});
+}
+
+TEST_CASE("bt fixed-length string lists", "[bt][list][consumer]") {
+    std::vector<std::string> keys;
+    for (char c : {'a', 'b', 'c'})
+        keys.push_back(std::string(32, c));
+    bt_dict d{{"keys", bt_list(keys.begin(), keys.end())}, {"n", 3}};
+    auto enc = bt_serialize(d);
+
+    bt_dict_consumer dc{enc};
+    auto [key, fixed] = dc.next_fixed_list<32>();
+    CHECK(key == "keys");
+    REQUIRE(fixed.size() == 3);
+    CHECK_FALSE(fixed.empty());
+    CHECK(std::string_view{fixed[1].data(), fixed[1].size()} == keys[1]);
+    CHECK(static_cast<const void*>(fixed[0].data()) == enc.data() + enc.find("32:") + 3);
+    size_t i = 0;
+    for (const_span<char, 32> k : fixed)
+        CHECK(std::string_view{k.data(), k.size()} == keys[i++]);
+    CHECK(i == 3);
+    auto arrays = fixed.to_vector<std::byte>();
+    REQUIRE(arrays.size() == 3);
+    CHECK(arrays[2][31] == std::byte{'c'});
+    CHECK(dc.consume_integer<int>() == 3);
+
+    bt_list_consumer lc{"llel3:abc3:defee"};
+    CHECK(lc.consume_fixed_list<5>().empty());
+    auto bytes = lc.consume_fixed_list<3, std::byte>();
+    CHECK(bytes[1][0] == std::byte{'d'});
+    CHECK(lc.is_finished());
+    CHECK(bt_list_consumer{"ll10:0123456789ee"}.consume_fixed_list<10>().size() == 1);
+
+    auto try_fixed = [](std::string_view in) {
+        bt_list_consumer c{in};
+        bt_fixed_list<3> val;
+        auto err = c.try_consume_fixed_list(val);
+        if (err)
+            CHECK(c.is_list() == (in[1] == 'l'));  // Unchanged on failure
+        return err;
+    };
+    CHECK_FALSE(try_fixed("ll3:abc3:defee"));
+    CHECK(try_fixed("l3:abce") == bt_error{bt_errc::wrong_type, 1});
+    CHECK(try_fixed("ll3:abc2:dee") == bt_error{bt_errc::wrong_type, 7});
+    CHECK(try_fixed("ll3:abc4:defgee") == bt_error{bt_errc::wrong_type, 7});
+    CHECK(try_fixed("ll3:abc03:defee") == bt_error{bt_errc::wrong_type, 7});  // Non-canonical
+    CHECK(try_fixed("ll3:abci3eee") == bt_error{bt_errc::wrong_type, 7});
+    CHECK(try_fixed("ll3:abc") == bt_error{bt_errc::unexpected_end, 7});
+    CHECK(try_fixed("ll3:abc3:def") == bt_error{bt_errc::unexpected_end, 12});
+    CHECK(try_fixed("ll3:abc9:def") == bt_error{bt_errc::string_length, 7});
+    CHECK_THROWS_AS(
+            bt_list_consumer{"ll3:abc9:defe"}.consume_fixed_list<3>(), bt_deserialize_invalid);
+    bt_dict_consumer empty{"de"};
+    bt_fixed_list<3> val;
+    CHECK(empty.try_consume_fixed_list(val).code == bt_errc::wrong_type);
+}
+
+TEST_CASE("bt key interning", "[bt][dict][intern]") {
+    using keyed = std::map<std::string_view, int>;
+    bt_intern_table keys;
+    std::vector<keyed> decoded;
+    for (int i = 0; i < 3; i++) {
+        auto enc = std::make_unique<std::string>(
+                bt_serialize(std::map<std::string, int>{{"a", i}, {"storage_server_version", 2}}));
+        decoded.push_back(bt_deserialize_interned<keyed>(*enc, keys));
+    }  // The encoded data is gone, but the keys live on in the table
+    CHECK(keys.size() == 2);
+    REQUIRE(decoded.size() == 3);
+    CHECK(decoded[2].at("a") == 2);
+    CHECK(decoded[0].at("storage_server_version") == 2);
+    CHECK(decoded[0].begin()->first.data() == decoded[2].begin()->first.data());
+    CHECK(keys.intern("a").data() == decoded[1].begin()->first.data());
+
+    // Nested containers are interned too
+    std::vector<keyed> list;
+    std::string enc = "ld1:ai1eed1:bi2eee";
+    CHECK_FALSE(try_bt_deserialize_interned(enc, list, keys));
+    CHECK(keys.size() == 3);
+    CHECK(list[1].begin()->first.data() == keys.intern("b").data());
+    CHECK_FALSE(try_bt_deserialize_interned(
+            const_span<std::byte>{reinterpret_cast<const std::byte*>(enc.data()), enc.size()},
+            list,
+            keys));
+
+    // Errors are reported as usual, and afterwards decoding borrows from the input again
+    CHECK(try_bt_deserialize_interned("d1:ai1e1:c", list.emplace_back(), keys) ==
+          bt_error{bt_errc::unexpected_end, 10});
+    CHECK_THROWS_AS(bt_deserialize_interned<keyed>("d1:c1:xe", keys), bt_deserialize_invalid);
+    CHECK(keys.size() == 4);  // "c"
+    enc = "d1:zi1ee";
+    auto borrowed = bt_deserialize_borrowed<keyed>(enc);
+    CHECK(borrowed.begin()->first.data() == enc.data() + 3);
+
+    // std::string keys are unaffected
+    CHECK(bt_deserialize_interned<std::map<std::string, int>>("d1:qi1ee", keys).count("q"));
+    CHECK(keys.size() == 4);
+    keys.clear();
+    CHECK(keys.size() == 0);
+}
+
+namespace {
+// Counts the allocations made by the containers using it
+size_t counted_allocs = 0;
+template <typename T>
+struct counting_alloc {
+    using value_type = T;
+    counting_alloc() = default;
+    template <typename U>
+    counting_alloc(const counting_alloc<U>&) {}
+    T* allocate(size_t n) {
+        ++counted_allocs;
+        return std::allocator<T>{}.allocate(n);
+    }
+    void deallocate(T* p, size_t n) { std::allocator<T>{}.deallocate(p, n); }
+    template <typename U>
+    bool operator==(const counting_alloc<U>&) const {
+        return true;
+    }
+};
+}  // namespace
+
+TEST_CASE("bt reusing deserialization", "[bt][deserialization][reuse]") {
+    std::string a(40, 'a'), b(30, 'b'), c(35, 'c');
+    std::vector<std::string> strs;
+    bt_deserialize_reusing(bt_serialize(std::vector{a, b, c}), strs);
+    CHECK(strs == std::vector{a, b, c});
+    const char* data0 = strs[0].data();
+    const char* data2 = strs[2].data();
+
+    // Same shape: every string is assigned in place
+    bt_deserialize_reusing(bt_serialize(std::vector{c, a, b}), strs);
+    CHECK(strs == std::vector{c, a, b});
+    CHECK(strs[0].data() == data0);
+    CHECK(strs[2].data() == data2);
+    // Shrinks and grows at the end
+    bt_deserialize_reusing(bt_serialize(std::vector{b}), strs);
+    CHECK(strs == std::vector{b});
+    CHECK(strs[0].data() == data0);
+    bt_deserialize_reusing(bt_serialize(std::vector{a, b, c, a}), strs);
+    CHECK(strs == std::vector{a, b, c, a});
+    CHECK(strs[0].data() == data0);
+
+    // Plain deserialization also keeps a string's capacity
+    std::string str(50, 'x');
+    const char* str_data = str.data();
+    bt_deserialize("3:abc", str);
+    CHECK(str == "abc");
+    CHECK(str.data() == str_data);
+
+    // Dict nodes are reused
+    using dict = std::map<std::string, std::vector<std::string>>;
+    dict d;
+    bt_deserialize_reusing(bt_serialize(dict{{a, {b}}, {b, {c}}}), d);
+    const auto* node_val = &d.begin()->second;
+    const char* key_data = d.begin()->first.data();
+    bt_deserialize_reusing(bt_serialize(dict{{c, {a, a}}, {"z", {}}}), d);
+    CHECK(d == dict{{c, {a, a}}, {"z", {}}});
+    CHECK(&d.begin()->second == node_val);
+    CHECK(d.begin()->first.data() == key_data);
+    bt_deserialize_reusing(bt_serialize(dict{{"x", {}}, {"y", {}}, {"z", {b}}}), d);
+    CHECK(d == dict{{"x", {}}, {"y", {}}, {"z", {b}}});
+    bt_deserialize_reusing("de", d);
+    CHECK(d.empty());
+
+    // Hash tables keep their buckets, so decoding a same-shaped dict allocates nothing
+    using hash_dict = std::unordered_map<
+            std::string,
+            int,
+            std::hash<std::string>,
+            std::equal_to<>,
+            counting_alloc<std::pair<const std::string, int>>>;
+    hash_dict hd;
+    bt_deserialize_reusing("d1:ai1e1:bi2e1:ci3ee", hd);
+    bt_deserialize_reusing("d1:ai1e1:bi2e1:ci3ee", hd);  // Warms up the spare table
+    counted_allocs = 0;
+    for (int i = 0; i < 10; i++) {
+        bt_deserialize_reusing("d1:xi4e1:yi5e1:zi6ee", hd);
+        bt_deserialize_reusing("d1:ai1e1:bi2e1:ci3ee", hd);
+    }
+    CHECK(counted_allocs == 0);
+    CHECK(hd == hash_dict{{"a", 1}, {"b", 2}, {"c", 3}});
+
+    // Results (and errors) are the same as those of plain deserialization
+    auto same_as_plain = [](std::string_view in, auto val) {
+        auto plain = val;
+        auto plain_err = try_bt_deserialize(in, plain);
+        auto reuse_err = try_bt_deserialize_reusing(in, val);
+        CHECK(reuse_err == plain_err);
+        if (!plain_err)
+            CHECK(val == plain);
+        return reuse_err;
+    };
+    std::list<std::vector<int>> lists{{1, 2}, {3}};
+    CHECK_FALSE(same_as_plain("lli5eeleli6ei7ei8eee", lists));
+    CHECK(same_as_plain("lli5eeleli6ei7ei8ee", lists).code == bt_errc::unexpected_end);
+    CHECK(same_as_plain("lli5ee1:x", lists).code == bt_errc::wrong_type);
+    CHECK_FALSE(same_as_plain("l1:b1:a1:be", std::set<std::string>{"q", "r", "s", "t"}));
+    CHECK_FALSE(same_as_plain("d1:ai1e1:ai2ee", std::map<std::string, int>{{"b", 3}, {"c", 4}}));
+    CHECK_FALSE(same_as_plain(
+            "d1:ai1e1:bi2ee", std::unordered_map<std::string, int>{{"b", 3}, {"c", 4}}));
+    CHECK(same_as_plain("d1:ai1e1:bi2ee", std::map<std::string, int8_t>{{"b", 3}}) == bt_error{});
+    CHECK(same_as_plain("d1:ai1e1:bi999ee", std::map<std::string, int8_t>{{"b", 3}}).code ==
+          bt_errc::integer_range);
+
+    // Absent bt_optional_field members get their defaults, not the previous message's values
+    using bt_struct_test::Setting;
+    std::vector<Setting> settings;
+    bt_deserialize_reusing("ld1:li7e1:n1:aed1:n1:bed1:li8e1:n1:cee", settings);
+    CHECK(settings == std::vector<Setting>{{"a", 7}, {"b", 3}, {"c", 8}});
+    CHECK_FALSE(same_as_plain("ld1:n1:xed1:li5e1:n1:yee", settings));
+    bt_deserialize_reusing("ld1:n1:xed1:li5e1:n1:yee", settings);
+    CHECK(settings == std::vector<Setting>{{"x", 3}, {"y", 5}});
+    Setting setting{"s", 9};
+    bt_deserialize_reusing("d1:n1:te", setting);
+    CHECK(setting == Setting{"t", 3});
+}
+
+TEST_CASE("bt container pre-sizing", "[bt][deserialization]") {
+    using detail::bt_count_elements;
+    CHECK(bt_count_elements("e", false) == 0);
+    CHECK(bt_count_elements("i1e3:abci-22eli1eeded1:ai1eee", false) == 6);
+    CHECK(bt_count_elements("1:ai1e1:bli1ei2eee", true) == 2);
+    // Invalid or incomplete data counts as 0 (and is left to the decoder)
+    CHECK(bt_count_elements("i1e3:abc", false) == 0);
+    CHECK(bt_count_elements("i1e9:abce", false) == 0);
+    CHECK(bt_count_elements("i1", false) == 0);
+    CHECK(bt_count_elements("i1eli1ee", false) == 0);
+    CHECK(bt_count_elements("x", false) == 0);
+
+    // Vectors of strings and integers are allocated once, at their final size
+    std::vector<std::string> strs(1000, std::string(20, 'x'));
+    auto decoded = bt_deserialize<std::vector<std::string>>(bt_serialize(strs));
+    CHECK(decoded == strs);
+    CHECK(decoded.capacity() == 1000);
+    std::unordered_map<std::string, int> m;
+    for (int i = 0; i < 100; i++)
+        m[std::to_string(i)] = i;
+    CHECK(bt_deserialize<std::unordered_map<std::string, int>>(bt_serialize(m)) == m);
+    CHECK(try_bt_deserialize("l1:a9:be", decoded) == bt_error{bt_errc::string_length, 4});
+}
+
+TEST_CASE("bt semantic equality, ordering and hashing", "[bt][compare]") {
+    // Non-canonical encodings of the same value
+    CHECK(bt_equal("i7e", "i007e"));
+    CHECK(bt_equal("i0e", "i-0e"));
+    CHECK(bt_equal("3:abc", "03:abc"));
+    CHECK(bt_equal("d1:ai1e1:bi2ee", "d1:bi2e1:ai01ee"));
+    CHECK(bt_equal("d1:ai1e1:bi2ee", "d1:bi2e1:ai1e1:ai3ee"));  // first duplicate key wins
+    CHECK(bt_equal("ld1:bi1e1:ai2eee", "ld1:ai2e1:bi1eee"));
+    CHECK_FALSE(bt_equal("i1e", "i2e"));
+    CHECK_FALSE(bt_equal("i1e", "1:1"));
+    CHECK_FALSE(bt_equal("li1ei2ee", "li2ei1ee"));
+    CHECK_FALSE(bt_equal("d1:ai1ee", "d1:bi1ee"));
+    CHECK_FALSE(bt_equal("i-1e", "i18446744073709551615e"));
+
+    CHECK(bt_compare("i7e", "i007e") == std::strong_ordering::equal);
+    CHECK(bt_compare("d1:bi2e1:ai1ee", "d1:ai1e1:bi3ee") == std::strong_ordering::less);
+    CHECK(bt_compare("li2ee", "li1ee") == std::strong_ordering::greater);
+
+    CHECK(bt_hash("d1:bi2e1:ai01ee") == bt_hash("d1:ai1e1:bi2ee"));
+    CHECK(bt_hash("i-0e") == std::hash<std::string_view>{}("i0e"));
+    std::string_view msg = "d1:ali1e2:hie1:bd1:ci-3eee";
+    CHECK(bt_hash(std::span{msg.data(), msg.size()}) == std::hash<bt_value>{}(bt_get(msg)));
+
+    std::unordered_set<std::string, bt_encoded_hash, bt_encoded_equal> seen;
+    CHECK(seen.insert("d1:ai1e1:bi2ee").second);
+    CHECK_FALSE(seen.insert("d1:bi2e1:ai1ee").second);
+    CHECK(seen.insert("d1:ai1e1:bi3ee").second);
+
+    // Invalid input throws, even when the two sides are identical
+    CHECK_THROWS_AS(bt_equal("i1", "i1"), bt_deserialize_invalid);
+    CHECK_THROWS_AS(bt_equal("i01e", "i1"), bt_deserialize_invalid);
+    CHECK_THROWS_AS(bt_hash("d1:bi1e1:ae"), bt_deserialize_invalid);
+    CHECK_THROWS_AS(bt_compare("i1ei2e", "i1e"), bt_deserialize_invalid);
+
+    // bt_value compares by value rather than by variant alternative
+    CHECK(bt_value{0} == bt_get("i0e"));
+    CHECK(bt_value{-1} != bt_value{std::numeric_limits<uint64_t>::max()});
+    CHECK(bt_value{"abc"} == bt_value{std::string{"abc"}});
+    CHECK(bt_value{"abc"} != bt_value{"abd"});
+    CHECK(bt_value{std::make_tuple(1, "x", -2)} == bt_get("li1e1:xi-2ee"));
+    CHECK(bt_get("d1:ali1eee") != bt_get("d1:ali2eee"));
+    CHECK(std::hash<bt_value>{}(bt_value{5}) == std::hash<bt_value>{}(bt_get("i5e")));
+}
+
+TEST_CASE("bt path queries", "[bt][path]") {
+    auto msg = bt_serialize(bt_dict{
+            {"result",
+             bt_dict{{"height", 123},
+                     {"swarm",
+                      bt_list{bt_dict{{"pubkey", "pk0"}},
+                              bt_dict{{"pubkey", "pk1"}, {"port", 22}},
+                              bt_dict{{"port", 33}}}}}},
+            {"t", "x"},
+            {"we.ird[key]", 1}});
+
+    CHECK(bt_path{"result.height"}.find(msg) == "i123e");
+    CHECK(bt_path{"result.swarm[1].pubkey"}.get<std::string_view>(msg) == "pk1");
+    CHECK(bt_path{"result.swarm[1]"}.find(msg) == "d4:porti22e6:pubkey3:pk1e");
+    CHECK(bt_path{""}.find(msg) == msg);
+    CHECK(bt_path{R"(we\.ird\[key])"}.get<int>(msg) == 1);
+    CHECK(bt_path{"[0]"}.find("li5ei6ee") == "i5e");
+    CHECK(bt_path{"[1][0]"}.find("li5eli6eee") == "i6e");
+
+    // Missing keys, out-of-range indices, and paths through the wrong type
+    CHECK_FALSE(bt_path{"result.swarm[2].pubkey"}.find(msg));
+    CHECK_FALSE(bt_path{"result.swarm[3]"}.find(msg));
+    CHECK_FALSE(bt_path{"result.nope"}.find(msg));
+    CHECK_FALSE(bt_path{"t.x"}.find(msg));
+    CHECK_FALSE(bt_path{"result[0]"}.find(msg));
+    std::string_view val;
+    CHECK(bt_path{"b"}.try_find("d1:ai1e1:ci2ee", val) == bt_error{bt_errc::key_not_found, 10});
+
+    // Only what is walked gets validated
+    CHECK(bt_path{"a"}.find("d1:ai1e1:bxxx") == "i1e");
+    CHECK_THROWS_AS(bt_path{"b"}.find("d1:ai1x1:bi2ee"), bt_deserialize_invalid);
+    CHECK(bt_path{"[2]"}.try_find("li1e", val) == bt_error{bt_errc::unexpected_end, 4});
+
+    for (auto bad : {"a..b", "a.", ".a", "a[x]", "a[1", "a[]", "a[1]b", "a[1].", "a\\"})
+        CHECK_THROWS_AS(bt_path{bad}, std::invalid_argument);
+    CHECK(bt_path{"a[1][2].b"}.steps().size() == 4);
+
+    bt_path_set paths{
+            "t", "result.swarm[1].port", "result.height", "nope", "result.swarm[0].pubkey",
+            "result.swarm[9]", "result.swarm[1]"};
+    auto found = paths.find(msg);
+    REQUIRE(found.size() == 7);
+    CHECK(found[0] == "1:x");
+    CHECK(found[1] == "i22e");
+    CHECK(found[2] == "i123e");
+    CHECK_FALSE(found[3]);
+    CHECK(found[4] == "3:pk0");
+    CHECK_FALSE(found[5]);
+    CHECK(found[6] == "d4:porti22e6:pubkey3:pk1e");
+
+    // The walk stops once everything has been found, so trailing garbage goes unnoticed...
+    CHECK(bt_path_set{"a", "b[0]"}.find("d1:ai1e1:bli2exxxxx")[1] == "i2e");
+    // ...but not garbage that has to be walked past
+    std::vector<std::optional<std::string_view>> vals;
+    CHECK(bt_path_set{"a", "c"}.try_find("d1:ai1e1:bxxx", vals) ==
+          bt_error{bt_errc::wrong_type, 10});
+    CHECK(vals[0] == "i1e");
+}
+
+TEST_CASE("bt encoded patching", "[bt][path][patch]") {
+    std::string blob = "d1:ai1e5:statsd5:counti99e4:name3:foo4:sizeli1ei2eee1:zi0ee";
+
+    // Same size: overwritten in place
+    const char* before = blob.data();
+    CHECK(bt_path{"stats.name"}.set(blob, "bar"));
+    CHECK(blob == "d1:ai1e5:statsd5:counti99e4:name3:bar4:sizeli1ei2eee1:zi0ee");
+    CHECK(blob.data() == before);
+
+    // Different size: spliced
+    bt_path count{"stats.count"};
+    CHECK(count.set(blob, *count.get<int>(blob) + 1));
+    CHECK(blob == "d1:ai1e5:statsd5:counti100e4:name3:bar4:sizeli1ei2eee1:zi0ee");
+    CHECK(bt_path{"stats.size[1]"}.set(blob, std::vector{3, 4}));
+    CHECK(blob == "d1:ai1e5:statsd5:counti100e4:name3:bar4:sizeli1eli3ei4eeee1:zi0ee");
+
+    // Missing keys are inserted in order
+    CHECK(bt_path{"stats.id"}.set_encoded(blob, "i7e"));
+    CHECK(bt_path{"0"}.set_encoded(blob, "le"));
+    CHECK(bt_path{"zz"}.set_encoded(blob, "de"));
+    CHECK(blob ==
+          "d1:0le1:ai1e5:statsd5:counti100e2:idi7e4:name3:bar4:sizeli1eli3ei4eeee1:zi0e2:zzdee");
+    CHECK(bt_validate(blob, {.canonical = true}) == bt_error{});
+    CHECK(bt_path{"zz.x"}.set(blob, 1));
+    CHECK(bt_path{"zz"}.find(blob) == "d1:xi1ee");
+
+    // Nothing is created along the way, nor can lists be extended
+    auto orig = blob;
+    CHECK_FALSE(bt_path{"nope.x"}.set(blob, 1));
+    CHECK_FALSE(bt_path{"a.x"}.set(blob, 1));
+    CHECK_FALSE(bt_path{"stats.size[2]"}.set(blob, 1));
+    CHECK_FALSE(bt_path{"stats[0]"}.set(blob, 1));
+    CHECK(blob == orig);
+
+    CHECK(bt_path{"stats.size[0]"}.erase(blob));
+    CHECK(bt_path{"stats.count"}.erase(blob));
+    CHECK(bt_path{"0"}.erase(blob));
+    CHECK_FALSE(bt_path{"stats.count"}.erase(blob));
+    CHECK(blob == "d1:ai1e5:statsd2:idi7e4:name3:bar4:sizelli3ei4eeee1:zi0e2:zzd1:xi1eee");
+
+    CHECK(bt_path{""}.set_encoded(blob, "i1e"));
+    CHECK(blob == "i1e");
+    CHECK_THROWS_AS(bt_path{""}.erase(blob), std::invalid_argument);
+    CHECK_THROWS_AS(bt_path{"x"}.set_encoded(blob, "i1"), bt_deserialize_invalid);
+    blob = "d1:ai1e1:bi2";
+    CHECK_THROWS_AS(bt_path{"b"}.set(blob, 3), bt_deserialize_invalid);
+    CHECK_THROWS_AS(bt_path{"c"}.set(blob, 3), bt_deserialize_invalid);
+    CHECK(blob == "d1:ai1e1:bi2");
+}
+
+TEST_CASE("bt dict merging", "[bt][dict][merge]") {
+    auto base = bt_serialize(bt_dict{
+            {"a", 1},
+            {"log", bt_dict{{"file", "x.log"}, {"level", "info"}}},
+            {"net", bt_dict{{"port", 22}}},
+            {"z", "base"}});
+    auto overlay = bt_serialize(bt_dict{
+            {"b", bt_list{1, 2}},
+            {"log", bt_dict{{"level", "debug"}, {"max", 3}}},
+            {"net", "off"},
+            {"z", "over"}});
+
+    CHECK(bt_merge(base, overlay) ==
+          "d1:ai1e1:bli1ei2ee3:logd5:level5:debug3:maxi3ee3:net3:off1:z4:overe");
+    CHECK(bt_merge(base, overlay, {.recursive = true}) ==
+          "d1:ai1e1:bli1ei2ee3:logd4:file5:x.log5:level5:debug3:maxi3ee3:net3:off1:z4:overe");
+    CHECK(bt_merge(base, "de") == base);
+    CHECK(bt_merge("de", overlay) == overlay);
+    CHECK(bt_merge("de", "de") == "de");
+
+    // Merging into part of a larger dict
+    bt_dict_producer out;
+    out.append("config", "");
+    {
+        auto sub = out.append_dict("merged");
+        bt_merge(base, overlay, sub, {.recursive = true});
+    }
+    out.append("zzz", 1);
+    CHECK(bt_get(out.view()) ==
+          bt_value{bt_dict{
+                  {"config", ""},
+                  {"merged", bt_get(bt_merge(base, overlay, {.recursive = true}))},
+                  {"zzz", 1}}});
+
+    // The raw value access that merging uses
+    bt_list_consumer l{"li1e3:abcd1:ali2eeee"};
+    CHECK(l.consume_value_data() == "i1e");
+    CHECK(l.consume_value_data() == "3:abc");
+    CHECK(l.consume_value_data() == "d1:ali2eee");
+    std::string_view v;
+    CHECK(l.try_consume_value_data(v) == bt_error{bt_errc::wrong_type, 19});
+    bt_dict_consumer d{"d1:ai-1e1:bd1:cleee"};
+    CHECK(d.next_value_data() == std::pair{"a"sv, "i-1e"sv});
+    CHECK(d.consume_value_data() == "d1:clee");
+
+    CHECK_THROWS_AS(bt_merge("d1:ai1e", "de"), bt_deserialize_invalid);
+    CHECK_THROWS(bt_merge("le", "de"));
+
+    // Recursive merging is depth limited; the error has no (meaningless) byte offset
+    std::string deep;
+    for (size_t i = 0; i <= bt_default_max_depth; i++)
+        deep += "d1:a";
+    deep += "i1e" + std::string(bt_default_max_depth + 1, 'e');
+    CHECK_NOTHROW(bt_merge(deep, deep));
+    CHECK_THROWS_WITH(
+            bt_merge(deep, deep, {.recursive = true}),
+            "Deserialization failed: maximum nesting depth exceeded");
+}
+
+TEST_CASE("bt dict diff and apply", "[bt][dict][diff]") {
+    std::string_view old = "d1:ai1e1:bi2e1:cd1:xi1e1:yi2eee";
+    std::string_view now = "d1:ai1e1:cd1:xi1e1:yi3ee1:di4ee";
+    auto delta = bt_diff(old, now);
+    CHECK(delta == "d1:ble1:cd1:yli3eee1:dli4eee");
+    CHECK(bt_apply(old, delta) == now);
+    CHECK(bt_diff(old, old) == "de");
+    CHECK(bt_apply(old, "de") == old);
+    CHECK(bt_apply(now, bt_diff(now, old)) == old);
+    CHECK(bt_apply("de", bt_diff("de", now)) == now);
+    CHECK(bt_apply(now, bt_diff(now, "de")) == "de");
+
+    // A small nested dict that changes completely is sent whole rather than as a nested delta
+    CHECK(bt_diff("d1:ad1:xi1eee", "d1:ad1:yi2eee") == "d1:ald1:yi2eeee");
+    // ...as is a dict replacing something else, and vice versa
+    CHECK(bt_diff("d1:ai1ee", "d1:adee") == "d1:aldeee");
+    CHECK(bt_diff("d1:adee", "d1:ai1ee") == "d1:ali1eee");
+
+    // Randomized round trips
+    std::mt19937_64 rng{42};
+    auto random_dict = [&rng](auto& self, int depth) -> bt_dict {
+        bt_dict d;
+        for (int i = 0; i < 8; i++) {
+            if (rng() % 3 == 0)
+                continue;
+            auto key = std::string(1, static_cast<char>('a' + i));
+            switch (depth < 2 ? rng() % 3 : rng() % 2) {
+                case 0: d[key] = static_cast<int64_t>(rng() % 3); break;
+                case 1: d[key] = std::string(rng() % 3, 'x'); break;
+                default: d[key] = self(self, depth + 1);
+            }
+        }
+        return d;
+    };
+    for (int i = 0; i < 200; i++) {
+        auto a = bt_serialize(random_dict(random_dict, 0));
+        auto b = bt_serialize(random_dict(random_dict, 0));
+        CHECK(bt_apply(a, bt_diff(a, b)) == b);
+    }
+
+    CHECK_THROWS_AS(bt_apply("d1:ai1ee", "d1:ad1:bleee"), std::invalid_argument);
+    CHECK_THROWS_AS(bt_apply("d1:ai1ee", "d1:ali1ei2eee"), std::invalid_argument);
+    CHECK_THROWS_WITH(
+            bt_apply("d1:ai1ee", "d1:ai2ee"),
+            "Invalid bt delta: key 'a' is neither a list nor a dict");
+    CHECK_THROWS_AS(bt_diff("d1:ai1ee", "d1:ai1e"), bt_deserialize_invalid);
+
+    // Nested deltas are depth limited; the error has no (meaningless) byte offset
+    auto nest = [](size_t levels, std::string_view inner) {
+        std::string d;
+        for (size_t i = 0; i < levels; i++)
+            d += "d1:a";
+        d += inner;
+        d.append(levels, 'e');
+        return d;
+    };
+    constexpr auto depth_error = "Deserialization failed: maximum nesting depth exceeded";
+    auto deep_a = nest(bt_default_max_depth + 1, "i1e");
+    auto deep_b = nest(bt_default_max_depth + 1, "i2e");
+    CHECK_THROWS_WITH(bt_diff(deep_a, deep_b), depth_error);
+    CHECK_THROWS_WITH(bt_apply(deep_a, nest(bt_default_max_depth + 1, "li2ee")), depth_error);
+}
+
+TEST_CASE("bt JSON transcoding", "[bt][json]") {
+    CHECK(bt_to_json("d1:ai1e1:bl3:xyzi-5eee") == R"({"a":1,"b":["xyz",-5]})");
+    CHECK(bt_to_json("d1:ade1:blee") == R"({"a":{},"b":[]})");
+    CHECK(bt_to_json("i18446744073709551615e") == "18446744073709551615");
+    CHECK(bt_to_json("7:a\"b\\\n\x01" "c") == R"("a\"b\\\n\u0001c")");
+    CHECK(bt_to_json("2:\xc3\xa9") == "\"\xc3\xa9\"");  // Valid UTF-8 is written as is
+    std::string out = "x";
+    bt_to_json("le", out);
+    CHECK(out == "x[]");
+
+    // Binary (non-UTF-8) strings and keys
+    std::string_view bin = "d2:\xff\x01i1ee";
+    CHECK(bt_to_json(bin) == R"({"\u00ff\u0001":1})");
+    CHECK(bt_to_json(bin, {.binary = bt_json_binary::hex}) == R"({"ff01":1})");
+    CHECK(bt_to_json(bin, {.binary = bt_json_binary::base64}) == R"({"/wE=":1})");
+    CHECK(bt_to_json("2:\xc0\x80", {.binary = bt_json_binary::hex}) == "\"c080\"");  // overlong
+
+    CHECK_THROWS_AS(bt_to_json("i1"), bt_deserialize_invalid);
+    CHECK_THROWS_AS(bt_to_json("i1ei2e"), bt_deserialize_invalid);
+    CHECK_THROWS_AS(bt_to_json("d1:ae"), bt_deserialize_invalid);
+    CHECK_THROWS_AS(bt_to_json("l3:abe"), bt_deserialize_invalid);
+    CHECK_THROWS_AS(
+            bt_to_json(std::string(600, 'l') + std::string(600, 'e')), bt_deserialize_invalid);
+
+    // JSON to bt: keys get sorted, null members are dropped, booleans become 0/1
+    CHECK(json_to_bt(R"( {"b": [1, "x", true, false], "a": {"z": null, "y": -3}} )") ==
+          "d1:ad1:yi-3ee1:bli1e1:xi1ei0eee");
+    CHECK(json_to_bt(R"({"a":1,"c":{"e":[],"d":{}},"b":2})") == "d1:ai1e1:bi2e1:cd1:dde1:eleee");
+    CHECK(json_to_bt(R"({"a":1,"b":2,"a":3})") == "d1:ai3e1:bi2ee");  // last duplicate wins
+    CHECK(json_to_bt(R"({"a":null})") == "de");
+    CHECK(json_to_bt(R"({"a":1,"a":null})") == "de");  // The last duplicate wins, even if null
+    CHECK(json_to_bt(R"({"a":1,"b":2,"a":null,"c":null})") == "d1:bi2ee");
+    CHECK(json_to_bt(R"({"b":null,"a":1,"b":2})") == "d1:ai1e1:bi2ee");
+    CHECK(json_to_bt(R"("\u00e9\ud83d\ude00\n\"\/")") == "9:\xc3\xa9\xf0\x9f\x98\x80\n\"/");
+    CHECK(json_to_bt("-0") == "i0e");
+    CHECK(json_to_bt("18446744073709551615") == "i18446744073709551615e");
+    CHECK(json_to_bt("-9223372036854775808") == "i-9223372036854775808e");
+    out = "l";
+    json_to_bt("[]", out);
+    CHECK(out == "lle");
+
+    // Round trips
+    std::string_view msgs[] = {
+            "d4:argsd5:countli1ei2ei3ee4:name6:h\xc3\xa9lloe2:idi17e3:rpc4:pinge",
+            "ld1:ai-1eed1:bldeeee",
+            "5:a\nb\tc",
+    };
+    for (auto msg : msgs)
+        CHECK(json_to_bt(bt_to_json(msg)) == msg);
+
+    for (std::string_view bad : {"", "1.5", "1e3", "01", "-", "null", "[null]", "{\"a\":1,}",
+                                 "[1 2]", "{\"a\" 1}", "{1:2}", "\"\\ud800\"", "\"\\udc00\"",
+                                 "\"\\x\"", "\"a\nb\"", "\"abc", "18446744073709551616",
+                                 "-9223372036854775809", "{} x", "tru", "[1]]"})
+        CHECK_THROWS_AS(json_to_bt(bad), std::invalid_argument);
+    CHECK_THROWS_AS(json_to_bt(std::string(600, '[') + std::string(600, ']')),
+                    std::invalid_argument);
+
+    // Appending an object's members to a dict producer
+    bt_dict_producer d;
+    d.append("a", 1);
+    json_to_bt(R"({"c":2,"b":1})", d);
+    d.append("z", 0);
+    CHECK(d.view() == "d1:ai1e1:bi1e1:ci2e1:zi0ee");
+    CHECK_THROWS_AS(json_to_bt("[1]", d), std::invalid_argument);
+}
+
 #ifdef OXENC_APPLE_TO_CHARS_WORKAROUND
 TEST_CASE("apple to_chars workaround test", "[bt][apple][sucks]") {
     char buf[20];